@@ -11,6 +11,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "mod/learned_index.h"
 
 namespace leveldb {
 
@@ -29,6 +30,10 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
     }
 
     TableBuilder* builder = new TableBuilder(options, file);
+    if (adgMod::learn_on_build &&
+        (adgMod::MOD == 6 || adgMod::MOD == 7 || adgMod::MOD == 9)) {
+      builder->TrainModel(adgMod::file_data->GetModel(meta->number));
+    }
     meta->smallest.DecodeFrom(iter->key());
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
@@ -9,6 +9,8 @@
 
 #include <algorithm>
 #include <atomic>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -47,15 +49,40 @@ const int kNumNonTableCacheFiles = 10;
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu)
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
+      : batch(nullptr), sync(false), done(false), relocation(false), cv(mu) {}
 
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+  bool relocation;  // Checks its keys itself, so it is never grouped
   port::CondVar cv;
 };
 
+// The memtables and Version a read looks into, pinned together so that a
+// reader can take all three at once.  refs is only changed under mutex_.
+struct DBImpl::SuperVersion {
+  MemTable* mem;
+  MemTable* imm;
+  Version* current;
+  uint64_t number;
+  int refs;
+};
+
+// The super version a thread last read with.  It owns one reference to it.
+// Holds InUse() while the thread is reading, and null once an install has
+// dropped the cached copy.
+struct DBImpl::SuperVersionSlot {
+  std::atomic<SuperVersion*> sv{nullptr};
+
+  static SuperVersion* InUse() {
+    static char marker;
+    return reinterpret_cast<SuperVersion*>(&marker);
+  }
+};
+
+static std::atomic<uint64_t> next_db_id(1);
+
 struct DBImpl::CompactionState {
   // Files produced by compaction
   struct Output {
@@ -71,7 +98,9 @@ struct DBImpl::CompactionState {
         smallest_snapshot(0),
         outfile(nullptr),
         builder(nullptr),
-        total_bytes(0) {}
+        total_bytes(0),
+        start(nullptr),
+        end(nullptr) {}
 
   Compaction* const compaction;
 
@@ -88,6 +117,24 @@ struct DBImpl::CompactionState {
   TableBuilder* builder;
 
   uint64_t total_bytes;
+
+  // User key range [*start, *end) merged into this state when the compaction
+  // is split into subcompactions.  nullptr means unbounded.
+  const std::string* start;
+  const std::string* end;
+  Compaction::Cursor cursor;
+};
+
+// One subcompaction running on its own thread
+struct DBImpl::Subcompaction {
+  DBImpl* db;
+  CompactionState* state;
+  Status status;
+
+  // Signalled through done_cv once every thread has finished
+  port::Mutex* done_mu;
+  port::CondVar* done_cv;
+  int* running;
 };
 
 // Fix user-supplied options to be reasonable
@@ -107,6 +154,7 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  ClipToRange(&result.max_subcompactions, 1, 64);
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -125,7 +173,9 @@ Options SanitizeOptions(const std::string& dbname,
 
 static int TableCacheSize(const Options& sanitized_options) {
   // Reserve ten files or so for other uses and give the rest to TableCache.
-  return /*sanitized_options.max_open_files*/ (int) adgMod::fd_limit - kNumNonTableCacheFiles;
+  const int table_files = /*sanitized_options.max_open_files*/ (int) adgMod::fd_limit - kNumNonTableCacheFiles;
+  // A table opened for direct reads holds a second file descriptor, for its O_DIRECT file
+  return sanitized_options.direct_reads ? table_files / 2 : table_files;
 }
 
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
@@ -146,23 +196,34 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       has_imm_(false),
       logfile_(nullptr),
       logfile_number_(0),
+      mem_vlog_start_(0),
       log_(nullptr),
       seed_(0),
       tmp_batch_(new WriteBatch),
       background_compaction_scheduled_(false),
+      background_gc_scheduled_(false),
+      stop_vlog_gc_(false),
+      background_learn_scheduled_(false),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
                                &internal_comparator_)),
-      version_count(0) {
+      version_count(0),
+      super_version_(nullptr),
+      super_version_number_(0),
+      id_(next_db_id.fetch_add(1)) {
         adgMod::db = this;
-        vlog = new adgMod::VLog(dbname_ + "/vlog.txt");
+        vlog = new adgMod::VLog(dbname_);
       }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish.
   mutex_.Lock();
+  stop_vlog_gc_.store(true, std::memory_order_release);
+  while (background_gc_scheduled_) {
+    background_work_finished_signal_.Wait();
+  }
   shutting_down_.store(true, std::memory_order_release);
-  while (background_compaction_scheduled_) {
+  while (background_compaction_scheduled_ || background_learn_scheduled_) {
     background_work_finished_signal_.Wait();
   }
 
@@ -170,6 +231,7 @@ DBImpl::~DBImpl() {
     CompactMemTable(imm_);
     CompactMemTable(mem_);
   }
+  ReleaseSuperVersions();
 
   mutex_.Unlock();
 
@@ -396,6 +458,14 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
     versions_->MarkFileNumberUsed(logs[i]);
   }
 
+  if (adgMod::MOD >= 7) {
+    s = RecoverVlog(edit, &max_sequence);
+    if (!s.ok()) {
+      return s;
+    }
+    *save_manifest = true;
+  }
+
   if (versions_->LastSequence() < max_sequence) {
     versions_->SetLastSequence(max_sequence);
   }
@@ -523,6 +593,104 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
+Status DBImpl::RecoverVlog(VersionEdit* edit, SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  // The values are appended at the head of the write queue, so the records
+  // past the head are the writes of the memtables lost, in sequence order.
+  // A descriptor without a head was written before the vlog was the log, and
+  // its writes are all in tables.
+  Status status = vlog->Open();
+  if (!status.ok()) {
+    return status;
+  }
+  if (versions_->HasVlogHead()) {
+    const uint64_t kStepBytes = 1 << 20;
+    SequenceNumber sequence =
+        std::max(versions_->LastSequence(), *max_sequence) + 1;
+    uint64_t address = versions_->VlogHead();
+    std::string scratch;
+    std::vector<adgMod::VLogRecord> records;
+    WriteBatch batch;
+    char buffer[adgMod::kVlogPointerSize];
+    std::string inline_value;
+    MemTable* mem = nullptr;
+    while (true) {
+      uint64_t next;
+      Status s = vlog->ReadRecords(address, kStepBytes, &scratch, &records,
+                                   &next);
+      if (s.IsCorruption()) {
+        Log(options_.info_log, "Vlog replay: %s", s.ToString().c_str());
+        uint64_t later;
+        if (vlog->NextSegment(address, &later)) {
+          // The segment before a new one is synced first, so a bad record
+          // in it is damage rather than a write cut short, and the writes
+          // after it would be lost
+          status = s;
+        } else if (options_.paranoid_checks) {
+          // A write cut short by the crash in the last segment, and no
+          // record after it is replayed
+          status = s;
+        }
+        break;
+      } else if (!s.ok() && !s.IsNotFound()) {
+        status = s;
+        break;
+      }
+      if (records.empty()) {
+        // The segment is done, or there is none at address
+        if (!vlog->NextSegment(address, &address)) break;
+        continue;
+      }
+      address = next;
+
+      batch.Clear();
+      for (const adgMod::VLogRecord& record : records) {
+        if (record.deletion) {
+          batch.Delete(record.key);
+        } else if (record.value.size() < adgMod::vlog_value_threshold) {
+          adgMod::EncodeInlineValue(record.value, &inline_value);
+          batch.Put(record.key, inline_value);
+        } else {
+          adgMod::EncodeVlogPointer(buffer, record.value_address,
+                                    record.value.size());
+          batch.Put(record.key, Slice(buffer, sizeof(buffer)));
+        }
+      }
+      WriteBatchInternal::SetSequence(&batch, sequence);
+      sequence += WriteBatchInternal::Count(&batch);
+      if (mem == nullptr) {
+        mem = new MemTable(internal_comparator_);
+        mem->Ref();
+      }
+      status = WriteBatchInternal::InsertInto(&batch, mem);
+      if (!status.ok()) break;
+
+      if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+        status = WriteLevel0Table(mem, edit, nullptr);
+        mem->Unref();
+        mem = nullptr;
+        if (!status.ok()) break;
+      }
+    }
+    if (mem != nullptr) {
+      if (status.ok()) status = WriteLevel0Table(mem, edit, nullptr);
+      mem->Unref();
+    }
+    if (status.ok() && sequence - 1 > *max_sequence) {
+      *max_sequence = sequence - 1;
+    }
+    Log(options_.info_log, "Replayed vlog from %llu: %s",
+        (unsigned long long)versions_->VlogHead(), status.ToString().c_str());
+  }
+
+  if (status.ok()) {
+    mem_vlog_start_ = vlog->End();
+    edit->SetVlogHead(mem_vlog_start_);
+    vlog->SetHead(mem_vlog_start_);
+  }
+  return status;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
@@ -537,7 +705,14 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    if (adgMod::MOD >= 7) {
+      // The table refers to the values by address, and once the vlog head
+      // passes them they are not replayed after a crash
+      s = vlog->Sync();
+    }
+    if (s.ok()) {
+      s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    }
     mutex_.Lock();
   }
 
@@ -602,14 +777,17 @@ int DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+    if (adgMod::MOD >= 7) edit.SetVlogHead(mem_vlog_start_);
     s = versions_->LogAndApply(&edit, &mutex_);
   }
 
   if (s.ok()) {
     // Commit to the new state
+    if (adgMod::MOD >= 7) vlog->SetHead(mem_vlog_start_);
     imm_->Unref();
     imm_ = nullptr;
     has_imm_.store(false, std::memory_order_release);
+    InstallSuperVersion();
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -640,12 +818,20 @@ void DBImpl::CompactMemTable(MemTable *table) {
     Status s = WriteLevel0Table(table, &edit, base);
     base->Unref();
 
+    // Only the records written to mem_ since are left to replay
+    const uint64_t head = table == mem_ ? vlog->End() : mem_vlog_start_;
+
     // Replace immutable memtable with the generated Table
     if (s.ok()) {
         edit.SetPrevLogNumber(0);
         edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+        if (adgMod::MOD >= 7) edit.SetVlogHead(head);
         s = versions_->LogAndApply(&edit, &mutex_);
     }
+    if (s.ok()) {
+        if (adgMod::MOD >= 7) vlog->SetHead(head);
+        InstallSuperVersion();
+    }
 }
 
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
@@ -720,6 +906,20 @@ Status DBImpl::TEST_CompactMemTable() {
   return s;
 }
 
+Status DBImpl::TEST_CollectVlogSegment() {
+  MutexLock l(&mutex_);
+  while (background_gc_scheduled_) {
+    background_work_finished_signal_.Wait();
+  }
+  background_gc_scheduled_ = true;
+  mutex_.Unlock();
+  Status s = CollectVlogSegment();
+  mutex_.Lock();
+  background_gc_scheduled_ = false;
+  background_work_finished_signal_.SignalAll();
+  return s;
+}
+
 void DBImpl::RecordBackgroundError(const Status& s) {
   mutex_.AssertHeld();
   if (bg_error_.ok()) {
@@ -768,8 +968,253 @@ void DBImpl::BackgroundCall() {
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
   MaybeScheduleCompaction();
+  // and it may have dropped enough values to collect the vlog
+  MaybeScheduleVlogGC();
   background_work_finished_signal_.SignalAll();
   env_->compaction_awaiting -= 1;
+  // The levels changed by the compaction have new, unlearned models.  Level
+  // learning gives way to compactions, so it is scheduled once this one no
+  // longer counts as awaiting.
+  MaybeScheduleLevelLearning();
+}
+
+void DBImpl::MaybeScheduleLevelLearning() {
+  mutex_.AssertHeld();
+  if (adgMod::MOD != 9 || adgMod::fresh_write || background_learn_scheduled_) {
+    // No level models, or already running
+  } else if (shutting_down_.load(std::memory_order_acquire)) {
+    // DB is being deleted; no more background learning
+  } else {
+    Version* current = versions_->current();
+    for (int level = 1; level < config::kNumLevels; level++) {
+      if (current->NumFiles(level) > 0 &&
+          !current->learned_index_data_[level]->Learned()) {
+        background_learn_scheduled_ = true;
+        env_->ScheduleLearning(&DBImpl::BGLevelLearnWork, this, 0);
+        break;
+      }
+    }
+  }
+}
+
+void DBImpl::BGLevelLearnWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundLevelLearn();
+}
+
+void DBImpl::BackgroundLevelLearn() {
+  Version* current = GetCurrentVersion();
+  for (int level = 1; level < config::kNumLevels; level++) {
+    if (shutting_down_.load(std::memory_order_acquire)) break;
+    adgMod::LearnedIndexData* model = current->learned_index_data_[level].get();
+    if (current->NumFiles(level) > 0 && !model->Learned()) {
+      adgMod::LearnedIndexData::LevelLearn(new adgMod::VersionAndSelf{
+          current, version_count, model, level});
+    }
+  }
+  MutexLock l(&mutex_);
+  assert(background_learn_scheduled_);
+  background_learn_scheduled_ = false;
+  // Levels changed while this ran are learned in another pass.  Levels given
+  // up for a compaction are scheduled again when it finishes.
+  if (versions_->current() != current) {
+    MaybeScheduleLevelLearning();
+  }
+  current->Unref();
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::MaybeScheduleVlogGC() {
+  mutex_.AssertHeld();
+  if (adgMod::MOD < 7 || background_gc_scheduled_) {
+    // No vlog, or already running
+  } else if (stop_vlog_gc_.load(std::memory_order_acquire)) {
+    // DB is being deleted
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (!snapshots_.empty()) {
+    // Snapshots may still read the values at the tail
+  } else if (!vlog->NeedsGC()) {
+    // No work to be done
+  } else {
+    background_gc_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGVlogGCWork, this);
+  }
+}
+
+void DBImpl::BGVlogGCWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundVlogGC();
+}
+
+void DBImpl::BackgroundVlogGC() {
+  Status s = CollectVlogSegment();
+  MutexLock l(&mutex_);
+  assert(background_gc_scheduled_);
+  background_gc_scheduled_ = false;
+  if (s.ok()) {
+    MaybeScheduleVlogGC();
+  } else {
+    Log(options_.info_log, "Vlog collection error: %s", s.ToString().c_str());
+  }
+  background_work_finished_signal_.SignalAll();
+}
+
+Status DBImpl::CollectVlogSegment() {
+  uint64_t begin, end;
+  if (!vlog->PickSegment(&begin, &end)) return Status::OK();
+  // Read and relocate in small steps, sleeping in between to stay within
+  // vlog_gc_rate, so that foreground reads and writes are not held up
+  const uint64_t kStepBytes = 1 << 20;
+  const uint64_t start_micros = env_->NowMicros();
+
+  Status s;
+  std::string scratch, stored;
+  std::vector<adgMod::VLogRecord> records;
+  std::vector<ValueRelocation> moved;
+  // Memtables are flushed in order, so the relocations are all in tables
+  // once the last memtable written to is
+  MemTable* relocated = nullptr;
+  uint64_t offset = begin;
+  while (offset < end && s.ok()) {
+    if (stop_vlog_gc_.load(std::memory_order_acquire)) break;
+    uint64_t next;
+    s = vlog->ReadRecords(offset, std::min(kStepBytes, end - offset), &scratch,
+                          &records, &next);
+    if (s.IsCorruption()) {
+      // A write cut short by a crash ends the segment; nothing refers to it
+      s = Status::OK();
+      next = end;
+    }
+    if (!s.ok()) break;
+
+    // A record is live if its key still points at it. Deletions are dead
+    // once the segment is behind the vlog head
+    moved.clear();
+    for (const adgMod::VLogRecord& record : records) {
+      uint64_t address;
+      uint32_t size;
+      if (!record.deletion &&
+          GetStoredValue(ReadOptions(), record.key, &stored).ok() &&
+          adgMod::DecodeVlogPointer(stored, &address, &size) &&
+          address == record.value_address) {
+        moved.push_back({record.key.ToString(), record.value_address,
+                         record.value.ToString()});
+      }
+    }
+    if (!moved.empty()) s = WriteRelocations(moved, &relocated);
+    offset = next;
+
+    if (adgMod::vlog_gc_rate > 0) {
+      const uint64_t due =
+          start_micros + (offset - begin) * 1000000 / adgMod::vlog_gc_rate;
+      const uint64_t now = env_->NowMicros();
+      if (due > now) env_->SleepForMicroseconds(due - now);
+    }
+  }
+  // The new addresses must be in tables before the segment is dropped, and
+  // writing those syncs the copies
+  if (relocated != nullptr) {
+    Status flushed = FlushRelocations(relocated);
+    if (s.ok()) s = flushed;
+  }
+  if (!s.ok() || offset < end) return s;
+
+  MutexLock l(&mutex_);
+  if (snapshots_.empty()) {
+    // A snapshot taken during the pass may still read the old copies; the
+    // next pass finds them dead and drops the segment then
+    vlog->DropSegment(begin);
+  }
+  return s;
+}
+
+Status DBImpl::WriteRelocations(const std::vector<ValueRelocation>& moved,
+                                MemTable** mem) {
+  Writer w(&mutex_);
+  w.relocation = true;
+
+  MutexLock l(&mutex_);
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+
+  // May temporarily unlock and wait.
+  Status status = MakeRoomForWrite(false);
+  if (status.ok()) {
+    MemTable* current = mem_;
+    uint64_t last_sequence = versions_->LastSequence();
+    mutex_.Unlock();
+    // No write can come between these lookups and the batch, as this writer
+    // heads the queue. Appending the copies here keeps the vlog in sequence
+    // order for replay
+    WriteBatch batch;
+    std::string stored;
+    char buffer[adgMod::kVlogPointerSize];
+    bool vlog_error = false;
+    for (const ValueRelocation& r : moved) {
+      uint64_t address;
+      uint32_t size;
+      if (GetStoredValue(ReadOptions(), r.key, &stored).ok() &&
+          adgMod::DecodeVlogPointer(stored, &address, &size) &&
+          address == r.old_address) {
+        status = vlog->AddRecord(r.key, r.value, &address);
+        if (!status.ok()) {
+          vlog_error = true;
+          break;
+        }
+        adgMod::EncodeVlogPointer(buffer, address, r.value.size());
+        batch.Put(r.key, Slice(buffer, sizeof(buffer)));
+      }
+    }
+    if (status.ok() && WriteBatchInternal::Count(&batch) > 0) {
+      WriteBatchInternal::SetSequence(&batch, last_sequence + 1);
+      last_sequence += WriteBatchInternal::Count(&batch);
+      status = WriteBatchInternal::InsertInto(&batch, current);
+    }
+    mutex_.Lock();
+    if (vlog_error) {
+      RecordBackgroundError(status);
+    }
+    versions_->SetLastSequence(last_sequence);
+    if (status.ok() && WriteBatchInternal::Count(&batch) > 0 &&
+        *mem != current) {
+      if (*mem != nullptr) (*mem)->Unref();
+      *mem = current;
+      current->Ref();
+    }
+  }
+
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return status;
+}
+
+Status DBImpl::FlushRelocations(MemTable* mem) {
+  Writer w(&mutex_);
+  w.relocation = true;
+
+  MutexLock l(&mutex_);
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+  // Only writers at the head of the queue switch memtables, and a memtable
+  // that has been written to is never empty
+  Status s;
+  if (mem == mem_) s = MakeRoomForWrite(true);
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+
+  while (s.ok() && mem == imm_ && bg_error_.ok()) {
+    background_work_finished_signal_.Wait();
+  }
+  if (s.ok()) s = bg_error_;
+  mem->Unref();
+  return s;
 }
 
 void DBImpl::BackgroundCompaction() {
@@ -814,6 +1259,7 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->smallest,
                        f->largest);
     status = versions_->LogAndApply(c->edit(), &mutex_);
+    if (status.ok()) InstallSuperVersion();
 
     if (!adgMod::fresh_write) {
         adgMod::file_stats_mutex.Lock();
@@ -844,14 +1290,6 @@ void DBImpl::BackgroundCompaction() {
     DeleteObsoleteFiles();
   }
 
-  if (c != nullptr && adgMod::MOD == 9 && !adgMod::fresh_write) {
-      //TODO: enqueue updated levels
-      Version* current = versions_->current();
-      int level = c->level();
-      adgMod::LearnedIndexData::LevelLearn(new adgMod::VersionAndSelf{current, version_count, current->learned_index_data_[level].get(), level}, true);
-      adgMod::LearnedIndexData::LevelLearn(new adgMod::VersionAndSelf{current, version_count, current->learned_index_data_[level+1].get(), level+1}, true);
-  }
-
     if (c != nullptr) {
         std::set<int> changed_level;
         for (auto& item: c->edit()->deleted_files_) {
@@ -951,6 +1389,10 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   Status s = env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
     compact->builder = new TableBuilder(options_, compact->outfile);
+    if ((adgMod::learn_on_build || adgMod::compose_models) &&
+        (adgMod::MOD == 6 || adgMod::MOD == 7 || adgMod::MOD == 9)) {
+      compact->builder->TrainModel(adgMod::file_data->GetModel(file_number));
+    }
   }
   return s;
 }
@@ -1042,43 +1484,45 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  Status status = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  if (status.ok()) InstallSuperVersion();
+  return status;
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-
-  Log(options_.info_log, "Compacting %d@%d + %d@%d files",
-      compact->compaction->num_input_files(0), compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
+void DBImpl::SubcompactionThread(void* arg) {
+  Subcompaction* sub = reinterpret_cast<Subcompaction*>(arg);
+  int64_t imm_micros = 0;
+  sub->status = sub->db->DoCompactionRange(sub->state, false, &imm_micros);
+  sub->done_mu->Lock();
+  if (--*sub->running == 0) {
+    sub->done_cv->Signal();
+  }
+  sub->done_mu->Unlock();
+}
 
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == nullptr);
-  assert(compact->outfile == nullptr);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
+Status DBImpl::DoCompactionRange(CompactionState* compact, bool flush_imm,
+                                 int64_t* imm_micros) {
+  MergeSource* source;
+  Iterator* input = versions_->MakeInputIterator(compact->compaction, &source);
+  if (compact->start != nullptr) {
+    InternalKey start(*compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
   } else {
-    compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
+    input->SeekToFirst();
   }
-
-  // Release mutex while we're actually doing the compaction work
-  mutex_.Unlock();
-
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  // entries added with the model and position they come from
+  uint64_t composed_entries = 0;
 
 //  vector<string> keys;
 
   for (; input->Valid() && !shutting_down_.load(std::memory_order_acquire);) {
     // Prioritize immutable compaction work
-    if (has_imm_.load(std::memory_order_relaxed)) {
+    if (flush_imm && has_imm_.load(std::memory_order_relaxed)) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
       if (imm_ != nullptr) {
@@ -1087,15 +1531,19 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         background_work_finished_signal_.SignalAll();
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
+    if (compact->end != nullptr &&
+        user_comparator()->Compare(ExtractUserKey(key), *compact->end) >= 0) {
+      break;
+    }
 //    ParsedInternalKey parsed;
 //    ParseInternalKey(key, &parsed);
 //    keys.push_back(parsed.user_key);
 
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->compaction->ShouldStopBefore(key, &compact->cursor) &&
         compact->builder != nullptr) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -1125,7 +1573,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;  // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->cursor)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -1138,13 +1587,22 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
       last_sequence_for_key = ikey.sequence;
     }
+
+    uint64_t value_address;
+    uint32_t value_size;
+    if (drop && adgMod::MOD >= 7 && ikey.type == kTypeValue &&
+        adgMod::DecodeVlogPointer(input->value(), &value_address,
+                                  &value_size)) {
+      // Nothing refers to the value of this entry in the vlog any more
+      vlog->AddGarbage(ikey.user_key, value_address, value_size);
+    }
 #if 0
     Log(options_.info_log,
         "  Compact: %s, seq %d, type: %d %d, drop: %d, is_base: %d, "
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key, &compact->cursor),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -1160,7 +1618,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      const adgMod::LearnedIndexData* model;
+      uint64_t position;
+      if (source != nullptr && source->CurrentSource(&model, &position)) {
+        compact->builder->Add(key, input->value(), model, position);
+        ++composed_entries;
+      } else {
+        compact->builder->Add(key, input->value());
+      }
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -1186,6 +1651,88 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   }
   delete input;
   input = nullptr;
+  adgMod::levelled_counters[16].Increment(compact->compaction->level() + 1,
+                                          composed_entries);
+  return status;
+}
+
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = env_->NowMicros();
+  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
+
+  Log(options_.info_log, "Compacting %d@%d + %d@%d files",
+      compact->compaction->num_input_files(0), compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1);
+
+  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == nullptr);
+  assert(compact->outfile == nullptr);
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
+  }
+
+  // Release mutex while we're actually doing the compaction work
+  mutex_.Unlock();
+
+  std::vector<std::string> boundaries;
+  compact->compaction->GetSubcompactionBoundaries(options_.max_subcompactions,
+                                                  &boundaries);
+  Status status;
+  if (boundaries.empty()) {
+    status = DoCompactionRange(compact, true, &imm_micros);
+  } else {
+    // Sub-range i is [boundaries[i-1], boundaries[i]).  The first one is
+    // merged on this thread, which also keeps flushing the memtable.
+    const int n = boundaries.size() + 1;
+    std::vector<Subcompaction> subs(n);
+    for (int i = 0; i < n; i++) {
+      CompactionState* state = new CompactionState(compact->compaction);
+      state->smallest_snapshot = compact->smallest_snapshot;
+      state->start = i > 0 ? &boundaries[i - 1] : nullptr;
+      state->end = i < n - 1 ? &boundaries[i] : nullptr;
+      subs[i].db = this;
+      subs[i].state = state;
+    }
+    Log(options_.info_log, "Compaction split into %d subcompactions", n);
+
+    port::Mutex done_mu;
+    port::CondVar done_cv(&done_mu);
+    int running = n - 1;
+    for (int i = 1; i < n; i++) {
+      subs[i].done_mu = &done_mu;
+      subs[i].done_cv = &done_cv;
+      subs[i].running = &running;
+      env_->StartThread(&DBImpl::SubcompactionThread, &subs[i]);
+    }
+    subs[0].status = DoCompactionRange(subs[0].state, true, &imm_micros);
+    done_mu.Lock();
+    while (running > 0) {
+      done_cv.Wait();
+    }
+    done_mu.Unlock();
+
+    // Outputs of consecutive sub-ranges are disjoint and sorted, so they can
+    // be installed by the single edit of this compaction.
+    for (int i = 0; i < n; i++) {
+      CompactionState* state = subs[i].state;
+      if (status.ok()) {
+        status = subs[i].status;
+      }
+      compact->outputs.insert(compact->outputs.end(), state->outputs.begin(),
+                              state->outputs.end());
+      compact->total_bytes += state->total_bytes;
+      if (state->builder != nullptr) {
+        state->builder->Abandon();
+        delete state->builder;
+      }
+      delete state->outfile;
+      delete state;
+    }
+  }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros - imm_micros;
@@ -1276,13 +1823,94 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
+  Status s = GetStoredValue(options, key, value);
+
+  // if Wisckey based implementation, need to read the value log to get the actual value
+  if (adgMod::MOD >= 7 && s.ok()) {
+    s = ReadVlogValue(options, key, value, value);
+  }
+  return s;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   PinnableSlice* value) {
+  value->Reset();
+  std::string* stored = value->GetSelf();
+  Status s = GetStoredValue(options, key, stored);
+  if (!s.ok()) {
+    return s;
+  }
+  // Sealed vlog segments are mapped, so the value is not copied at all
+  if (adgMod::MOD >= 7) {
+    return ReadVlogValue(options, key, stored, value);
+  }
+  value->PinSelf();
+  return s;
+}
+
+namespace {
+
+// *stored holds a value kept inline; drop its tag and padding.  The string
+// overload is for reading into *stored itself
+void SetInlineValue(std::string* stored, std::string* value) {
+  assert(stored == value);
+  const Slice inline_value = adgMod::DecodeInlineValue(*stored);
+  const size_t size = inline_value.size();
+  value->erase(0, inline_value.data() - stored->data());
+  value->resize(size);
+}
+
+void SetInlineValue(std::string* stored, PinnableSlice* value) {
+  assert(stored == value->GetSelf());
+  SetInlineValue(stored, stored);
+  value->PinSelf();
+}
+
+}  // namespace
+
+template <typename Value>
+Status DBImpl::ReadVlogValue(const ReadOptions& options, const Slice& key,
+                             std::string* stored, Value* value) {
+  uint64_t reclaimed_address = ~static_cast<uint64_t>(0);
+  while (true) {
+#ifdef INTERNAL_TIMER
+    adgMod::Stats* instance = adgMod::Stats::GetInstance();
+    instance->StartTimer(12);
+#endif
+    uint64_t value_address;
+    uint32_t value_size;
+    if (!adgMod::DecodeVlogPointer(*stored, &value_address, &value_size)) {
+      SetInlineValue(stored, value);
+      return Status::OK();
+    }
+    Status read = vlog->ReadRecord(value_address, value_size, value);
+#ifdef INTERNAL_TIMER
+    instance->PauseTimer(12);
+#endif
+    if (!read.IsNotFound()) return read;
+    // The value was relocated by vlog collection meanwhile: its new address is
+    // in the LSM by now
+    if (value_address == reclaimed_address) {
+      return Status::Corruption("value reclaimed from the vlog", key);
+    }
+    reclaimed_address = value_address;
+    Status s = GetStoredValue(options, key, stored);
+    if (!s.ok()) return s;
+  }
+}
+
+Status DBImpl::GetStoredValue(const ReadOptions& options, const Slice& key,
+                              std::string* value) {
 
   adgMod::Stats* instance = adgMod::Stats::GetInstance();
 
 
 
   Status s;
-  MutexLock l(&mutex_);
+  // Pin the memtables and Version before reading the sequence, so that every
+  // write up to the snapshot is in one of them
+  SuperVersionSlot* slot;
+  SuperVersion* sv = AcquireSuperVersion(&slot);
   SequenceNumber snapshot;
   if (options.snapshot != nullptr) {
     snapshot =
@@ -1291,21 +1919,17 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
     snapshot = versions_->LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  Version* current = sv->current;
 
   bool have_stat_update = false;
   Version::GetStats stats;
 
 
 
-  // Unlock while reading from files and memtables
+  // Read from files and memtables without holding mutex_
   {
-    mutex_.Unlock();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
 #ifdef INTERNAL_TIMER
@@ -1333,32 +1957,207 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
 #endif
       s = current->Get(options, lkey, value, &stats);
     }
-
-    // if Wisckey based implementation, need to read the value log to get the actual value
-    if (adgMod::MOD >= 7 && s.ok()) {
-#ifdef INTERNAL_TIMER
-      instance->StartTimer(12);
-#endif
-      uint64_t value_address = DecodeFixed64(value->c_str());
-      uint32_t value_size = DecodeFixed32(value->c_str() + sizeof(uint64_t));
-      *value = std::move(vlog->ReadRecord(value_address, value_size));
-#ifdef INTERNAL_TIMER
-      instance->PauseTimer(12);
-#endif
-    }
-    mutex_.Lock();
   }
 
 //  if (have_stat_update && current->UpdateStats(stats)) {
 //    MaybeScheduleCompaction();
 //  }
 
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
-  current->Unref();
+  ReleaseSuperVersion(slot, sv);
   return s;
 }
 
+void DBImpl::MultiGet(const ReadOptions& options,
+                      const std::vector<Slice>& keys,
+                      std::vector<std::string>* values,
+                      std::vector<Status>* statuses) {
+  const size_t n = keys.size();
+  values->assign(n, std::string());
+  statuses->assign(n, Status::NotFound(Slice()));
+  if (n == 0) return;
+
+  SuperVersionSlot* slot;
+  SuperVersion* sv = AcquireSuperVersion(&slot);
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  // Probe in key order, so that the keys falling in one table are adjacent
+  const Comparator* ucmp = user_comparator();
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return ucmp->Compare(keys[a], keys[b]) < 0;
+  });
+
+  // Settle what the memtables can answer, and leave the rest to the Version
+  std::deque<LookupKey> lookup_keys;
+  std::vector<size_t> pending;
+  std::vector<const LookupKey*> pending_keys;
+  std::vector<std::string*> pending_values;
+  for (size_t i : order) {
+    lookup_keys.emplace_back(keys[i], snapshot);
+    const LookupKey& lkey = lookup_keys.back();
+    Status s;
+    if (sv->mem->Get(lkey, &(*values)[i], &s) ||
+        (sv->imm != nullptr && sv->imm->Get(lkey, &(*values)[i], &s))) {
+      (*statuses)[i] = s;
+    } else {
+      pending.push_back(i);
+      pending_keys.push_back(&lkey);
+      pending_values.push_back(&(*values)[i]);
+    }
+  }
+  if (!pending.empty()) {
+    std::vector<Status> pending_statuses;
+    sv->current->MultiGet(options, pending_keys, pending_values,
+                          &pending_statuses);
+    for (size_t p = 0; p < pending.size(); p++) {
+      (*statuses)[pending[p]] = pending_statuses[p];
+    }
+  }
+  ReleaseSuperVersion(slot, sv);
+
+  // if Wisckey based implementation, need to read the value log to get the actual values
+  if (adgMod::MOD >= 7) {
+    for (size_t i = 0; i < n; i++) {
+      if (!(*statuses)[i].ok()) continue;
+      std::string* value = &(*values)[i];
+      uint64_t value_address;
+      uint32_t value_size;
+      if (!adgMod::DecodeVlogPointer(*value, &value_address, &value_size)) {
+        SetInlineValue(value, value);
+      } else {
+        (*statuses)[i] = vlog->ReadRecord(value_address, value_size, value);
+        if ((*statuses)[i].IsNotFound()) {
+          // Relocated by vlog collection meanwhile
+          (*statuses)[i] = Get(options, keys[i], value);
+        }
+      }
+    }
+  }
+}
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  assert(mem_ != nullptr);
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->current = versions_->current();
+  sv->mem->Ref();
+  if (sv->imm != nullptr) sv->imm->Ref();
+  sv->current->Ref();
+  sv->number = super_version_number_.load(std::memory_order_relaxed) + 1;
+  sv->refs = 1;
+
+  SuperVersion* old = super_version_;
+  super_version_ = sv;
+  super_version_number_.store(sv->number, std::memory_order_release);
+  if (old != nullptr) UnrefSuperVersion(old);
+
+  // A slot in use keeps its super version until the reader hands it back
+  // and finds the slot emptied.
+  for (size_t i = 0; i < super_version_slots_.size();) {
+    SuperVersion* cached = super_version_slots_[i]->sv.exchange(nullptr);
+    if (cached != nullptr && cached != SuperVersionSlot::InUse()) {
+      UnrefSuperVersion(cached);
+    }
+    if (super_version_slots_[i].use_count() == 1) {
+      // the thread has exited
+      super_version_slots_[i] = super_version_slots_.back();
+      super_version_slots_.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+void DBImpl::ReleaseSuperVersions() {
+  mutex_.AssertHeld();
+  for (const auto& slot : super_version_slots_) {
+    SuperVersion* cached = slot->sv.exchange(nullptr);
+    assert(cached != SuperVersionSlot::InUse());
+    if (cached != nullptr) UnrefSuperVersion(cached);
+  }
+  super_version_slots_.clear();
+  if (super_version_ != nullptr) {
+    UnrefSuperVersion(super_version_);
+    super_version_ = nullptr;
+  }
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  assert(sv->refs > 0);
+  if (--sv->refs == 0) {
+    sv->mem->Unref();
+    if (sv->imm != nullptr) sv->imm->Unref();
+    sv->current->Unref();
+    delete sv;
+  }
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion(SuperVersionSlot** slot) {
+  *slot = LocalSuperVersionSlot();
+  SuperVersion* sv = (*slot)->sv.exchange(SuperVersionSlot::InUse(),
+                                          std::memory_order_acquire);
+  if (sv != nullptr &&
+      sv->number == super_version_number_.load(std::memory_order_acquire)) {
+    return sv;
+  }
+
+  MutexLock l(&mutex_);
+  if (sv != nullptr) UnrefSuperVersion(sv);
+  sv = super_version_;
+  sv->refs++;
+  return sv;
+}
+
+void DBImpl::ReleaseSuperVersion(SuperVersionSlot* slot, SuperVersion* sv) {
+  SuperVersion* expected = SuperVersionSlot::InUse();
+  if (slot->sv.compare_exchange_strong(expected, sv,
+                                       std::memory_order_release)) {
+    return;
+  }
+  // An install emptied the slot while sv was in use
+  MutexLock l(&mutex_);
+  UnrefSuperVersion(sv);
+}
+
+DBImpl::SuperVersionSlot* DBImpl::LocalSuperVersionSlot() {
+  // This thread's slots by DB id, and the one used last
+  struct LocalSlots {
+    uint64_t last_id = 0;
+    SuperVersionSlot* last = nullptr;
+    std::map<uint64_t, std::shared_ptr<SuperVersionSlot>> slots;
+  };
+  static thread_local LocalSlots local;
+  if (local.last_id == id_) return local.last;
+
+  std::shared_ptr<SuperVersionSlot>& slot = local.slots[id_];
+  if (slot == nullptr) {
+    // Slots no DB refers to any more belong to closed DBs
+    for (auto iter = local.slots.begin(); iter != local.slots.end();) {
+      if (iter->second != nullptr && iter->second.use_count() == 1) {
+        iter = local.slots.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    slot = std::make_shared<SuperVersionSlot>();
+    MutexLock l(&mutex_);
+    super_version_slots_.push_back(slot);
+  }
+  local.last_id = id_;
+  local.last = slot.get();
+  return local.last;
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1390,21 +2189,59 @@ void DBImpl::ReleaseSnapshot(const Snapshot* snapshot) {
 
 // Convenience methods
 Status DBImpl::Put(const WriteOptions& o, const Slice& key, const Slice& val) {
-  if (adgMod::MOD >= 7) {
-    uint64_t value_address = adgMod::db->vlog->AddRecord(key, val);
-    char buffer[sizeof(uint64_t) + sizeof(uint32_t)];
-    EncodeFixed64(buffer, value_address);
-    EncodeFixed32(buffer + sizeof(uint64_t), val.size());
-    return DB::Put(o, key, (Slice) {buffer, sizeof(uint64_t) + sizeof(uint32_t)});
-  } else {
-    return DB::Put(o, key, val);
-  }
+  return DB::Put(o, key, val);
 }
 
 Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+namespace {
+
+// Appends the updates of a batch to the vlog, and collects the same updates
+// with each value tagged, and replaced by its address and size unless it is
+// kept inline
+class VlogAppender : public WriteBatch::Handler {
+ public:
+  VlogAppender(adgMod::VLog* vlog, WriteBatch* addresses)
+      : vlog_(vlog), addresses_(addresses) {}
+
+  virtual void Put(const Slice& key, const Slice& value) {
+    if (!status_.ok()) return;
+    uint64_t address;
+    status_ = vlog_->AddRecord(key, value, &address);
+    if (!status_.ok()) return;
+    if (value.size() < adgMod::vlog_value_threshold) {
+      // Small enough that a second read would cost more than keeping it in
+      // the tables.  The record is only there to replay after a crash
+      vlog_->AddGarbage(key, address, value.size());
+      adgMod::EncodeInlineValue(value, &inline_value_);
+      addresses_->Put(key, inline_value_);
+      return;
+    }
+    char buffer[adgMod::kVlogPointerSize];
+    adgMod::EncodeVlogPointer(buffer, address, value.size());
+    addresses_->Put(key, Slice(buffer, sizeof(buffer)));
+  }
+
+  virtual void Delete(const Slice& key) {
+    if (!status_.ok()) return;
+    status_ = vlog_->AddDeletion(key);
+    if (status_.ok()) addresses_->Delete(key);
+  }
+
+  // The first append that failed; the updates after it were skipped
+  const Status& status() const { return status_; }
+
+ private:
+  adgMod::VLog* const vlog_;
+  WriteBatch* const addresses_;
+  std::string inline_value_;
+  Status status_;
+};
+
+}  // namespace
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   Writer w(&mutex_);
   w.batch = updates;
@@ -1434,6 +2271,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
     // and protects against concurrent loggers and concurrent writes
     // into mem_.
     {
+      bool vlog_error = false;
       mutex_.Unlock();
       if (adgMod::MOD < 7) {
           status = log_->AddRecord(WriteBatchInternal::Contents(updates));
@@ -1444,12 +2282,36 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
                   sync_error = true;
               }
           }
-      }
 
-      if (status.ok()) {
-        status = WriteBatchInternal::InsertInto(updates, mem_);
+          if (status.ok()) {
+            status = WriteBatchInternal::InsertInto(updates, mem_);
+          }
+      } else {
+          // The vlog is the log: the values are appended there in sequence
+          // order, and the memtable gets their addresses
+          WriteBatch addresses;
+          VlogAppender appender(vlog, &addresses);
+          status = updates->Iterate(&appender);
+          if (status.ok()) {
+            status = appender.status();
+          }
+          if (status.ok() && options.sync) {
+              status = vlog->Sync();
+          }
+          vlog_error = !status.ok();
+
+          if (status.ok()) {
+            WriteBatchInternal::SetSequence(
+                &addresses, WriteBatchInternal::Sequence(updates));
+            status = WriteBatchInternal::InsertInto(&addresses, mem_);
+          }
       }
       mutex_.Lock();
+      if (vlog_error) {
+        // Part of the batch may be in the vlog and replayed after a crash,
+        // so no write may follow it
+        RecordBackgroundError(status);
+      }
 //      if (sync_error) {
 //        // The state of the log file is indeterminate: the log record we
 //        // just added may or may not show up when the DB is re-opened.
@@ -1510,6 +2372,11 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       break;
     }
 
+    if (w->relocation) {
+      // Vlog relocations must check their keys at the head of the queue
+      break;
+    }
+
     if (w->batch != nullptr) {
       size += WriteBatchInternal::ByteSize(w->batch);
       if (size > max_size) {
@@ -1595,6 +2462,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       has_imm_.store(true, std::memory_order_release);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      if (adgMod::MOD >= 7) {
+        // Nothing is appended to the vlog unless at the head of the queue
+        mem_vlog_start_ = vlog->End();
+      }
+      InstallSuperVersion();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
     }
@@ -1703,6 +2575,27 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::MultiGet(const ReadOptions& options, const std::vector<Slice>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) {
+  values->assign(keys.size(), std::string());
+  statuses->resize(keys.size());
+  ReadOptions snapshot_options = options;
+  if (options.snapshot == nullptr) snapshot_options.snapshot = GetSnapshot();
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*statuses)[i] = Get(snapshot_options, keys[i], &(*values)[i]);
+  }
+  if (options.snapshot == nullptr) ReleaseSnapshot(snapshot_options.snapshot);
+}
+
+Status DB::Get(const ReadOptions& options, const Slice& key,
+               PinnableSlice* value) {
+  value->Reset();
+  Status s = Get(options, key, value->GetSelf());
+  if (s.ok()) value->PinSelf();
+  return s;
+}
+
 DB::~DB() {}
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
@@ -1739,6 +2632,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallSuperVersion();
     impl->DeleteObsoleteFiles();
     //impl->MaybeScheduleCompaction();
     impl->versions_->current()->ReadLevelModel();
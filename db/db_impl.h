@@ -7,8 +7,10 @@
 
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 #include <mod/Vlog.h>
 
 #include "db/dbformat.h"
@@ -42,6 +44,12 @@ class DBImpl : public DB {
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value);
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value);
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -57,6 +65,10 @@ class DBImpl : public DB {
   // Force current memtable contents to be compacted.
   Status TEST_CompactMemTable();
 
+  // Collect one vlog segment, if one is dead enough, after any collection
+  // running in the background.
+  Status TEST_CollectVlogSegment();
+
   // Return an internal iterator over the current state of the database.
   // The keys of this iterator are internal keys (see format.h).
   // The returned iterator should be deleted when no longer needed.
@@ -88,7 +100,17 @@ private:
   friend class DB;
   friend class TableCache;
   struct CompactionState;
+  struct Subcompaction;
   struct Writer;
+  struct SuperVersion;
+  struct SuperVersionSlot;
+
+  // A live value that vlog garbage collection is to append again
+  struct ValueRelocation {
+    std::string key;
+    uint64_t old_address;
+    std::string value;
+  };
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -119,6 +141,18 @@ private:
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
 
+  // Get without reading the vlog: with MOD >= 7, *value is tagged, and holds
+  // either the value or its address and size in the vlog.
+  Status GetStoredValue(const ReadOptions& options, const Slice& key,
+                        std::string* value) LOCKS_EXCLUDED(mutex_);
+  // Set *value, a std::string or PinnableSlice, to the value that *stored,
+  // the result of GetStoredValue for key, holds or points at in the vlog.
+  // *stored is looked up again if the record has been relocated.
+  template <typename Value>
+  Status ReadVlogValue(const ReadOptions& options, const Slice& key,
+                       std::string* stored, Value* value)
+      LOCKS_EXCLUDED(mutex_);
+
   Status NewDB();
 
   // Recover the descriptor from persistent storage.  May do a significant
@@ -141,6 +175,10 @@ private:
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Writes the vlog records past the head to tables; the vlog stands in for
+  // the log when values are kept there.
+  Status RecoverVlog(VersionEdit* edit, SequenceNumber* max_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -154,18 +192,66 @@ private:
 
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Learn the level models of the current version that are not learned on
+  // the learning thread, off the compaction path (MOD 9).  Until a model is
+  // installed, lookups in its level fall back to FindFile.
+  void MaybeScheduleLevelLearning() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGLevelLearnWork(void* db);
+  void BackgroundLevelLearn() LOCKS_EXCLUDED(mutex_);
+
+  // Collect a vlog segment in a thread of its own once enough of it is
+  // dead.
+  void MaybeScheduleVlogGC() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGVlogGCWork(void* db);
+  void BackgroundVlogGC() LOCKS_EXCLUDED(mutex_);
+  // Append the live records of the deadest vlog segment again, point their
+  // keys at the copies and delete the segment.
+  Status CollectVlogSegment() LOCKS_EXCLUDED(mutex_);
+  // Append the values of moved again and point their keys at the copies,
+  // unless they were overwritten or deleted since they were found live.  *mem
+  // is set to a reference to the memtable they went into.
+  Status WriteRelocations(const std::vector<ValueRelocation>& moved,
+                          MemTable** mem) LOCKS_EXCLUDED(mutex_);
+  // Wait until mem, switched out first if it is still mem_, is written to a
+  // table, and drop the reference to it.
+  Status FlushRelocations(MemTable* mem) LOCKS_EXCLUDED(mutex_);
+
     void BackgroundCall();
   void BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Merge the input entries within the key range of *compact into its
+  // outputs.  If flush_imm, the immutable memtable is compacted in between
+  // whenever one is waiting, and the time spent is added to *imm_micros.
+  Status DoCompactionRange(CompactionState* compact, bool flush_imm,
+                           int64_t* imm_micros) LOCKS_EXCLUDED(mutex_);
+  static void SubcompactionThread(void* arg);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Replace super_version_ with one holding the current mem_, imm_ and
+  // Version, and drop the older ones cached by reader threads.  Called
+  // whenever any of the three changes.
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Drop every cached super version and super_version_ itself.
+  void ReleaseSuperVersions() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UnrefSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Pin the latest super version for a read.  Takes mutex_ only when this
+  // thread has no up-to-date super version cached in *slot.
+  SuperVersion* AcquireSuperVersion(SuperVersionSlot** slot)
+      LOCKS_EXCLUDED(mutex_);
+  // Hand sv back to the thread's cache, or unref it if it was dropped
+  // meanwhile.
+  void ReleaseSuperVersion(SuperVersionSlot* slot, SuperVersion* sv)
+      LOCKS_EXCLUDED(mutex_);
+  SuperVersionSlot* LocalSuperVersionSlot() LOCKS_EXCLUDED(mutex_);
+
   const Comparator* user_comparator() const {
     return internal_comparator_.user_comparator();
   }
@@ -194,6 +280,8 @@ private:
   std::atomic<bool> has_imm_;         // So bg thread can detect non-null imm_
   WritableFile* logfile_;
   uint64_t logfile_number_ GUARDED_BY(mutex_);
+  // The vlog address of the first record written to mem_
+  uint64_t mem_vlog_start_ GUARDED_BY(mutex_);
   log::Writer* log_;
   uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
 
@@ -210,6 +298,14 @@ private:
   // Has a background compaction been scheduled or is running?
   bool background_compaction_scheduled_ GUARDED_BY(mutex_);
 
+  // Is a vlog collection pass running, and should it stop early?  It is
+  // stopped before shutting_down_ is set, as it waits for compactions.
+  bool background_gc_scheduled_ GUARDED_BY(mutex_);
+  std::atomic<bool> stop_vlog_gc_;
+
+  // Has level learning been scheduled or is running?
+  bool background_learn_scheduled_ GUARDED_BY(mutex_);
+
   ManualCompaction* manual_compaction_ GUARDED_BY(mutex_);
 public:
   VersionSet* const versions_;
@@ -219,6 +315,16 @@ private:
   Status bg_error_ GUARDED_BY(mutex_);
 
   CompactionStats stats_[config::kNumLevels] GUARDED_BY(mutex_);
+
+  // Latest mem_, imm_ and Version bundled for readers, and its number, by
+  // which readers check whether their cached copy is still current.
+  SuperVersion* super_version_ GUARDED_BY(mutex_);
+  std::atomic<uint64_t> super_version_number_;
+  // One slot for each thread that has read from this DB
+  std::vector<std::shared_ptr<SuperVersionSlot>> super_version_slots_
+      GUARDED_BY(mutex_);
+  // Names this DB in the threads' slot maps, since addresses are reused
+  const uint64_t id_;
 };
 
 // Sanitize db options.  The caller should delete result.info_log if
@@ -4,7 +4,6 @@
 
 #include "leveldb/db.h"
 
-#include <atomic>
 #include <string>
 
 #include "db/db_impl.h"
@@ -15,8 +14,10 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/table.h"
+#include "mod/util.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
+#include "util/coding.h"
 #include "util/hash.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
@@ -120,6 +121,11 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Tables opened while shorten_table_reads_ is set cut the next
+  // short_table_reads_ reads in half, as if they had hit the end of the file.
+  bool shorten_table_reads_;
+  std::atomic<int> short_table_reads_;
+
   explicit SpecialEnv(Env* base)
       : EnvWrapper(base),
         delay_data_sync_(false),
@@ -128,7 +134,9 @@ class SpecialEnv : public EnvWrapper {
         non_writable_(false),
         manifest_sync_error_(false),
         manifest_write_error_(false),
-        count_random_reads_(false) {}
+        count_random_reads_(false),
+        shorten_table_reads_(false),
+        short_table_reads_(0) {}
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
     class DataFile : public WritableFile {
@@ -218,10 +226,40 @@ class SpecialEnv : public EnvWrapper {
       }
     };
 
+    class ShortReadFile : public RandomAccessFile {
+     private:
+      SpecialEnv* env_;
+      RandomAccessFile* target_;
+
+     public:
+      ShortReadFile(SpecialEnv* env, RandomAccessFile* target)
+          : env_(env), target_(target) {}
+      virtual ~ShortReadFile() { delete target_; }
+      virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) const {
+        if (n < 2 || env_->short_table_reads_.load() <= 0) {
+          return target_->Read(offset, n, result, scratch);
+        }
+        env_->short_table_reads_.fetch_sub(1);
+        // only the first half lands in scratch, the rest of it is zeroed
+        Status s = target_->Read(offset, n / 2, result, scratch);
+        if (s.ok()) {
+          memmove(scratch, result->data(), result->size());
+          memset(scratch + result->size(), 0, n - result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+    };
+
     Status s = target()->NewRandomAccessFile(f, r);
     if (s.ok() && count_random_reads_) {
       *r = new CountingFile(*r, &random_read_counter_);
     }
+    if (s.ok() && shorten_table_reads_ &&
+        strstr(f.c_str(), ".ldb") != nullptr) {
+      *r = new ShortReadFile(this, *r);
+    }
     return s;
   }
 };
@@ -573,6 +611,23 @@ TEST(DBTest, ReadWrite) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetPinnable) {
+  do {
+    ASSERT_OK(Put("foo", "v1"));
+    ASSERT_OK(Put("bar", std::string(1000, 'x')));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("foo", "v2"));
+
+    PinnableSlice value;
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &value));
+    ASSERT_EQ("v2", value.ToString());
+    ASSERT_OK(db_->Get(ReadOptions(), "bar", &value));
+    ASSERT_EQ(std::string(1000, 'x'), value.ToString());
+    ASSERT_TRUE(db_->Get(ReadOptions(), "baz", &value).IsNotFound());
+    ASSERT_TRUE(value.empty());
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, PutDeleteGet) {
   do {
     ASSERT_OK(db_->Put(WriteOptions(), "foo", "v1"));
@@ -666,6 +721,44 @@ TEST(DBTest, GetIdenticalSnapshots) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, MultiGet) {
+  do {
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("c", "vc"));
+    ASSERT_OK(Put("e", "ve"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("c", "vc2"));
+    ASSERT_OK(Delete("e"));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put("a", "va2"));
+
+    // Unsorted, with a duplicate, a deleted and missing keys
+    std::vector<Slice> keys = {"e", "a", "b", "c", "a", "z"};
+    for (int i = 0; i < 2; i++) {
+      ReadOptions options;
+      options.snapshot = (i == 0) ? nullptr : snapshot;
+      std::vector<std::string> values;
+      std::vector<Status> statuses;
+      db_->MultiGet(options, keys, &values, &statuses);
+      ASSERT_EQ(keys.size(), values.size());
+      ASSERT_EQ(keys.size(), statuses.size());
+      for (size_t k = 0; k < keys.size(); k++) {
+        std::string result = statuses[k].ok() ? values[k]
+                             : statuses[k].IsNotFound() ? "NOT_FOUND"
+                                                        : statuses[k].ToString();
+        ASSERT_EQ(Get(keys[k].ToString(), options.snapshot), result);
+      }
+    }
+    db_->ReleaseSnapshot(snapshot);
+
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    db_->MultiGet(ReadOptions(), std::vector<Slice>(), &values, &statuses);
+    ASSERT_TRUE(values.empty());
+    ASSERT_TRUE(statuses.empty());
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, IterateOverEmptySnapshot) {
   do {
     const Snapshot* snapshot = db_->GetSnapshot();
@@ -1614,6 +1707,543 @@ TEST(DBTest, ManualCompaction) {
   ASSERT_EQ("0,0,1", FilesPerLevel());
 }
 
+namespace {
+
+// Counts the compactions split into subcompactions
+class SubcompactionLogger : public Logger {
+ public:
+  SubcompactionLogger() : splits(0) {}
+  virtual void Logv(const char* format, va_list ap) {
+    if (strstr(format, "subcompactions") != nullptr) splits++;
+  }
+  std::atomic<int> splits;
+};
+
+std::string SubcompactionKey(int i) {
+  char buf[20];
+  snprintf(buf, sizeof(buf), "%016d", i);
+  return std::string(buf);
+}
+
+// The user keys of the bounds of each file of the deepest non-empty level in
+// a leveldb.sstables property
+std::vector<std::pair<std::string, std::string>> DeepestFileBounds(
+    const std::string& sstables) {
+  std::vector<std::pair<std::string, std::string>> bounds;
+  size_t pos = 0;
+  while ((pos = sstables.find('\n', pos)) != std::string::npos) {
+    const size_t line = ++pos;
+    if (sstables.compare(line, 4, "--- ") == 0) {
+      size_t next = sstables.find('\n', line);
+      if (next != std::string::npos && next + 1 < sstables.size() &&
+          sstables[next + 1] == ' ') {
+        bounds.clear();
+      }
+      continue;
+    }
+    const size_t smallest = sstables.find("['", line);
+    const size_t limit = sstables.find(".. '", line);
+    if (smallest == std::string::npos || limit == std::string::npos) continue;
+    bounds.emplace_back(
+        sstables.substr(smallest + 2,
+                        sstables.find("' @", smallest) - smallest - 2),
+        sstables.substr(limit + 4, sstables.find("' @", limit) - limit - 4));
+  }
+  return bounds;
+}
+
+}  // namespace
+
+// Compactions split into subcompactions, which learn their outputs at once
+// (MOD 6 with learn_on_build), install disjoint sorted files that never split
+// a user key.
+TEST(DBTest, Subcompactions) {
+  const int mod = adgMod::MOD;
+  const bool learn_on_build = adgMod::learn_on_build;
+  adgMod::MOD = 6;
+  adgMod::learn_on_build = true;
+
+  SubcompactionLogger logger;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.max_subcompactions = 4;
+  options.compression = kNoCompression;
+  options.max_file_size = 1 << 20;
+  options.info_log = &logger;
+  DestroyAndReopen(&options);
+
+  // Level 3 gets several files, then a level-2 file over every fifth key of
+  // their range is compacted into them.  The values are incompressible, so
+  // that the files hold few keys.
+  const int kNumKeys = 20000;
+  Random rnd(301);
+  std::vector<std::string> old_values, new_values;
+  for (int i = 0; i < kNumKeys; i++) {
+    old_values.push_back(RandomString(&rnd, 100));
+    new_values.push_back(i % 5 == 0 ? RandomString(&rnd, 100) : old_values[i]);
+    ASSERT_OK(Put(SubcompactionKey(i), old_values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(1, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(2, nullptr, nullptr);
+  ASSERT_GT(NumTableFilesAtLevel(3), 2);
+  // keep the old entries, so that the rewritten user keys have two entries
+  const Snapshot* snapshot = db_->GetSnapshot();
+  for (int i = 0; i < kNumKeys; i += 5) {
+    ASSERT_OK(Put(SubcompactionKey(i), new_values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  for (int level = 0; level < 3; level++) {
+    dbfull()->TEST_CompactRange(level, nullptr, nullptr);
+  }
+  ASSERT_GT(logger.splits.load(), 0);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(new_values[i], Get(SubcompactionKey(i)));
+    ASSERT_EQ(old_values[i], Get(SubcompactionKey(i), snapshot));
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(SubcompactionKey(count), iter->key().ToString());
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(kNumKeys, count);
+
+  std::string sstables;
+  ASSERT_TRUE(db_->GetProperty("leveldb.sstables", &sstables));
+  std::vector<std::pair<std::string, std::string>> bounds =
+      DeepestFileBounds(sstables);
+  ASSERT_GT(bounds.size(), 1);
+  for (size_t i = 0; i < bounds.size(); i++) {
+    ASSERT_LE(bounds[i].first, bounds[i].second);
+    if (i > 0) ASSERT_LT(bounds[i - 1].second, bounds[i].first);
+  }
+  ASSERT_EQ(SubcompactionKey(0), bounds.front().first);
+  ASSERT_EQ(SubcompactionKey(kNumKeys - 1), bounds.back().second);
+
+  db_->ReleaseSnapshot(snapshot);
+  Close();
+  adgMod::MOD = mod;
+  adgMod::learn_on_build = learn_on_build;
+}
+
+// Every subcompaction, not only the one starting at the first key, merges its
+// range with the learned merge and composes its outputs from the models of
+// its inputs.
+TEST(DBTest, LearnedMergeSubcompactions) {
+  const int mod = adgMod::MOD;
+  const bool learn_on_build = adgMod::learn_on_build;
+  const bool learned_merge = adgMod::learned_merge;
+  const bool compose_models = adgMod::compose_models;
+  adgMod::MOD = 6;
+  adgMod::learn_on_build = true;
+  adgMod::learned_merge = true;
+  adgMod::compose_models = true;
+
+  SubcompactionLogger logger;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.max_subcompactions = 4;
+  options.compression = kNoCompression;
+  options.max_file_size = 1 << 20;
+  options.info_log = &logger;
+  DestroyAndReopen(&options);
+
+  const int kNumKeys = 20000;
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < kNumKeys; i++) {
+    values.push_back(RandomString(&rnd, 100));
+    ASSERT_OK(Put(SubcompactionKey(i), values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(1, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(2, nullptr, nullptr);
+  ASSERT_GT(NumTableFilesAtLevel(3), 2);
+  // every fifth key again, in runs the merge can skip past
+  for (int i = 0; i < kNumKeys; i += 5) {
+    values[i] = RandomString(&rnd, 100);
+    ASSERT_OK(Put(SubcompactionKey(i), values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(1, nullptr, nullptr);
+
+  const int splits = logger.splits.load();
+  const int skipped = adgMod::levelled_counters[15].Sum();
+  const int composed = adgMod::levelled_counters[16].Sum();
+  dbfull()->TEST_CompactRange(2, nullptr, nullptr);
+  ASSERT_GT(logger.splits.load(), splits);
+  ASSERT_GT(adgMod::levelled_counters[15].Sum(), skipped);
+  // the older entries of the rewritten keys are dropped, and each of the
+  // others comes with the table it was read from
+  ASSERT_EQ(kNumKeys, adgMod::levelled_counters[16].Sum() - composed);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(values[i], Get(SubcompactionKey(i)));
+  }
+
+  Close();
+  adgMod::MOD = mod;
+  adgMod::learn_on_build = learn_on_build;
+  adgMod::learned_merge = learned_merge;
+  adgMod::compose_models = compose_models;
+}
+
+namespace {
+
+// Puts the values in a vlog of small segments for the lifetime of the object.
+// Collection is off until a test turns it on.  Tables are learned as they are
+// built, so no learning outlives the DB.
+class VlogSettings {
+ public:
+  explicit VlogSettings(int mod)
+      : mod_(adgMod::MOD),
+        learn_on_build_(adgMod::learn_on_build),
+        segment_size_(adgMod::vlog_segment_size),
+        gc_threshold_(adgMod::vlog_gc_threshold),
+        gc_rate_(adgMod::vlog_gc_rate),
+        value_threshold_(adgMod::vlog_value_threshold) {
+    adgMod::MOD = mod;
+    adgMod::learn_on_build = true;
+    adgMod::vlog_segment_size = 64 << 10;
+    adgMod::vlog_gc_threshold = 0;
+    adgMod::vlog_gc_rate = 0;
+  }
+
+  ~VlogSettings() {
+    adgMod::MOD = mod_;
+    adgMod::learn_on_build = learn_on_build_;
+    adgMod::vlog_segment_size = segment_size_;
+    adgMod::vlog_gc_threshold = gc_threshold_;
+    adgMod::vlog_gc_rate = gc_rate_;
+    adgMod::vlog_value_threshold = value_threshold_;
+  }
+
+ private:
+  const int mod_;
+  const bool learn_on_build_;
+  const uint64_t segment_size_;
+  const double gc_threshold_;
+  const uint64_t gc_rate_;
+  const uint32_t value_threshold_;
+};
+
+std::string VlogKey(int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "key%06d", i);
+  return std::string(buf);
+}
+
+int CountVlogSegments(Env* env, const std::string& dbname) {
+  std::vector<std::string> files;
+  env->GetChildren(dbname, &files);
+  int count = 0;
+  for (const std::string& file : files) {
+    if (file.size() > 5 && file.compare(file.size() - 5, 5, ".vlog") == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Reads every key until told to stop, counting the values that differ from
+// the expected ones
+struct VlogReaderState {
+  DB* db;
+  const std::vector<std::string>* expected;
+  std::atomic<bool> stop;
+  std::atomic<bool> done;
+  std::atomic<int> reads;
+  std::atomic<int> errors;
+};
+
+void VlogReaderBody(void* arg) {
+  VlogReaderState* state = reinterpret_cast<VlogReaderState*>(arg);
+  std::string value;
+  while (!state->stop.load(std::memory_order_acquire)) {
+    for (size_t i = 0; i < state->expected->size(); i++) {
+      Status s = state->db->Get(ReadOptions(), VlogKey(i), &value);
+      const std::string& expected = (*state->expected)[i];
+      if (expected.empty() ? !s.IsNotFound() : !s.ok() || value != expected) {
+        state->errors.fetch_add(1, std::memory_order_relaxed);
+      }
+      state->reads.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  state->done.store(true, std::memory_order_release);
+}
+
+}  // namespace
+
+// Fills the vlog with values, then overwrites or deletes half of them, so
+// that the first segments are half dead once compactions drop the old
+// versions.  expected gets the values left, empty for the deleted keys.
+static void FillVlogWithGarbage(DBTest* t, std::vector<std::string>* expected) {
+  const int kNumKeys = 2000;
+  Random rnd(301);
+  expected->clear();
+  for (int i = 0; i < kNumKeys; i++) {
+    expected->push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(t->Put(VlogKey(i), (*expected)[i]));
+  }
+  for (int i = 0; i < kNumKeys; i += 2) {
+    if (i % 4 == 0) {
+      (*expected)[i].clear();
+      ASSERT_OK(t->Delete(VlogKey(i)));
+    } else {
+      (*expected)[i] = RandomString(&rnd, 1000);
+      ASSERT_OK(t->Put(VlogKey(i), (*expected)[i]));
+    }
+  }
+  ASSERT_OK(t->dbfull()->TEST_CompactMemTable());
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    t->dbfull()->TEST_CompactRange(level, nullptr, nullptr);
+  }
+}
+
+static void CheckVlogValues(DBTest* t,
+                            const std::vector<std::string>& expected) {
+  for (size_t i = 0; i < expected.size(); i++) {
+    ASSERT_EQ(expected[i].empty() ? "NOT_FOUND" : expected[i],
+              t->Get(VlogKey(i)));
+  }
+}
+
+// Collection of segments holding live and dead values keeps the live ones,
+// here and after a reopen, which replays no dropped segment.
+TEST(DBTest, VlogCollection) {
+  const int mods[] = {7, 9};
+  for (int mod : mods) {
+    VlogSettings settings(mod);
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    std::vector<std::string> expected;
+    FillVlogWithGarbage(this, &expected);
+    CheckVlogValues(this, expected);
+    const int segments = CountVlogSegments(env_, dbname_);
+
+    adgMod::vlog_gc_threshold = 0.3;
+    for (int i = 0; i < segments; i++) {
+      ASSERT_OK(dbfull()->TEST_CollectVlogSegment());
+    }
+    ASSERT_LT(CountVlogSegments(env_, dbname_), segments);
+    CheckVlogValues(this, expected);
+
+    Reopen(&options);
+    CheckVlogValues(this, expected);
+    ASSERT_OK(Put(VlogKey(0), "v"));
+    expected[0] = "v";
+    Reopen(&options);
+    CheckVlogValues(this, expected);
+    Close();
+  }
+}
+
+// Reads that race with collection find each value at its old or new address.
+TEST(DBTest, VlogCollectionConcurrentReads) {
+  const int mods[] = {7, 9};
+  for (int mod : mods) {
+    VlogSettings settings(mod);
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    std::vector<std::string> expected;
+    FillVlogWithGarbage(this, &expected);
+    const int segments = CountVlogSegments(env_, dbname_);
+
+    const int kNumThreads = 4;
+    VlogReaderState state[kNumThreads];
+    for (int id = 0; id < kNumThreads; id++) {
+      state[id].db = db_;
+      state[id].expected = &expected;
+      state[id].stop.store(false, std::memory_order_release);
+      state[id].done.store(false, std::memory_order_release);
+      state[id].reads.store(0, std::memory_order_release);
+      state[id].errors.store(0, std::memory_order_release);
+      env_->StartThread(VlogReaderBody, &state[id]);
+    }
+    adgMod::vlog_gc_threshold = 0.3;
+    for (int i = 0; i < segments; i++) {
+      ASSERT_OK(dbfull()->TEST_CollectVlogSegment());
+    }
+    for (int id = 0; id < kNumThreads; id++) {
+      state[id].stop.store(true, std::memory_order_release);
+    }
+    for (int id = 0; id < kNumThreads; id++) {
+      while (!state[id].done.load(std::memory_order_acquire)) {
+        DelayMilliseconds(10);
+      }
+      ASSERT_GT(state[id].reads.load(std::memory_order_acquire), 0);
+      ASSERT_EQ(0, state[id].errors.load(std::memory_order_acquire));
+    }
+    ASSERT_LT(CountVlogSegments(env_, dbname_), segments);
+    CheckVlogValues(this, expected);
+    Close();
+  }
+}
+
+// A segment that cannot be created fails the write and every write after it,
+// and the values written before are still there after a reopen.
+TEST(DBTest, VlogSegmentCreationError) {
+  VlogSettings settings(7);
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.env = env_;
+  DestroyAndReopen(&options);
+
+  ASSERT_OK(Put("foo", "v1"));
+  env_->non_writable_.store(true, std::memory_order_release);
+  // a segment holds about 64 of these
+  std::string big(1000, 'x');
+  int written = 0;
+  Status s;
+  for (int i = 0; i < 200 && s.ok(); i++) {
+    s = Put(VlogKey(i), big);
+    if (s.ok()) written++;
+  }
+  ASSERT_TRUE(!s.ok());
+  ASSERT_TRUE(!Put("bar", "v2").ok());
+  env_->non_writable_.store(false, std::memory_order_release);
+  ASSERT_TRUE(!Put("bar", "v2").ok());
+
+  Reopen(&options);
+  ASSERT_EQ("v1", Get("foo"));
+  for (int i = 0; i < written; i++) {
+    ASSERT_EQ(big, Get(VlogKey(i)));
+  }
+  ASSERT_EQ("NOT_FOUND", Get("bar"));
+  ASSERT_OK(Put("bar", "v2"));
+  ASSERT_EQ("v2", Get("bar"));
+  Close();
+}
+
+// Values kept inline and in the vlog read back the same from the memtable,
+// from tables and after a replay of the vlog.  The sizes include those whose
+// tagged inline form would be as long as an untagged pointer.
+TEST(DBTest, VlogValuesReopen) {
+  const int mods[] = {7, 9};
+  for (int mod : mods) {
+    VlogSettings settings(mod);
+    adgMod::vlog_value_threshold = 16;
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    // the values are written twice, the first ones end up in a table and
+    // the second ones are replayed
+    const int sizes[] = {0, 1, 10, 11, 12, 15, 16, 17, 1000};
+    const int kNumValues = sizeof(sizes) / sizeof(sizes[0]);
+    std::vector<std::string> values;
+    Random rnd(301);
+    for (int i = 0; i < 2 * kNumValues; i++) {
+      values.push_back(RandomString(&rnd, sizes[i % kNumValues]));
+      ASSERT_OK(Put(VlogKey(i), values[i]));
+      if (i == kNumValues - 1) {
+        ASSERT_OK(dbfull()->TEST_CompactMemTable());
+      }
+    }
+    for (int i = 0; i < 2 * kNumValues; i++) {
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+    Reopen(&options);
+    for (int i = 0; i < 2 * kNumValues; i++) {
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+    Close();
+  }
+}
+
+// A short read of the entries a learned lookup predicts falls back to the
+// table's own search instead of decoding the missing entries.
+TEST(DBTest, LearnedReadShortRead) {
+  const int mods[] = {6, 7};
+  for (int mod : mods) {
+    VlogSettings settings(mod);
+    env_->shorten_table_reads_ = true;
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.create_if_missing = true;
+    // entries of one size, so that they are located from their positions
+    options.compression = kNoCompression;
+    options.block_restart_interval = 1;
+    DestroyAndReopen(&options);
+
+    const int kNumKeys = 2000;
+    Random rnd(301);
+    std::vector<std::string> values;
+    for (int i = 0; i < kNumKeys; i++) {
+      values.push_back(RandomString(&rnd, 100));
+      ASSERT_OK(Put(VlogKey(i), values[i]));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+
+    for (int i = 0; i < kNumKeys; i += 7) {
+      env_->short_table_reads_.store(1);
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+    env_->short_table_reads_.store(0);
+    env_->shorten_table_reads_ = false;
+    Close();
+  }
+}
+
+// A DB written before values were tagged keeps the bare address and size of
+// each value in vlog.txt, in its tables and its log.  Its values read back
+// in the modes with a vlog, next to those written since.
+TEST(DBTest, VlogUntaggedPointers) {
+  VlogSettings settings(5);
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  const int kNumKeys = 20;
+  std::vector<std::string> values;
+  std::string vlog;
+  Random rnd(301);
+  for (int i = 0; i < kNumKeys; i++) {
+    values.push_back(RandomString(&rnd, i % 2 == 0 ? 11 : 100));
+    PutLengthPrefixedSlice(&vlog, VlogKey(i));
+    PutVarint32(&vlog, values[i].size());
+    std::string pointer;
+    PutFixed64(&pointer, vlog.size());
+    PutFixed32(&pointer, values[i].size());
+    vlog.append(values[i]);
+    ASSERT_EQ(adgMod::kUntaggedVlogPointerSize, pointer.size());
+    ASSERT_OK(Put(VlogKey(i), pointer));
+    if (i == kNumKeys / 2) {
+      ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    }
+  }
+  Close();
+  ASSERT_OK(WriteStringToFile(env_, vlog, dbname_ + "/vlog.txt"));
+
+  const int mods[] = {7, 9};
+  for (int mod : mods) {
+    adgMod::MOD = mod;
+    Reopen(&options);
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+    values[mod] = "v" + std::to_string(mod);
+    ASSERT_OK(Put(VlogKey(mod), values[mod]));
+    Reopen(&options);
+    for (int i = 0; i < kNumKeys; i++) {
+      ASSERT_EQ(values[i], Get(VlogKey(i)));
+    }
+  }
+  Close();
+}
+
 TEST(DBTest, DBOpen_Options) {
   std::string dbname = test::TmpDir() + "/db_options_test";
   DestroyDB(dbname, Options());
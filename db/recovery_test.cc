@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <algorithm>
+
 #include "db/db_impl.h"
 #include "db/filename.h"
 #include "db/version_set.h"
@@ -9,6 +11,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/write_batch.h"
+#include "mod/util.h"
 #include "util/logging.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
@@ -71,6 +74,8 @@ class RecoveryTest {
     return db_->Put(WriteOptions(), k, v);
   }
 
+  Status Delete(const std::string& k) { return db_->Delete(WriteOptions(), k); }
+
   std::string Get(const std::string& k, const Snapshot* snapshot = nullptr) {
     std::string result;
     Status s = db_->Get(ReadOptions(), k, &result);
@@ -94,6 +99,42 @@ class RecoveryTest {
 
   std::string LogName(uint64_t number) { return LogFileName(dbname_, number); }
 
+  // The vlog segments, in the order they were written
+  std::vector<std::string> VlogSegments() {
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    std::vector<std::string> segments;
+    for (const std::string& filename : filenames) {
+      if (filename.size() > 5 &&
+          filename.compare(filename.size() - 5, 5, ".vlog") == 0) {
+        segments.push_back(dbname_ + "/" + filename);
+      }
+    }
+    ASSERT_TRUE(!segments.empty());
+    std::sort(segments.begin(), segments.end());
+    return segments;
+  }
+
+  // The vlog segment written last
+  std::string LastVlogSegment() { return VlogSegments().back(); }
+
+  // Replace the vlog with a new one, written by a DB in mode mod
+  void OpenVlog(int mod, bool paranoid_checks = false) {
+    Close();
+    DestroyDB(dbname_, Options());
+    adgMod::MOD = mod;
+    Options options;
+    options.create_if_missing = true;
+    options.paranoid_checks = paranoid_checks;
+    ASSERT_OK(OpenWithStatus(&options));
+  }
+
+  Status ReopenVlog(bool paranoid_checks = false) {
+    Options options;
+    options.paranoid_checks = paranoid_checks;
+    return OpenWithStatus(&options);
+  }
+
   size_t DeleteLogFiles() {
     // Linux allows unlinking open files, but Windows does not.
     // Closing the db allows for file deletion.
@@ -325,6 +366,153 @@ TEST(RecoveryTest, ManifestMissing) {
   ASSERT_TRUE(status.IsCorruption());
 }
 
+namespace {
+
+// Values go to the vlog, which is the log, for the lifetime of the object.
+// Tables are learned as they are built, so no learning outlives the DB.
+class VlogMode {
+ public:
+  VlogMode() : mod_(adgMod::MOD), learn_on_build_(adgMod::learn_on_build) {
+    adgMod::learn_on_build = true;
+  }
+  ~VlogMode() {
+    adgMod::MOD = mod_;
+    adgMod::learn_on_build = learn_on_build_;
+  }
+
+ private:
+  const int mod_;
+  const bool learn_on_build_;
+};
+
+std::string VlogKey(int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "key%03d", i);
+  return std::string(buf);
+}
+
+std::string VlogValue(int i) { return std::string(100, 'a' + i % 26); }
+
+// Each record is its checksum, the key and value lengths, the key and the value
+const size_t kVlogSegmentHeader = 16;
+const size_t kVlogRecordSize = 4 + 1 + 6 + 1 + 100;
+
+}  // namespace
+
+// Writes only in the vlog are replayed on every reopen, in both modes that
+// have one.
+TEST(RecoveryTest, VlogReopen) {
+  VlogMode mode;
+  const int mods[] = {7, 9};
+  for (int mod : mods) {
+    OpenVlog(mod);
+    for (int i = 0; i < 50; i++) {
+      ASSERT_OK(Put(VlogKey(i), VlogValue(i)));
+    }
+    ASSERT_OK(Delete(VlogKey(10)));
+    ASSERT_OK(ReopenVlog());
+    for (int i = 0; i < 50; i++) {
+      ASSERT_EQ(i == 10 ? "NOT_FOUND" : VlogValue(i), Get(VlogKey(i)));
+    }
+
+    ASSERT_OK(Put(VlogKey(10), "v"));
+    ASSERT_OK(Put(VlogKey(50), VlogValue(50)));
+    CompactMemTable();
+    ASSERT_OK(Put(VlogKey(0), "v"));
+    ASSERT_OK(ReopenVlog());
+    ASSERT_OK(ReopenVlog());
+    ASSERT_EQ("v", Get(VlogKey(0)));
+    ASSERT_EQ("v", Get(VlogKey(10)));
+    for (int i = 1; i <= 50; i++) {
+      if (i != 10) ASSERT_EQ(VlogValue(i), Get(VlogKey(i)));
+    }
+  }
+}
+
+// A record cut short by a crash is dropped, and the log goes on after it.
+TEST(RecoveryTest, VlogTornTail) {
+  VlogMode mode;
+  OpenVlog(7);
+  for (int i = 0; i < 50; i++) {
+    ASSERT_OK(Put(VlogKey(i), VlogValue(i)));
+  }
+  Close();
+  const std::string segment = LastVlogSegment();
+  ASSERT_EQ(kVlogSegmentHeader + 50 * kVlogRecordSize, FileSize(segment));
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env(), segment, &contents));
+  // files are opened for appending
+  ASSERT_OK(env()->DeleteFile(segment));
+  ASSERT_OK(WriteStringToFile(env(), contents.substr(0, contents.size() - 10),
+                              segment));
+
+  ASSERT_OK(ReopenVlog());
+  for (int i = 0; i < 49; i++) {
+    ASSERT_EQ(VlogValue(i), Get(VlogKey(i)));
+  }
+  ASSERT_EQ("NOT_FOUND", Get(VlogKey(49)));
+
+  ASSERT_OK(Put(VlogKey(49), VlogValue(49)));
+  ASSERT_OK(ReopenVlog());
+  for (int i = 0; i < 50; i++) {
+    ASSERT_EQ(VlogValue(i), Get(VlogKey(i)));
+  }
+}
+
+// Replay stops at the first record that fails its checksum, or fails with
+// paranoid checks.
+TEST(RecoveryTest, VlogCorruptRecord) {
+  VlogMode mode;
+  OpenVlog(7);
+  for (int i = 0; i < 50; i++) {
+    ASSERT_OK(Put(VlogKey(i), VlogValue(i)));
+  }
+  Close();
+  const std::string segment = LastVlogSegment();
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env(), segment, &contents));
+  // a byte of the value of record 20
+  contents[kVlogSegmentHeader + 20 * kVlogRecordSize + kVlogRecordSize - 50] ^=
+      0x1;
+  ASSERT_OK(env()->DeleteFile(segment));
+  ASSERT_OK(WriteStringToFile(env(), contents, segment));
+
+  ASSERT_TRUE(ReopenVlog(true).IsCorruption());
+  ASSERT_OK(ReopenVlog());
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(VlogValue(i), Get(VlogKey(i)));
+  }
+  for (int i = 20; i < 50; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(VlogKey(i)));
+  }
+}
+
+// A bad record in a segment followed by others is damage, not a torn write,
+// so the DB does not open without the writes after it.
+TEST(RecoveryTest, VlogCorruptEarlierSegment) {
+  VlogMode mode;
+  const uint64_t segment_size = adgMod::vlog_segment_size;
+  adgMod::vlog_segment_size = kVlogSegmentHeader + 8 * kVlogRecordSize;
+  OpenVlog(7);
+  for (int i = 0; i < 50; i++) {
+    ASSERT_OK(Put(VlogKey(i), VlogValue(i)));
+  }
+  Close();
+  const std::vector<std::string> segments = VlogSegments();
+  ASSERT_GT(segments.size(), 2u);
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env(), segments[0], &contents));
+  // a byte of the value of record 2
+  contents[kVlogSegmentHeader + 2 * kVlogRecordSize + kVlogRecordSize - 50] ^=
+      0x1;
+  ASSERT_OK(env()->DeleteFile(segments[0]));
+  ASSERT_OK(WriteStringToFile(env(), contents, segments[0]));
+
+  ASSERT_TRUE(ReopenVlog().IsCorruption());
+  ASSERT_TRUE(ReopenVlog(true).IsCorruption());
+  adgMod::vlog_segment_size = segment_size;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) { return leveldb::test::RunAllTests(); }
@@ -3,6 +3,8 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <fcntl.h>
+#include <algorithm>
+#include <vector>
 #include <table/filter_block.h>
 #include "db/table_cache.h"
 #include "db/filename.h"
@@ -19,12 +21,15 @@ namespace leveldb {
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  // opened when options.direct_reads is set; serves the reads of learned lookups
+  RandomAccessFile* direct_file = nullptr;
 };
 
 static void DeleteEntry(const Slice& key, void* value) {
   TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
   delete tf->table;
   delete tf->file;
+  delete tf->direct_file;
   delete tf;
 }
 
@@ -121,6 +126,10 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
+      if (options_.direct_reads) {
+        // without direct I/O, learned lookups read through the page cache as usual
+        env_->NewDirectRandomAccessFile(fname, &tf->direct_file);
+      }
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
@@ -282,6 +291,199 @@ Cache::Handle* TableCache::FindFile(const ReadOptions& options, uint64_t file_nu
     return cache_handle;
 }
 
+uint64_t TableCache::LocateEntries(TableAndFile* tf, const TableLayout& layout, const Slice& k,
+                                   uint64_t lower, uint64_t upper, size_t* pos_block_lower,
+                                   size_t* pos_block_upper) {
+  const uint64_t entries_per_block = layout.entries_per_block();
+  size_t index_lower = lower / entries_per_block;
+  size_t index_upper = upper / entries_per_block;
+
+  uint64_t i = index_lower;
+  if (index_lower != index_upper) {
+    Block* index_block = tf->table->rep_->index_block;
+    uint32_t mid_index_entry = DecodeFixed32(index_block->data_ + index_block->restart_offset_ + index_lower * sizeof(uint32_t));
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(index_block->data_ + mid_index_entry,
+                                      index_block->data_ + index_block->restart_offset_, &shared, &non_shared, &value_length);
+    assert(key_ptr != nullptr && shared == 0 && "Index Entry Corruption");
+    Slice mid_key(key_ptr, non_shared);
+    int comp = tf->table->rep_->options.comparator->Compare(mid_key, k);
+    i = comp < 0 ? index_upper : index_lower;
+  }
+
+  *pos_block_lower = i == index_lower ? lower % entries_per_block : 0;
+  *pos_block_upper = i == index_upper ? upper % entries_per_block : entries_per_block - 1;
+  return i;
+}
+
+void TableCache::SearchEntries(TableAndFile* tf, const TableLayout& layout, const Slice& entries,
+                               uint64_t first, uint64_t pos_lower, uint64_t pos_upper,
+                               const Slice& k, Slice* key, Slice* value) {
+  const char* limit = entries.data() + entries.size();
+  uint64_t left = pos_lower, right = pos_upper;
+  while (left < right) {
+    uint32_t mid = (left + right) / 2;
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(entries.data() + (mid - first) * layout.entry_stride(),
+            limit, &shared, &non_shared, &value_length);
+    assert(key_ptr != nullptr && shared == 0 && "Entry Corruption");
+
+    Slice mid_key(key_ptr, non_shared);
+    int comp = tf->table->rep_->options.comparator->Compare(mid_key, k);
+    if (comp < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+
+  uint32_t shared, non_shared, value_length;
+  const char* key_ptr = DecodeEntry(entries.data() + (left - first) * layout.entry_stride(),
+          limit, &shared, &non_shared, &value_length);
+  assert(key_ptr != nullptr && shared == 0 && "Entry Corruption");
+  *key = Slice(key_ptr, non_shared);
+  *value = Slice(key_ptr + non_shared, value_length);
+}
+
+bool TableCache::IndexedRead(Table* table, RandomAccessFile* file, const TableLayout& layout,
+                             const Slice& k, uint64_t lower, uint64_t upper, void* arg,
+                             void (*handle_result)(void*, const Slice&, const Slice&)) {
+#ifdef INTERNAL_TIMER
+  adgMod::Stats* instance = adgMod::Stats::GetInstance();
+#endif
+  Block* index_block = table->rep_->index_block;
+  const Comparator* comparator = table->rep_->options.comparator;
+  const uint32_t num_blocks = index_block->NumRestarts();
+  if (num_blocks == 0) return true;
+
+  // the index block has a restart point per entry, so entry b is found directly
+  struct IndexEntry {
+    Slice key;
+    BlockHandle handle;
+    uint64_t first, count;
+  };
+  auto read_index = [&](uint32_t b, IndexEntry* entry) {
+    const char* limit = index_block->data_ + index_block->restart_offset_;
+    uint32_t offset = DecodeFixed32(limit + b * sizeof(uint32_t));
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(index_block->data_ + offset, limit, &shared, &non_shared, &value_length);
+    if (key_ptr == nullptr || shared != 0) return false;
+    entry->key = Slice(key_ptr, non_shared);
+    Slice value(key_ptr + non_shared, value_length);
+    return DecodeIndexValue(&value, &entry->handle, &entry->first, &entry->count).ok();
+  };
+  // the last block whose first entry is at or before position
+  auto block_of = [&](uint64_t position, uint32_t* block) {
+    uint32_t left = 0, right = num_blocks - 1;
+    IndexEntry entry;
+    while (left < right) {
+      uint32_t mid = (left + right + 1) / 2;
+      if (!read_index(mid, &entry)) return false;
+      if (entry.first <= position) {
+        left = mid;
+      } else {
+        right = mid - 1;
+      }
+    }
+    *block = left;
+    return true;
+  };
+
+  // Narrow [lower, upper] to one block: the first one whose largest key is not less than k
+  uint32_t block_lower, block_upper;
+  if (!block_of(lower, &block_lower) || !block_of(upper, &block_upper)) return false;
+  IndexEntry entry;
+  uint32_t left = block_lower, right = block_upper;
+  while (left < right) {
+    uint32_t mid = (left + right) / 2;
+    if (!read_index(mid, &entry)) return false;
+    if (comparator->Compare(entry.key, k) < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  if (!read_index(left, &entry) || entry.count == 0) return false;
+  uint64_t pos_upper = left == block_upper ? std::min(upper - entry.first, entry.count - 1) : entry.count - 1;
+  uint64_t pos_lower = left == block_lower ? std::min(lower - entry.first, pos_upper) : 0;
+
+  FilterBlockReader* filter = table->rep_->filter;
+  if (filter != nullptr && !filter->KeyMayMatch(entry.handle.offset(), k)) return true;
+
+#ifdef INTERNAL_TIMER
+  instance->StartTimer(5);
+#endif
+  // Read the restart points covering the interval, then the entries between them. The
+  // slot after the last restart point holds the restart count and stands for the end
+  // of the entries.
+  const uint64_t interval = layout.restart_interval();
+  const uint64_t num_restarts = (entry.count + interval - 1) / interval;
+  const uint64_t restart_lower = pos_lower / interval, restart_upper = pos_upper / interval;
+  const uint64_t restarts_offset = entry.handle.size() - (num_restarts + 1) * sizeof(uint32_t);
+  const size_t slots_size = (restart_upper - restart_lower + 2) * sizeof(uint32_t);
+  static thread_local std::string scratch;
+  static thread_local std::vector<uint32_t> restarts;
+  if (scratch.size() < slots_size) scratch.resize(slots_size);
+  Slice slots;
+  Status s = file->Read(entry.handle.offset() + restarts_offset + restart_lower * sizeof(uint32_t),
+                        slots_size, &slots, &scratch[0]);
+  if (!s.ok() || slots.size() != slots_size) return false;
+  restarts.clear();
+  for (uint64_t r = restart_lower; r <= restart_upper; ++r) {
+    restarts.push_back(DecodeFixed32(slots.data() + (r - restart_lower) * sizeof(uint32_t)));
+  }
+  restarts.push_back(restart_upper + 1 == num_restarts
+                     ? restarts_offset
+                     : DecodeFixed32(slots.data() + (restart_upper - restart_lower + 1) * sizeof(uint32_t)));
+  const uint32_t begin = restarts.front(), end = restarts.back();
+  if (begin > end || end > restarts_offset) return false;
+
+  if (scratch.size() < end - begin) scratch.resize(end - begin);
+  Slice entries;
+  s = file->Read(entry.handle.offset() + begin, end - begin, &entries, &scratch[0]);
+  if (!s.ok() || entries.size() != end - begin) return false;
+#ifdef INTERNAL_TIMER
+  instance->PauseTimer(5);
+  instance->StartTimer(3);
+#endif
+
+  // Binary search the restart points for the last one before k, then scan from it
+  const char* limit = entries.data() + entries.size();
+  auto key_at = [&](const char* p, Slice* key, Slice* value) {
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(p, limit, &shared, &non_shared, &value_length);
+    if (key_ptr == nullptr || shared != 0) return (const char*) nullptr;
+    *key = Slice(key_ptr, non_shared);
+    *value = Slice(key_ptr + non_shared, value_length);
+    return key_ptr + non_shared + value_length;
+  };
+  Slice key, value;
+  size_t restart_left = 0, restart_right = restarts.size() - 2;
+  while (restart_left < restart_right) {
+    size_t mid = (restart_left + restart_right + 1) / 2;
+    if (key_at(entries.data() + restarts[mid] - begin, &key, &value) == nullptr) return false;
+    if (comparator->Compare(key, k) < 0) {
+      restart_left = mid;
+    } else {
+      restart_right = mid - 1;
+    }
+  }
+  bool found = false;
+  for (const char* p = entries.data() + restarts[restart_left] - begin; p < limit;) {
+    p = key_at(p, &key, &value);
+    if (p == nullptr) return false;
+    if (comparator->Compare(key, k) >= 0) {
+      found = true;
+      break;
+    }
+  }
+#ifdef INTERNAL_TIMER
+  instance->PauseTimer(3);
+#endif
+  if (found) handle_result(arg, key, value);
+  return true;
+}
+
 void TableCache::LevelRead(const ReadOptions &options, uint64_t file_number,
                             uint64_t file_size, const Slice &k, void *arg,
                             void (*handle_result)(void *, const Slice &, const Slice &), int level,
@@ -297,12 +499,20 @@ void TableCache::LevelRead(const ReadOptions &options, uint64_t file_number,
     Cache::Handle* cache_handle = nullptr;
     Status s = FindTable(file_number, file_size, &cache_handle);
     TableAndFile* tf = reinterpret_cast<TableAndFile*>(cache_->Value(cache_handle));
-    RandomAccessFile* file = tf->file;
+    RandomAccessFile* file = tf->direct_file != nullptr ? tf->direct_file : tf->file;
     FilterBlockReader* filter = tf->table->rep_->filter;
+    const TableLayout layout = tf->table->Layout();
 #ifdef INTERNAL_TIMER
     instance->PauseTimer(1);
 #endif
 
+    if (!layout.uniform() && !layout.indexed()) {
+      // entries of this table cannot be located from their positions: search it the usual way
+      tf->table->InternalGet(options, k, arg, handle_result, level, meta, lower, upper, learned, version);
+      cache_->Release(cache_handle);
+      return;
+    }
+
 
     if (!learned) {
       // if level model is not used, consult file model for predicted position
@@ -318,7 +528,10 @@ void TableCache::LevelRead(const ReadOptions &options, uint64_t file_number,
 #ifdef INTERNAL_TIMER
       instance->PauseTimer(2);
 #endif
-      if (lower > model->MaxPosition()) return;
+      if (lower > model->MaxPosition()) {
+        cache_->Release(cache_handle);
+        return;
+      }
 #ifdef RECORD_LEVEL_INFO
         adgMod::levelled_counters[1].Increment(level);
       } else {
@@ -326,31 +539,23 @@ void TableCache::LevelRead(const ReadOptions &options, uint64_t file_number,
 #endif
     }
 
-
-    // Get the position we want to read
-    // Get the data block index
-    size_t index_lower = lower / adgMod::block_num_entries;
-    size_t index_upper = upper / adgMod::block_num_entries;
-
-    // if the given interval overlaps two data block, consult the index block to get
-    // the largest key in the first data block and compare it with the target key
-    // to decide which data block the key is in
-    uint64_t i = index_lower;
-    if (index_lower != index_upper) {
-      Block* index_block = tf->table->rep_->index_block;
-      uint32_t mid_index_entry = DecodeFixed32(index_block->data_ + index_block->restart_offset_ + index_lower * sizeof(uint32_t));
-      uint32_t shared, non_shared, value_length;
-      const char* key_ptr = DecodeEntry(index_block->data_ + mid_index_entry,
-                                        index_block->data_ + index_block->restart_offset_, &shared, &non_shared, &value_length);
-      assert(key_ptr != nullptr && shared == 0 && "Index Entry Corruption");
-      Slice mid_key(key_ptr, non_shared);
-      int comp = tf->table->rep_->options.comparator->Compare(mid_key, k);
-      i = comp < 0 ? index_upper : index_lower;
+    if (!layout.uniform()) {
+      // entries vary in size: find them through the index values and the restart array
+      if (!IndexedRead(tf->table, file, layout, k, lower, upper, arg, handle_result)) {
+        tf->table->InternalGet(options, k, arg, handle_result, level, meta, lower, upper, learned, version);
+      }
+      cache_->Release(cache_handle);
+      return;
     }
 
 
+    // Get the data block and the interval within it that the target key may lie in
+    size_t pos_block_lower, pos_block_upper;
+    uint64_t i = LocateEntries(tf, layout, k, lower, upper, &pos_block_lower, &pos_block_upper);
+
+
     // Check Filter Block
-    uint64_t block_offset = i * adgMod::block_size;
+    uint64_t block_offset = i * layout.block_stride();
 #ifdef INTERNAL_TIMER
     instance->StartTimer(15);
 #endif
@@ -368,66 +573,172 @@ void TableCache::LevelRead(const ReadOptions &options, uint64_t file_number,
     instance->StartTimer(5);
 #endif
 
-    // Get the interval within the data block that the target key may lie in
-    size_t pos_block_lower = i == index_lower ? lower % adgMod::block_num_entries : 0;
-    size_t pos_block_upper = i == index_upper ? upper % adgMod::block_num_entries : adgMod::block_num_entries - 1;
-
     // Read corresponding entries
-    size_t read_size = (pos_block_upper - pos_block_lower + 1) * adgMod::entry_size;
-    static char scratch[4096];
+    size_t read_size = (pos_block_upper - pos_block_lower + 1) * layout.entry_stride();
+    // each reader thread has its own buffer, grown to the largest interval it has read
+    static thread_local std::string scratch;
+    if (scratch.size() < read_size) scratch.resize(read_size);
     Slice entries;
-    s = file->Read(block_offset + pos_block_lower * adgMod::entry_size, read_size, &entries, scratch);
-    assert(s.ok());
-
+    s = file->Read(block_offset + pos_block_lower * layout.entry_stride(), read_size, &entries, &scratch[0]);
 #ifdef INTERNAL_TIMER
-    bool first_search = true;
+    instance->PauseTimer(5);
+#endif
+    if (!s.ok() || entries.size() != read_size) {
+      // the entries cannot be decoded from a failed or short read: search the table the usual way
+      tf->table->InternalGet(options, k, arg, handle_result, level, meta, lower, upper, learned, version);
+      cache_->Release(cache_handle);
+      return;
+    }
+#ifdef INTERNAL_TIMER
+    instance->StartTimer(3);
 #endif
 
-
-    // Binary Search within the interval
-    uint64_t left = pos_block_lower, right = pos_block_upper;
-    while (left < right) {
-      uint32_t mid = (left + right) / 2;
-      uint32_t shared, non_shared, value_length;
-      const char* key_ptr = DecodeEntry(entries.data() + (mid - pos_block_lower) * adgMod::entry_size,
-              entries.data() + read_size, &shared, &non_shared, &value_length);
-      assert(key_ptr != nullptr && shared == 0 && "Entry Corruption");
-
+    // Binary Search within the interval, and decode the target entry to get the key
+    // and value (actually value_addr)
+    Slice key, value;
+    SearchEntries(tf, layout, entries, pos_block_lower, pos_block_lower, pos_block_upper, k, &key, &value);
 #ifdef INTERNAL_TIMER
-      if (first_search) {
-        first_search = false;
-        instance->PauseTimer(5);
-        instance->StartTimer(3);
-      }
+    instance->PauseTimer(3);
 #endif
+    handle_result(arg, key, value);
 
-      Slice mid_key(key_ptr, non_shared);
-      int comp = tf->table->rep_->options.comparator->Compare(mid_key, k);
-      if (comp < 0) {
-        left = mid + 1;
-      } else {
-        right = mid;
+    //cache handle;
+    cache_->Release(cache_handle);
+}
+
+Status TableCache::MultiGet(const ReadOptions& options, FileLookups* lookups, size_t num,
+                            void (*handle_result)(void*, const Slice&, const Slice&),
+                            Version* version) {
+  // the block and entry interval predicted for one key
+  struct Probe {
+    size_t lookup;
+    size_t key;
+    uint64_t block;
+    size_t pos_lower, pos_upper;
+  };
+  std::vector<Probe> probes;
+  std::vector<Cache::Handle*> handles(num, nullptr);
+  std::vector<TableAndFile*> tables(num, nullptr);
+  std::vector<TableLayout> layouts(num);
+  Status result;
+
+  for (size_t b = 0; b < num; ++b) {
+    FileLookups& lookup = lookups[b];
+    FileMetaData* meta = lookup.meta;
+    adgMod::LearnedIndexData* model = nullptr;
+    if (adgMod::MOD == 6 || adgMod::MOD == 7 || adgMod::MOD == 9) {
+      model = adgMod::file_data->GetModel(meta->number);
+      if (!model->Learned()) model = nullptr;
+    }
+    if (model != nullptr) {
+      lookup.status = FindTable(meta->number, meta->file_size, &handles[b]);
+      if (!lookup.status.ok()) {
+        if (result.ok()) result = lookup.status;
+        continue;
+      }
+      tables[b] = reinterpret_cast<TableAndFile*>(cache_->Value(handles[b]));
+      layouts[b] = tables[b]->table->Layout();
+      if (!layouts[b].uniform()) {
+        cache_->Release(handles[b]);
+        handles[b] = nullptr;
+        tables[b] = nullptr;
+        model = nullptr;
+      }
+    }
+    if (model == nullptr) {
+      // no file model, or entries that cannot be located from their positions:
+      // one lookup after another, sharing the block cache
+      for (size_t j = 0; j < lookup.n && lookup.status.ok(); ++j) {
+        adgMod::LearnedIndexData* unused_model;
+        bool file_learned;
+        lookup.status = Get(options, meta->number, meta->file_size, lookup.k[j], lookup.arg[j],
+                            handle_result, lookup.level, meta, 0, 0, false, version,
+                            &unused_model, &file_learned);
       }
+      if (result.ok()) result = lookup.status;
+      continue;
     }
 
+    TableAndFile* tf = tables[b];
+    const TableLayout& layout = layouts[b];
+    FilterBlockReader* filter = tf->table->rep_->filter;
 
-    // decode the target entry to get the key and value (actually value_addr)
-    uint32_t shared, non_shared, value_length;
-    const char* key_ptr = DecodeEntry(entries.data() + (left - pos_block_lower) * adgMod::entry_size,
-            entries.data() + read_size, &shared, &non_shared, &value_length);
-    assert(key_ptr != nullptr && shared == 0 && "Entry Corruption");
-#ifdef INTERNAL_TIMER
-    if (!first_search) {
-      instance->PauseTimer(3);
+    // predict the block and the entry interval of every key the filter lets through
+    size_t first = probes.size();
+    for (size_t j = 0; j < lookup.n; ++j) {
+      ParsedInternalKey parsed_key;
+      ParseInternalKey(lookup.k[j], &parsed_key);
+      auto bounds = model->GetPosition(parsed_key.user_key);
+      if (bounds.first > model->MaxPosition()) continue;
+#ifdef RECORD_LEVEL_INFO
+      adgMod::levelled_counters[1].Increment(lookup.level);
+#endif
+      Probe probe;
+      probe.lookup = b;
+      probe.key = j;
+      probe.block = LocateEntries(tf, layout, lookup.k[j], bounds.first, bounds.second, &probe.pos_lower, &probe.pos_upper);
+      if (filter != nullptr && !filter->KeyMayMatch(probe.block * layout.block_stride(), lookup.k[j])) continue;
+      probes.push_back(probe);
+    }
+    std::stable_sort(probes.begin() + first, probes.end(),
+                     [](const Probe& x, const Probe& y) { return x.block < y.block; });
+  }
+
+  // one read per data block, covering the intervals of all keys predicted into it
+  std::vector<size_t> first_probe, read_lower, read_upper;
+  for (size_t p = 0; p < probes.size(); ++p) {
+    if (p == 0 || probes[p].lookup != probes[p - 1].lookup || probes[p].block != probes[p - 1].block) {
+      first_probe.push_back(p);
+      read_lower.push_back(probes[p].pos_lower);
+      read_upper.push_back(probes[p].pos_upper);
     } else {
-      instance->PauseTimer(5);
+      read_lower.back() = std::min(read_lower.back(), probes[p].pos_lower);
+      read_upper.back() = std::max(read_upper.back(), probes[p].pos_upper);
     }
-#endif
-    Slice key(key_ptr, non_shared), value(key_ptr + non_shared, value_length);
-    handle_result(arg, key, value);
+  }
+  first_probe.push_back(probes.size());
+  std::vector<ReadRequest> reads(read_lower.size());
+  std::vector<RandomAccessFile*> files(reads.size());
+  size_t total_size = 0;
+  for (size_t r = 0; r < reads.size(); ++r) {
+    const Probe& probe = probes[first_probe[r]];
+    TableAndFile* tf = tables[probe.lookup];
+    const TableLayout& layout = layouts[probe.lookup];
+    files[r] = tf->direct_file != nullptr ? tf->direct_file : tf->file;
+    reads[r].offset = probe.block * layout.block_stride() + read_lower[r] * layout.entry_stride();
+    reads[r].n = (read_upper[r] - read_lower[r] + 1) * layout.entry_stride();
+    total_size += reads[r].n;
+  }
+  static thread_local std::string scratch;
+  if (scratch.size() < total_size) scratch.resize(total_size);
+  size_t scratch_offset = 0;
+  for (ReadRequest& read : reads) {
+    read.scratch = &scratch[scratch_offset];
+    scratch_offset += read.n;
+  }
 
-    //cache handle;
-    cache_->Release(cache_handle);
+  // all reads of all files in flight together
+  if (!reads.empty()) env_->MultiRead(files.data(), reads.data(), reads.size());
+
+  for (size_t r = 0; r < reads.size(); ++r) {
+    FileLookups& lookup = lookups[probes[first_probe[r]].lookup];
+    if (!reads[r].status.ok()) {
+      if (lookup.status.ok()) lookup.status = reads[r].status;
+      if (result.ok()) result = reads[r].status;
+      continue;
+    }
+    for (size_t p = first_probe[r]; p < first_probe[r + 1]; ++p) {
+      Slice key, value;
+      SearchEntries(tables[probes[p].lookup], layouts[probes[p].lookup], reads[r].result, read_lower[r], probes[p].pos_lower,
+                    probes[p].pos_upper, lookup.k[probes[p].key], &key, &value);
+      handle_result(lookup.arg[probes[p].key], key, value);
+    }
+  }
+
+  for (Cache::Handle* handle : handles) {
+    if (handle != nullptr) cache_->Release(handle);
+  }
+  return result;
 }
 
 
@@ -20,6 +20,7 @@
 namespace leveldb {
 
 class Env;
+struct TableAndFile;
 
 class FilterAndFile {
 public:
@@ -69,8 +70,53 @@ class TableCache {
                  void (*handle_result)(void*, const Slice&, const Slice&), int level,
                  FileMetaData* meta = nullptr, uint64_t lower = 0, uint64_t upper = 0, bool learned = false, Version* version = nullptr);
 
+  // The part of a MultiGet that falls in one file: the sorted internal keys
+  // k[0..n-1], and the status of looking them up
+  struct FileLookups {
+    FileMetaData* meta;
+    int level;
+    const Slice* k;
+    void* const* arg;
+    size_t n;
+    Status status;
+  };
+
+  // Looks up the keys of every lookups[i] in its file, calling
+  // (*handle_result)(arg[j], found_key, found_value) for every k[j] that finds
+  // an entry.  With learned file models, keys predicted into the same data
+  // block share one read, and the reads of all files are issued together
+  // through Env::MultiRead.  Returns the first non-OK status of any file.
+  Status MultiGet(const ReadOptions& options, FileLookups* lookups, size_t num,
+                  void (*handle_result)(void*, const Slice&, const Slice&),
+                  Version* version);
+
+  // Looks up internal key k, predicted at positions [lower, upper], in a table
+  // whose layout is indexed() but not uniform(): picks the data block through
+  // the entry positions in the index values, reads the slots of its restart
+  // array that cover the interval and then only the entries between them from
+  // file, and calls handle_result with the first entry not less than k, if
+  // any.  Returns false if the table turns out not to be laid out that way.
+  static bool IndexedRead(Table* table, RandomAccessFile* file, const TableLayout& layout,
+                          const Slice& k, uint64_t lower, uint64_t upper, void* arg,
+                          void (*handle_result)(void*, const Slice&, const Slice&));
+
 
  private:
+  // Narrows [lower, upper], the predicted positions of internal key k in the
+  // table, to one data block of the given layout.  If the interval overlaps
+  // two data blocks, consults the index block to get the largest key in the
+  // first one and compares it with k to decide which block k is in.  Returns
+  // the block and sets the interval of entries within it.
+  static uint64_t LocateEntries(TableAndFile* tf, const TableLayout& layout, const Slice& k,
+                                uint64_t lower, uint64_t upper, size_t* pos_block_lower,
+                                size_t* pos_block_upper);
+  // Binary searches entries [pos_lower, pos_upper] of a data block for the
+  // first one not less than k, and decodes it into *key and *value.  entries
+  // holds the block's entries from position first on.
+  static void SearchEntries(TableAndFile* tf, const TableLayout& layout, const Slice& entries,
+                            uint64_t first, uint64_t pos_lower, uint64_t pos_upper,
+                            const Slice& k, Slice* key, Slice* value);
+
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
   Cache::Handle* FindFile(const ReadOptions& options, uint64_t file_number, uint64_t file_size);
 
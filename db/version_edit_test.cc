@@ -36,6 +36,7 @@ TEST(VersionEditTest, EncodeDecode) {
   edit.SetLogNumber(kBig + 100);
   edit.SetNextFile(kBig + 200);
   edit.SetLastSequence(kBig + 1000);
+  edit.SetVlogHead(kBig + 1100);
   TestEncodeDecode(edit);
 }
 
@@ -297,27 +297,79 @@ namespace leveldb {
         return a->number > b->number;
     }
 
+    void Version::BuildLevel0Index() {
+        const Comparator *ucmp = vset_->icmp_.user_comparator();
+        auto before = [ucmp](const Slice &a, const Slice &b) { return ucmp->Compare(a, b) < 0; };
+        level0_bounds_.clear();
+        level0_slot_start_.clear();
+        level0_files_.clear();
+        if (files_[0].empty()) return;
+
+        for (FileMetaData *f : files_[0]) {
+            level0_bounds_.push_back(f->smallest.user_key());
+            level0_bounds_.push_back(f->largest.user_key());
+        }
+        std::sort(level0_bounds_.begin(), level0_bounds_.end(), before);
+        level0_bounds_.erase(std::unique(level0_bounds_.begin(), level0_bounds_.end(),
+                                         [ucmp](const Slice &a, const Slice &b) {
+                                             return ucmp->Compare(a, b) == 0;
+                                         }),
+                             level0_bounds_.end());
+
+        // A file covers the slots from that of its smallest key to that of its largest
+        std::vector<FileMetaData *> newest(files_[0]);
+        std::sort(newest.begin(), newest.end(), NewestFirst);
+        std::vector<std::pair<uint32_t, uint32_t>> slots;
+        const size_t num_slots = 2 * level0_bounds_.size() + 1;
+        level0_slot_start_.assign(num_slots + 1, 0);
+        for (FileMetaData *f : newest) {
+            uint32_t first = 2 * (std::lower_bound(level0_bounds_.begin(), level0_bounds_.end(),
+                                                   f->smallest.user_key(), before) - level0_bounds_.begin()) + 1;
+            uint32_t last = 2 * (std::lower_bound(level0_bounds_.begin(), level0_bounds_.end(),
+                                                  f->largest.user_key(), before) - level0_bounds_.begin()) + 1;
+            slots.emplace_back(first, last);
+            for (uint32_t j = first; j <= last; ++j) ++level0_slot_start_[j + 1];
+        }
+        for (size_t j = 0; j < num_slots; ++j) level0_slot_start_[j + 1] += level0_slot_start_[j];
+
+        // Filled newest first, so that every slot lists its files newest first
+        std::vector<uint32_t> filled(level0_slot_start_.begin(), level0_slot_start_.end() - 1);
+        level0_files_.resize(level0_slot_start_.back());
+        for (size_t i = 0; i < newest.size(); ++i) {
+            for (uint32_t j = slots[i].first; j <= slots[i].second; ++j) {
+                level0_files_[filled[j]++] = newest[i];
+            }
+        }
+    }
+
+    void Version::Level0Files(const Slice &user_key, FileMetaData *const **files, size_t *num) const {
+        if (level0_bounds_.empty()) {
+            *num = 0;
+            return;
+        }
+        const Comparator *ucmp = vset_->icmp_.user_comparator();
+        size_t i = std::lower_bound(level0_bounds_.begin(), level0_bounds_.end(), user_key,
+                                    [ucmp](const Slice &a, const Slice &b) {
+                                        return ucmp->Compare(a, b) < 0;
+                                    }) - level0_bounds_.begin();
+        size_t slot = 2 * i;
+        if (i < level0_bounds_.size() && ucmp->Compare(level0_bounds_[i], user_key) == 0) ++slot;
+        *files = level0_files_.data() + level0_slot_start_[slot];
+        *num = level0_slot_start_[slot + 1] - level0_slot_start_[slot];
+    }
+
     void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void *arg,
                                      bool (*func)(void *, int, FileMetaData *)) {
         // TODO(sanjay): Change Version::Get() to use this function.
         const Comparator *ucmp = vset_->icmp_.user_comparator();
 
         // Search level-0 in order from newest to oldest.
-        std::vector<FileMetaData *> tmp;
-        tmp.reserve(files_[0].size());
-        for (uint32_t i = 0; i < files_[0].size(); i++) {
-            FileMetaData *f = files_[0][i];
-            if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-                ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
-                tmp.push_back(f);
-            }
-        }
-        if (!tmp.empty()) {
-            std::sort(tmp.begin(), tmp.end(), NewestFirst);
-            for (uint32_t i = 0; i < tmp.size(); i++) {
-                if (!(*func)(arg, 0, tmp[i])) {
-                    return;
-                }
+        FileMetaData *const *level0_files;
+        size_t num_level0_files;
+        Level0Files(user_key, &level0_files, &num_level0_files);
+        for (size_t i = 0; i < num_level0_files; i++) {
+            if (!(*func)(arg, 0, level0_files[i])) {
+                return;
             }
         }
 
@@ -341,6 +393,67 @@ namespace leveldb {
         }
     }
 
+    FileMetaData *Version::FileForKey(int level, const Slice &user_key, const Slice &ikey,
+                                      uint64_t *lower, uint64_t *upper, bool *learned) {
+        const Comparator *ucmp = vset_->icmp_.user_comparator();
+        if (adgMod::MOD == 9) {
+            // Check if a level model is available
+            adgMod::LearnedIndexData *learned_this_level = learned_index_data_[level].get();
+            if (learned_this_level->Learned(this, adgMod::db->version_count, level)) {
+#ifdef RECORD_LEVEL_INFO
+                adgMod::levelled_counters[13].Increment(level);
+#endif
+                // use level model to get the target file
+                std::pair<uint64_t, uint64_t> bounds = learned_this_level->GetPosition(user_key);
+                if (bounds.first > learned_this_level->MaxPosition()) {
+                    // the model predicts a region larger than its size -- target key not in this level
+                    return nullptr;
+                }
+                if (adgMod::level_entry_model) {
+                    // the predicted entries of the level lie in one file, found with the
+                    // accumulated number of entries of the files before it
+                    size_t index;
+                    uint64_t relative_lower, relative_upper;
+                    if (!learned_this_level->num_entries_accumulated.Search(user_key, bounds.first, bounds.second,
+                                                                            &index, &relative_lower, &relative_upper)
+                        || index >= files_[level].size()) {
+                        return nullptr;
+                    }
+                    FileMetaData *file = files_[level][index];
+                    if (ucmp->Compare(file->smallest.user_key(), user_key) > 0) return nullptr;
+                    if (learned != nullptr) {
+                        *lower = relative_lower;
+                        *upper = relative_upper;
+                        *learned = true;
+                    }
+                    return file;
+                }
+                for (int i = bounds.first; i <= bounds.second && i < files_[level].size(); ++i) {
+                    FileMetaData *file = files_[level][i];
+                    if (ucmp->Compare(file->smallest.user_key(), user_key) <= 0
+                        && ucmp->Compare(file->largest.user_key(), user_key) >= 0) {
+                        return file;
+                    }
+                }
+                return nullptr;
+            }
+        }
+
+        // if no models available follow the baseline path
+#ifdef RECORD_LEVEL_INFO
+        adgMod::levelled_counters[14].Increment(level);
+#endif
+        // Binary search to find earliest index whose largest key >= ikey.
+        uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
+        if (index >= files_[level].size()) return nullptr;
+        FileMetaData *f = files_[level][index];
+        if (ucmp->Compare(user_key, f->smallest.user_key()) < 0) {
+            // All of "f" is past any data for user_key
+            return nullptr;
+        }
+        return f;
+    }
+
     Status Version::Get(const ReadOptions &options, const LookupKey &k,
                         std::string *value, GetStats *stats) {
         adgMod::Stats *instance = adgMod::Stats::GetInstance();
@@ -357,7 +470,6 @@ namespace leveldb {
         // We can search level-by-level since entries never hop across
         // levels.  Therefore we are guaranteed that if we find data
         // in a smaller level, later levels are irrelevant.
-        std::vector<FileMetaData *> tmp;
         FileMetaData *tmp2;
         for (int level = 0; level < config::kNumLevels; level++) {
             size_t num_files = files_[level].size();
@@ -367,7 +479,7 @@ namespace leveldb {
             FileMetaData *const *files = &files_[level][0];
             uint64_t position_lower = 0;
             uint64_t position_upper = 0;
-            bool learned = false;
+            bool level_learned = false;
 
             // Step FindFile
             instance->StartTimer(0);
@@ -376,88 +488,20 @@ namespace leveldb {
                 // overlap user_key and process them in order from newest to oldest.
 
                 // We don't have level models for Level 0 as files overlap with each other
-                // So we follow the original LevelDB way in FindFile process
-                tmp.reserve(num_files);
-                for (uint32_t i = 0; i < num_files; i++) {
-                    FileMetaData *f = files[i];
-                    if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-                        ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
-                        tmp.push_back(f);
-                    }
-                }
-                if (tmp.empty()) {
+                // So the files holding the key come from the index built with the version
+                Level0Files(user_key, &files, &num_files);
+                if (num_files == 0) {
                     instance->PauseTimer(0);
                     continue;
                 }
-
-                std::sort(tmp.begin(), tmp.end(), NewestFirst);
-                files = &tmp[0];
-                num_files = tmp.size();
             } else {
-                if (adgMod::MOD == 9) {
-                    // Check if a level model is available
-                    adgMod::LearnedIndexData *learned_this_level = learned_index_data_[level].get();
-                    if (learned_this_level->Learned(this, adgMod::db->version_count, level)) {
-                        adgMod::levelled_counters[13].Increment(level);
-                        // use level model to get the target file
-                        learned = true;
-                        std::pair<uint64_t, uint64_t> bounds = learned_this_level->GetPosition(user_key);
-//                        size_t index;
-                        if (bounds.first <= learned_this_level->MaxPosition()) {
-                            files = nullptr;
-                            num_files = 0;
-                            for (int i = bounds.first; i <= bounds.second && i<files_[level].size(); ++i) {
-                                FileMetaData *file = files_[level][i];
-                                if (ucmp->Compare(file->smallest.user_key(), user_key) <= 0
-                                    && ucmp->Compare(file->largest.user_key(), user_key) >= 0) {
-                                    files = &files_[level][i];
-                                    num_files = 1;
-                                    break;
-                                }
-                            }
-                        } else {
-                            // the model predicts a region larger than its size -- target key not in this level
-                            files = nullptr;
-                            num_files = 0;
-                        }
-                    } else {
-                        // if no models available follow the baseline path
-                        adgMod::levelled_counters[14].Increment(level);
-                        // Binary search to find earliest index whose largest key >= ikey.
-                        uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
-                        if (index >= num_files) {
-                            files = nullptr;
-                            num_files = 0;
-                        } else {
-                            tmp2 = files[index];
-                            if (ucmp->Compare(user_key, tmp2->smallest.user_key()) < 0) {
-                                // All of "tmp2" is past any data for user_key
-                                files = nullptr;
-                                num_files = 0;
-                            } else {
-                                files = &tmp2;
-                                num_files = 1;
-                            }
-                        }
-                    }
+                tmp2 = FileForKey(level, user_key, ikey, &position_lower, &position_upper, &level_learned);
+                if (tmp2 == nullptr) {
+                    files = nullptr;
+                    num_files = 0;
                 } else {
-                    adgMod::levelled_counters[14].Increment(level);
-                    // Binary search to find earliest index whose largest key >= ikey.
-                    uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
-                    if (index >= num_files) {
-                        files = nullptr;
-                        num_files = 0;
-                    } else {
-                        tmp2 = files[index];
-                        if (ucmp->Compare(user_key, tmp2->smallest.user_key()) < 0) {
-                            // All of "tmp2" is past any data for user_key
-                            files = nullptr;
-                            num_files = 0;
-                        } else {
-                            files = &tmp2;
-                            num_files = 1;
-                        }
-                    }
+                    files = &tmp2;
+                    num_files = 1;
                 }
             }
             instance->PauseTimer(0);
@@ -490,7 +534,7 @@ namespace leveldb {
                     // If level model is not ready, this function will detect and see if file model is available
                     // param:learned means if level model is used
                     s = vset_->table_cache_->Get(options, f->number, f->file_size, ikey,
-                                                 &saver, SaveValue, level, f, position_lower, position_upper, false,
+                                                 &saver, SaveValue, level, f, position_lower, position_upper, level_learned,
                                                  this, &model, &file_learned);
                 }
                 auto temp = instance->PauseTimer(6, true);
@@ -551,6 +595,108 @@ namespace leveldb {
         return Status::NotFound(Slice());  // Use an empty error message for speed
     }
 
+    void Version::MultiGet(const ReadOptions &options, const std::vector<const LookupKey *> &keys,
+                           const std::vector<std::string *> &values, std::vector<Status> *statuses) {
+        const Comparator *ucmp = vset_->icmp_.user_comparator();
+        const size_t n = keys.size();
+        std::vector<Saver> savers(n);
+        for (size_t i = 0; i < n; ++i) {
+            savers[i].state = kNotFound;
+            savers[i].ucmp = ucmp;
+            savers[i].user_key = keys[i]->user_key();
+            savers[i].value = values[i];
+        }
+        statuses->assign(n, Status::NotFound(Slice()));
+        std::vector<bool> failed(n, false);
+
+        // keys not yet found or deleted, in key order
+        std::vector<size_t> pending(n);
+        for (size_t i = 0; i < n; ++i) pending[i] = i;
+
+        std::vector<FileMetaData *> targets;
+        std::vector<Slice> ikeys;
+        std::vector<void *> args;
+        std::vector<TableCache::FileLookups> lookups;
+        std::vector<size_t> runs;
+        for (int level = 0; level < config::kNumLevels && !pending.empty(); level++) {
+            if (files_[level].empty()) continue;
+
+            if (level == 0) {
+                // Level-0 files may overlap each other: search the files of each key
+                // from newest to oldest, as Get does
+                for (size_t i : pending) {
+                    FileMetaData *const *level0_files;
+                    size_t num_level0_files;
+                    Level0Files(savers[i].user_key, &level0_files, &num_level0_files);
+                    Slice ikey = keys[i]->internal_key();
+                    void *arg = &savers[i];
+                    for (size_t j = 0; j < num_level0_files; ++j) {
+                        FileMetaData *f = level0_files[j];
+                        TableCache::FileLookups lookup = {f, level, &ikey, &arg, 1, Status()};
+                        Status s = vset_->table_cache_->MultiGet(options, &lookup, 1, SaveValue, this);
+                        if (!s.ok()) {
+                            (*statuses)[i] = s;
+                            failed[i] = true;
+                        }
+                        if (failed[i] || savers[i].state != kNotFound) break;
+                    }
+                }
+            } else {
+                // Files in a level are disjoint, so the sorted keys falling in one file
+                // are consecutive: look up each such run in its file, all runs at once
+                targets.resize(pending.size());
+                for (size_t p = 0; p < pending.size(); ++p) {
+                    size_t i = pending[p];
+                    targets[p] = FileForKey(level, savers[i].user_key, keys[i]->internal_key());
+                }
+                ikeys.clear();
+                args.clear();
+                lookups.clear();
+                runs.clear();
+                for (size_t p = 0; p < pending.size(); ++p) {
+                    ikeys.push_back(keys[pending[p]]->internal_key());
+                    args.push_back(&savers[pending[p]]);
+                }
+                size_t end;
+                for (size_t p = 0; p < pending.size(); p = end) {
+                    end = p + 1;
+                    while (end < pending.size() && targets[end] == targets[p]) ++end;
+                    if (targets[p] == nullptr) continue;
+                    lookups.push_back({targets[p], level, &ikeys[p], &args[p], end - p, Status()});
+                    runs.push_back(p);
+                }
+                vset_->table_cache_->MultiGet(options, lookups.data(), lookups.size(), SaveValue, this);
+                for (size_t b = 0; b < lookups.size(); ++b) {
+                    if (lookups[b].status.ok()) continue;
+                    for (size_t q = runs[b]; q < runs[b] + lookups[b].n; ++q) {
+                        (*statuses)[pending[q]] = lookups[b].status;
+                        failed[pending[q]] = true;
+                    }
+                }
+            }
+
+            // settle the keys found or deleted in this level
+            size_t remaining = 0;
+            for (size_t i : pending) {
+                if (failed[i]) continue;
+                switch (savers[i].state) {
+                    case kNotFound:
+                        pending[remaining++] = i;
+                        break;
+                    case kFound:
+                        (*statuses)[i] = Status::OK();
+                        break;
+                    case kDeleted:
+                        break;
+                    case kCorrupt:
+                        (*statuses)[i] = Status::Corruption("corrupted key for ", savers[i].user_key);
+                        break;
+                }
+            }
+            pending.resize(remaining);
+        }
+    }
+
     bool Version::UpdateStats(const GetStats &stats) {
         FileMetaData *f = stats.seek_file;
         if (f != nullptr) {
@@ -867,6 +1013,7 @@ namespace leveldb {
                 }
 #endif
             }
+            v->BuildLevel0Index();
         }
 
         void MaybeAddFile(Version *v, int level, FileMetaData *f) {
@@ -898,6 +1045,8 @@ namespace leveldb {
               last_sequence_(0),
               log_number_(0),
               prev_log_number_(0),
+              has_vlog_head_(false),
+              vlog_head_(0),
               descriptor_file_(nullptr),
               descriptor_log_(nullptr),
               dummy_versions_(this),
@@ -943,6 +1092,11 @@ namespace leveldb {
         for (int i = 1; i < config::kNumLevels; ++i) {
             if (changed_level.count(i) == 0) {
                 current->learned_index_data_[i] = previous->learned_index_data_[i];
+            } else if (adgMod::MOD == 9 && !adgMod::level_entry_model) {
+                // Refit only the regions of the model the edit touched, so that the level keeps a
+                // model through compactions; otherwise it is learned again in the background
+                current->learned_index_data_[i]->UpdateLevel(previous->learned_index_data_[i].get(),
+                                                             previous->files_[i], current->files_[i]);
             }
         }
     }
@@ -1022,6 +1176,10 @@ namespace leveldb {
             AppendVersion(v);
             log_number_ = edit->log_number_;
             prev_log_number_ = edit->prev_log_number_;
+            if (edit->has_vlog_head_) {
+                has_vlog_head_ = true;
+                vlog_head_ = edit->vlog_head_;
+            }
         } else {
             delete v;
             if (!new_manifest_file.empty()) {
@@ -1071,10 +1229,12 @@ namespace leveldb {
         bool have_prev_log_number = false;
         bool have_next_file = false;
         bool have_last_sequence = false;
+        bool have_vlog_head = false;
         uint64_t next_file = 0;
         uint64_t last_sequence = 0;
         uint64_t log_number = 0;
         uint64_t prev_log_number = 0;
+        uint64_t vlog_head = 0;
         Builder builder(this, current_);
 
         {
@@ -1119,6 +1279,11 @@ namespace leveldb {
                     last_sequence = edit.last_sequence_;
                     have_last_sequence = true;
                 }
+
+                if (edit.has_vlog_head_) {
+                    vlog_head = edit.vlog_head_;
+                    have_vlog_head = true;
+                }
             }
         }
         delete file;
@@ -1152,6 +1317,8 @@ namespace leveldb {
             last_sequence_ = last_sequence;
             log_number_ = log_number;
             prev_log_number_ = prev_log_number;
+            has_vlog_head_ = have_vlog_head;
+            vlog_head_ = vlog_head;
 
             // See if we can reuse the existing MANIFEST file.
             if (ReuseManifest(dscname, current)) {
@@ -1245,6 +1412,9 @@ namespace leveldb {
         // Save metadata
         VersionEdit edit;
         edit.SetComparatorName(icmp_.user_comparator()->Name());
+        if (has_vlog_head_) {
+            edit.SetVlogHead(vlog_head_);
+        }
 
         // Save compaction pointers
         for (int level = 0; level < config::kNumLevels; level++) {
@@ -1388,10 +1558,28 @@ namespace leveldb {
         GetRange(all, smallest, largest);
     }
 
-    Iterator *VersionSet::MakeInputIterator(Compaction *c) {
+    Iterator *VersionSet::MakeInputIterator(Compaction *c, MergeSource **source) {
         ReadOptions options;
         options.verify_checksums = options_->paranoid_checks;
         options.fill_cache = false;
+        if (source != nullptr) *source = nullptr;
+
+        // Learned merge, and composing output models from input models, need one child per
+        // input file to track positions within the file model of each child.
+        if ((adgMod::learned_merge || adgMod::compose_models) &&
+            (adgMod::MOD == 6 || adgMod::MOD == 7 || adgMod::MOD == 9)) {
+            std::vector<Iterator *> list;
+            std::vector<adgMod::LearnedIndexData *> models;
+            for (int which = 0; which < 2; which++) {
+                for (FileMetaData *file : c->inputs_[which]) {
+                    list.push_back(table_cache_->NewIterator(options, file->number, file->file_size));
+                    adgMod::LearnedIndexData *model = adgMod::file_data->GetModel(file->number);
+                    models.push_back(model->Learned() ? model : nullptr);
+                }
+            }
+            return NewLearnedMergingIterator(&icmp_, list.data(), models.data(), list.size(), c->level() + 1,
+                                             adgMod::compose_models ? source : nullptr);
+        }
 
         // Level-0 files have to be merged together.  For other levels,
         // we will make a concatenating iterator per level.
@@ -1651,12 +1839,15 @@ namespace leveldb {
     Compaction::Compaction(const Options *options, int level)
             : level_(level),
               max_output_file_size_(MaxFileSizeForLevel(options, level)),
-              input_version_(nullptr),
-              grandparent_index_(0),
-              seen_key_(false),
-              overlapped_bytes_(0) {
+              input_version_(nullptr) {
+    }
+
+    Compaction::Cursor::Cursor()
+            : grandparent_index(0),
+              seen_key(false),
+              overlapped_bytes(0) {
         for (int i = 0; i < config::kNumLevels; i++) {
-            level_ptrs_[i] = 0;
+            level_ptrs[i] = 0;
         }
     }
 
@@ -1684,13 +1875,13 @@ namespace leveldb {
         }
     }
 
-    bool Compaction::IsBaseLevelForKey(const Slice &user_key) {
+    bool Compaction::IsBaseLevelForKey(const Slice &user_key, Cursor *cursor) {
         // Maybe use binary search to find right entry instead of linear search?
         const Comparator *user_cmp = input_version_->vset_->icmp_.user_comparator();
         for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
             const std::vector<FileMetaData *> &files = input_version_->files_[lvl];
-            for (; level_ptrs_[lvl] < files.size();) {
-                FileMetaData *f = files[level_ptrs_[lvl]];
+            for (; cursor->level_ptrs[lvl] < files.size();) {
+                FileMetaData *f = files[cursor->level_ptrs[lvl]];
                 if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
                     // We've advanced far enough
                     if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1699,36 +1890,73 @@ namespace leveldb {
                     }
                     break;
                 }
-                level_ptrs_[lvl]++;
+                cursor->level_ptrs[lvl]++;
             }
         }
         return true;
     }
 
-    bool Compaction::ShouldStopBefore(const Slice &internal_key) {
+    bool Compaction::ShouldStopBefore(const Slice &internal_key, Cursor *cursor) {
         const VersionSet *vset = input_version_->vset_;
         // Scan to find earliest grandparent file that contains key.
         const InternalKeyComparator *icmp = &vset->icmp_;
-        while (grandparent_index_ < grandparents_.size() &&
+        while (cursor->grandparent_index < grandparents_.size() &&
                icmp->Compare(internal_key,
-                             grandparents_[grandparent_index_]->largest.Encode()) >
+                             grandparents_[cursor->grandparent_index]->largest.Encode()) >
                0) {
-            if (seen_key_) {
-                overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+            if (cursor->seen_key) {
+                cursor->overlapped_bytes += grandparents_[cursor->grandparent_index]->file_size;
             }
-            grandparent_index_++;
+            cursor->grandparent_index++;
         }
-        seen_key_ = true;
+        cursor->seen_key = true;
 
-        if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
+        if (cursor->overlapped_bytes > MaxGrandParentOverlapBytes(vset->options_)) {
             // Too much overlap for current output; start new output
-            overlapped_bytes_ = 0;
+            cursor->overlapped_bytes = 0;
             return true;
         } else {
             return false;
         }
     }
 
+    void Compaction::GetSubcompactionBoundaries(int max_subcompactions,
+                                                std::vector<std::string> *boundaries) const {
+        boundaries->clear();
+        if (max_subcompactions <= 1) return;
+        const Comparator *user_cmp = input_version_->vset_->icmp_.user_comparator();
+
+        // Candidate cut points are the largest user keys of the input files. The
+        // input bytes of a file are attributed to its largest key.
+        std::vector<std::pair<Slice, uint64_t>> ends;
+        uint64_t total_bytes = 0;
+        for (int which = 0; which < 2; which++) {
+            for (FileMetaData *f : inputs_[which]) {
+                ends.emplace_back(f->largest.user_key(), f->file_size);
+                total_bytes += f->file_size;
+            }
+        }
+        if (ends.size() < 2) return;
+        std::sort(ends.begin(), ends.end(),
+                  [user_cmp](const std::pair<Slice, uint64_t> &a, const std::pair<Slice, uint64_t> &b) {
+                      return user_cmp->Compare(a.first, b.first) < 0;
+                  });
+
+        // Cut at the file end that brings the accumulated input past the next
+        // equal share. All entries of a cut key go to the sub-range starting at
+        // it, so a user key is never split. Cutting at the last file end would
+        // leave almost nothing for the last sub-range.
+        const uint64_t share = total_bytes / max_subcompactions;
+        uint64_t accumulated = 0;
+        for (size_t i = 0; i + 1 < ends.size(); i++) {
+            accumulated += ends[i].second;
+            if (accumulated < share * (boundaries->size() + 1)) continue;
+            if (user_cmp->Compare(ends[i].first, ends[i + 1].first) == 0) continue;
+            boundaries->push_back(ends[i].first.ToString());
+            if (boundaries->size() + 1 == static_cast<size_t>(max_subcompactions)) break;
+        }
+    }
+
     void Compaction::ReleaseInputs() {
         if (input_version_ != nullptr) {
             input_version_->Unref();
@@ -1765,17 +1993,45 @@ namespace leveldb {
 
         for (int j = 0; j < files_[level].size(); ++j) {
             FileMetaData *file = files_[level][j];
-            data->string_keys.emplace_back(file->smallest.user_key().data(), file->smallest.user_key().size());
-            data->string_keys.emplace_back(file->largest.user_key().data(), file->largest.user_key().size());
+            data->keys.push_back(adgMod::SliceToInteger(file->smallest.user_key()));
+            data->keys.push_back(adgMod::SliceToInteger(file->largest.user_key()));
         }
         // push the maximun key in to the data points
         return true;
     }
 
+    bool Version::LearnLevelEntries(const ReadOptions &options, int level) {
+        if (files_[level].empty()) return false;
+
+        adgMod::FileModelBuilder builder(learned_index_data_[level].get());
+        for (FileMetaData *file : files_[level]) {
+            // given up like the learning of other level models
+            if (adgMod::env->compaction_awaiting.load() != 0) return false;
+            adgMod::LearnedIndexData *model = adgMod::file_data->GetModel(file->number);
+            if (!model->Learned() || !builder.AddTable(model)) {
+                Iterator *iter = vset_->table_cache_->NewIterator(options, file->number, file->file_size);
+                for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+                    builder.Add(ExtractUserKey(iter->key()));
+                }
+                Status s = iter->status();
+                delete iter;
+                if (!s.ok()) return false;
+            }
+            builder.FinishTable(file->largest.user_key());
+        }
+        return builder.Finish();
+    }
+
+    // Level models over entries are written apart from models over file pairs, which they
+    // cannot be read as
+    static const char *LevelModelSuffix() {
+        return adgMod::level_entry_model ? ".emodel" : ".model";
+    }
+
     void Version::WriteLevelModel() {
         //return;
         for (int i = 0; i < config::kNumLevels; ++i) {
-            learned_index_data_[i]->WriteModel(vset_->dbname_ + "/" + to_string(i) + ".model");
+            learned_index_data_[i]->WriteModel(vset_->dbname_ + "/" + to_string(i) + LevelModelSuffix());
             for (FileMetaData *file_meta : files_[i]) {
                 adgMod::file_data->GetModel(file_meta->number)->WriteModel(
                         vset_->dbname_ + "/" + to_string(file_meta->number) + ".fmodel");
@@ -1787,8 +2043,11 @@ namespace leveldb {
         uint64_t file_max = 0;
         for (int i = 0; i < config::kNumLevels; ++i) {
 
-            if (adgMod::load_level_model)
-                learned_index_data_[i]->ReadModel(vset_->dbname_ + "/" + to_string(i) + ".model");
+            if (adgMod::load_level_model) {
+                learned_index_data_[i]->ReadModel(vset_->dbname_ + "/" + to_string(i) + LevelModelSuffix());
+                // a model over the entries of a level searches its accumulated array on every lookup
+                if (adgMod::level_entry_model) learned_index_data_[i]->LoadAccumulated();
+            }
 
             for (FileMetaData *file_meta : files_[i]) {
                 if (adgMod::load_file_model) {
@@ -1816,6 +2075,8 @@ namespace leveldb {
     void Version::FileLearn() {
         for (int i = 0; i < config::kNumLevels; ++i) {
             for (FileMetaData *file_meta : files_[i]) {
+                if ((adgMod::learn_on_build || adgMod::compose_models) &&
+                    adgMod::file_data->GetModel(file_meta->number)->Learned()) continue;
                 adgMod::LearnedIndexData::FileLearn(new adgMod::MetaAndSelf{this, adgMod::db->version_count, file_meta,
                                                                             adgMod::file_data->GetModel(
                                                                                     file_meta->number), i});
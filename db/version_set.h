@@ -15,6 +15,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -33,6 +34,7 @@ class Writer;
 class Compaction;
 class Iterator;
 class MemTable;
+class MergeSource;
 class TableBuilder;
 class TableCache;
 class Version;
@@ -75,6 +77,14 @@ class Version {
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  // Batched Get: looks up every keys[i], sorted by user key, and on success
+  // stores its value in *values[i].  Sets (*statuses)[i] as Get would return
+  // it.  Keys of a level that fall in the same file are looked up together.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, const std::vector<const LookupKey*>& keys,
+                const std::vector<std::string*>& values,
+                std::vector<Status>* statuses);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -121,6 +131,9 @@ class Version {
   // Fill level model data, essentially fill every file model data in that level and copy
   // them as a whole
   bool FillLevel(const ReadOptions& options, int level);
+  // Learn the level model over every entry of the level, copying the segments of the learned
+  // file models and reading the other files; false if given up for a compaction
+  bool LearnLevelEntries(const ReadOptions& options, int level);
   // Write and read file&level models (the name is misguiding LOL)
   void WriteLevelModel();
   void ReadLevelModel();
@@ -134,6 +147,20 @@ class Version {
   friend class VersionSet;
   friend class adgMod::LearnedIndexData;
 
+  // The file of level > 0 that may hold user_key, or nullptr.  Uses the level
+  // model when MOD == 9 and it is learned.  If the model covers the entries of
+  // the level, *learned is set and [*lower, *upper] are the positions of the
+  // entries in the file that may hold user_key.
+  FileMetaData* FileForKey(int level, const Slice& user_key, const Slice& ikey,
+                           uint64_t* lower = nullptr, uint64_t* upper = nullptr,
+                           bool* learned = nullptr);
+
+  // Build the index of the level-0 files from files_[0].
+  void BuildLevel0Index();
+  // Set *files to the *num level-0 files that may hold user_key, newest first.
+  void Level0Files(const Slice& user_key, FileMetaData* const** files,
+                   size_t* num) const;
+
   class LevelFileNumIterator;
 
   explicit Version(VersionSet* vset)
@@ -145,8 +172,9 @@ class Version {
         file_to_compact_level_(-1),
         compaction_score_(-1),
         compaction_level_(-1) {
+            // a model over the entries of a level is searched like a file model
             for (int i = 0; i < config::kNumLevels; ++i)
-                learned_index_data_.push_back(std::make_shared<adgMod::LearnedIndexData>(adgMod::level_allowed_seek, true));
+                learned_index_data_.push_back(std::make_shared<adgMod::LearnedIndexData>(adgMod::level_allowed_seek, !adgMod::level_entry_model));
         }
 
   Version(const Version&) = delete;
@@ -172,6 +200,16 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Index of the level-0 files, built with the version.  The distinct bounds
+  // of the files, in order, split the user keys into slots: slot 2i+1 is
+  // level0_bounds_[i] itself and slot 2i the keys between it and the bound
+  // before it.  The files holding the keys of slot j are
+  // level0_files_[level0_slot_start_[j], level0_slot_start_[j+1]), newest
+  // first.
+  std::vector<Slice> level0_bounds_;
+  std::vector<uint32_t> level0_slot_start_;
+  std::vector<FileMetaData*> level0_files_;
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -234,12 +272,14 @@ class VersionSet {
   int64_t NumLevelBytes(int level) const;
 
   // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
     assert(s >= last_sequence_);
-    last_sequence_ = s;
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -252,6 +292,11 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
+  // Return whether the descriptor records a vlog head, and the vlog address
+  // from which the records have not been written to any table yet.
+  bool HasVlogHead() const { return has_vlog_head_; }
+  uint64_t VlogHead() const { return vlog_head_; }
+
   // Pick level and inputs for a new compaction.
   // Returns nullptr if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
@@ -271,7 +316,9 @@ class VersionSet {
 
   // Create an iterator that reads over the compaction inputs for "*c".
   // The caller should delete the iterator when no longer needed.
-  Iterator* MakeInputIterator(Compaction* c);
+  // If source is not nullptr, *source is set to where the iterator tells the
+  // input table and position of its entries, or nullptr if it cannot.
+  Iterator* MakeInputIterator(Compaction* c, MergeSource** source = nullptr);
 
   // Returns true iff some level needs a compaction.
   bool NeedsCompaction() const {
@@ -330,9 +377,11 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;  // read by Get without mutex_
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
+  bool has_vlog_head_;
+  uint64_t vlog_head_;
 
   // Opened lazily
   WritableFile* descriptor_file_;
@@ -374,14 +423,45 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // Position of one pass over the compaction input in key order.  A pass
+  // only moves forward, so the cursor lets IsBaseLevelForKey() and
+  // ShouldStopBefore() resume where the previous key left off.  Every
+  // subcompaction keeps its own cursor.
+  struct Cursor {
+    Cursor();
+
+    // State used to check for number of overlapping grandparent files
+    // (parent == level_ + 1, grandparent == level_ + 2)
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // State for implementing IsBaseLevelForKey
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key, Cursor* cursor);
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, Cursor* cursor);
+
+  // Split the key range of this compaction into at most "max_subcompactions"
+  // disjoint sub-ranges holding roughly equal amounts of input data.  Stores
+  // in *boundaries the sorted user keys that separate consecutive sub-ranges
+  // (sub-range i covers [boundaries[i-1], boundaries[i])); leaves it empty
+  // if the compaction should not be split.
+  void GetSubcompactionBoundaries(int max_subcompactions,
+                                  std::vector<std::string>* boundaries) const;
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -401,21 +481,8 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
 
-  // State used to check for number of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Files in level_ + 2 overlapping the output, see ShouldStopBefore()
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }  // namespace leveldb
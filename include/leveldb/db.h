@@ -8,6 +8,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <string>
+#include <vector>
+
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
@@ -90,6 +93,26 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value) = 0;
 
+  // Like Get, but *value may refer to the stored value in place, e.g. in a
+  // memory-mapped file, instead of a copy of it.  It stays valid until value
+  // is reset or destroyed.  On a miss value is reset.
+  //
+  // The default implementation reads into the buffer of *value.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value);
+
+  // Look up every key in "keys" as Get would, all as of the same snapshot.
+  // Sets (*statuses)[i] to what Get would return for keys[i] and, if it is
+  // OK, (*values)[i] to the value.  Both vectors are resized to keys.size().
+  //
+  // Cheaper than separate Gets for a batch of keys: the implementation may
+  // sort the batch and share lookups and reads between keys.  The default
+  // implementation calls Get for each key.
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
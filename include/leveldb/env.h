@@ -49,6 +49,7 @@ namespace leveldb {
 class FileLock;
 class Logger;
 class RandomAccessFile;
+struct ReadRequest;
 class SequentialFile;
 class Slice;
 class WritableFile;
@@ -93,6 +94,35 @@ class LEVELDB_EXPORT Env {
   virtual Status NewRandomAccessFile(const std::string& fname,
                                      RandomAccessFile** result) = 0;
 
+  // Perform requests[i] on files[i] for every i < num, setting the result
+  // and status of each as RandomAccessFile::MultiRead does.  Returns the
+  // first non-OK status, if any.  An implementation may keep all of them
+  // in flight at once; the default one reads them one after another.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status MultiRead(RandomAccessFile* const* files,
+                           ReadRequest* requests, size_t num);
+
+  // Like NewRandomAccessFile, but the returned file reads around the page
+  // cache (O_DIRECT on posix).  Reads need not be aligned; the file aligns
+  // them internally.
+  //
+  // May return an IsNotSupportedError error if this Env or the filesystem
+  // does not support direct I/O.  Callers should then use a file from
+  // NewRandomAccessFile instead.
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+
+  // Like NewRandomAccessFile, but the whole file is memory mapped, so that
+  // Read() returns slices into the mapping without using scratch.  They stay
+  // valid while the returned file lives.  The file must not grow meanwhile.
+  //
+  // May return an IsNotSupportedError error if this Env cannot map the file,
+  // e.g. because too many files are mapped already.  Callers should then use
+  // a file from NewRandomAccessFile instead.
+  virtual Status NewMappedRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+
   // Create an object that writes to a new file with the specified
   // name.  Deletes any existing file with the same name and creates a
   // new file.  On success, stores a pointer to the new file in
@@ -193,7 +223,11 @@ class LEVELDB_EXPORT Env {
   virtual void SleepForMicroseconds(int micros) = 0;
 
   virtual void ClearPendingLearning() {};
-  virtual void ScheduleLearning(void (*background_work_function)(void*), void* background_work_arg, int priority) {};
+  // Run the function on the learning thread.  Envs without one start a
+  // thread of its own for it.
+  virtual void ScheduleLearning(void (*background_work_function)(void*), void* background_work_arg, int priority) {
+    StartThread(background_work_function, background_work_arg);
+  }
   virtual void NewRandomAccessFileLearned(const std::string& filename, RandomAccessFile** result) {};
   virtual void PrepareLearning(uint64_t time_start, int level, FileMetaData* meta) {};
   std::atomic<int> compaction_awaiting;
@@ -229,6 +263,16 @@ class LEVELDB_EXPORT SequentialFile {
   virtual Status Skip(uint64_t n) = 0;
 };
 
+// One read of a MultiRead batch: "n" bytes at "offset" into "scratch", with
+// the same meaning as the arguments of RandomAccessFile::Read.
+struct LEVELDB_EXPORT ReadRequest {
+  uint64_t offset;
+  size_t n;
+  char* scratch;
+  Slice result;
+  Status status;
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class LEVELDB_EXPORT RandomAccessFile {
  public:
@@ -250,6 +294,14 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // Perform the "num" reads in "requests", setting the result and status
+  // of each.  Implementations may issue them together.  Returns the first
+  // non-OK status, if any.  The default implementation calls Read for
+  // each request in turn.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status MultiRead(ReadRequest* requests, size_t num) const;
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -330,6 +382,18 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
                              RandomAccessFile** r) override {
     return target_->NewRandomAccessFile(f, r);
   }
+  Status MultiRead(RandomAccessFile* const* f, ReadRequest* r,
+                   size_t n) override {
+    return target_->MultiRead(f, r, n);
+  }
+  Status NewDirectRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) override {
+    return target_->NewDirectRandomAccessFile(f, r);
+  }
+  Status NewMappedRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) override {
+    return target_->NewMappedRandomAccessFile(f, r);
+  }
   Status NewWritableFile(const std::string& f, WritableFile** r) override {
     return target_->NewWritableFile(f, r);
   }
@@ -368,6 +432,9 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   void StartThread(void (*f)(void*), void* a) override {
     return target_->StartThread(f, a);
   }
+  void ScheduleLearning(void (*f)(void*), void* a, int priority) override {
+    return target_->ScheduleLearning(f, a, priority);
+  }
   Status GetTestDirectory(std::string* path) override {
     return target_->GetTestDirectory(path);
   }
@@ -116,6 +116,20 @@ struct LEVELDB_EXPORT Options {
   // initially populating a large database.
   size_t max_file_size = 2 * 1024 * 1024;
 
+  // Maximum number of threads a single compaction is split across.  The key
+  // range of a large compaction is divided at input file boundaries into
+  // disjoint sub-ranges that are merged in parallel, and all of their
+  // outputs are installed together.  1 merges every compaction on the
+  // background compaction thread only.
+  int max_subcompactions = 1;
+
+  // If true, the entry intervals that learned lookups predict are read from
+  // tables opened with O_DIRECT, bypassing the page cache, so that reading a
+  // few hundred bytes does not pull whole pages of a table into memory.
+  // Everything else still goes through the normal file.  Ignored where the
+  // Env or the filesystem does not support direct I/O.
+  bool direct_reads = false;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
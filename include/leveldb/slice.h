@@ -19,6 +19,7 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <memory>
 #include <string>
 
 #include "leveldb/export.h"
@@ -110,6 +111,46 @@ inline int Slice::compare(const Slice& b) const {
   return r;
 }
 
+// A Slice that can keep the storage it refers to alive, so that a value can
+// be handed out from where it was read, e.g. a memory-mapped file, without
+// copying it.  Otherwise it refers to a buffer of its own that is reused by
+// the next read into it.  The data is valid until Reset() or destruction.
+class LEVELDB_EXPORT PinnableSlice : public Slice {
+ public:
+  PinnableSlice() {}
+
+  PinnableSlice(const PinnableSlice&) = delete;
+  PinnableSlice& operator=(const PinnableSlice&) = delete;
+
+  // Refer to s, which pin keeps alive.
+  void PinSlice(const Slice& s, std::shared_ptr<const void> pin) {
+    pin_ = std::move(pin);
+    Slice::operator=(s);
+  }
+
+  // Refer to the contents of GetSelf().
+  void PinSelf() {
+    pin_.reset();
+    Slice::operator=(self_);
+  }
+
+  // The buffer of this slice, to read into before calling PinSelf().
+  std::string* GetSelf() { return &self_; }
+
+  // Whether this slice refers to storage outside its own buffer.
+  bool IsPinned() const { return pin_ != nullptr; }
+
+  // Refer to nothing, releasing the pinned storage.
+  void Reset() {
+    pin_.reset();
+    clear();
+  }
+
+ private:
+  std::string self_;
+  std::shared_ptr<const void> pin_;
+};
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_INCLUDE_SLICE_H_
@@ -61,6 +61,10 @@ class LEVELDB_EXPORT Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const Slice& key) const;
 
+  // Where learned lookups find the entries of this table.  Tables without a
+  // layout block share the one recorded from the first block ever read.
+  TableLayout Layout() const;
+
  private:
   friend class TableCache;
 
@@ -78,6 +82,9 @@ class LEVELDB_EXPORT Table {
 
         BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
         Block* index_block;
+
+        TableLayout layout;
+        bool has_layout;  // False for tables written without a layout block
     };
 
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
@@ -93,6 +100,7 @@ class LEVELDB_EXPORT Table {
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadLayout(const Slice& layout_handle_value);
 
   void FillData(const ReadOptions& options, adgMod::LearnedIndexData* data);
 
@@ -19,6 +19,10 @@
 #include "leveldb/options.h"
 #include "leveldb/status.h"
 
+namespace adgMod {
+class LearnedIndexData;
+}
+
 namespace leveldb {
 
 class BlockBuilder;
@@ -51,12 +55,24 @@ class LEVELDB_EXPORT TableBuilder {
   // REQUIRES: Finish(), Abandon() have not been called
   void Add(const Slice& key, const Slice& value);
 
+  // Like Add(), for an entry read from position source_position of a table
+  // whose learned model is *source.  The model being learned (see
+  // TrainModel()) reuses the segments of source for runs of such entries.
+  void Add(const Slice& key, const Slice& value,
+           const adgMod::LearnedIndexData* source, uint64_t source_position);
+
   // Advanced operation: flush any buffered key/value pairs to file.
   // Can be used to ensure that two adjacent entries never live in
   // the same data block.  Most clients should not need to use this method.
   // REQUIRES: Finish(), Abandon() have not been called
   void Flush();
 
+  // Learn a file model for this table into *data from the keys as they are
+  // added, instead of reading the table back once it is written.  The model
+  // is installed by a successful Finish().
+  // REQUIRES: Add() has not been called
+  void TrainModel(adgMod::LearnedIndexData* data);
+
   // Return non-ok iff some error has been detected.
   Status status() const;
 
@@ -83,6 +99,8 @@ class LEVELDB_EXPORT TableBuilder {
   bool ok() const { return status().ok(); }
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
+  // Checks the data block just written against the layout so far.
+  void UpdateLayout(uint64_t raw_size);
 
   struct Rep;
   Rep* rep_;
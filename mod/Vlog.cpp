@@ -2,72 +2,559 @@
 // Created by daiyi on 2020/03/23.
 //
 
-#include <fcntl.h>
-#include <sys/stat.h>
+#include <algorithm>
 #include "Vlog.h"
 #include "util.h"
 #include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/logging.h"
+#include "util/mutexlock.h"
 
 using std::string;
 
-
+namespace leveldb {
+Status WriteStringToFileSync(Env* env, const Slice& data, const std::string& fname);
+}
 
 const int buffer_size_max = 300 * 1024;
 
 namespace adgMod {
 
-VLog::VLog(const std::string& vlog_name) : writer(nullptr), reader(nullptr) {
-    adgMod::env->NewWritableFile(vlog_name, &writer);
-    adgMod::env->NewRandomAccessFile(vlog_name, &reader);
+namespace {
+
+// An address is the segment number in the high bits and the offset in the segment in the
+// low ones, so the addresses of segment 0 are plain offsets into vlog.txt
+const int kOffsetBits = 40;
+
+uint64_t SegmentOf(uint64_t address) { return address >> kOffsetBits; }
+uint64_t OffsetOf(uint64_t address) { return address & ((uint64_t(1) << kOffsetBits) - 1); }
+uint64_t MakeAddress(uint64_t segment, uint64_t offset) { return (segment << kOffsetBits) | offset; }
+
+// Every segment but 0 starts with the magic number and its own number. The records of
+// segments with kSegmentMagic start with the masked crc32c of the rest of the record; those
+// with kUnchecksummedSegmentMagic were written before records had one
+const uint64_t kSegmentMagic = 0x63676573676f6c76ull;  // "vlogsegc"
+const uint64_t kUnchecksummedSegmentMagic = 0x6d676573676f6c76ull;  // "vlogsegm"
+const uint64_t kHeaderSize = 2 * sizeof(uint64_t);
+const uint64_t kChecksumSize = sizeof(uint32_t);
+
+// Stands for the value size of a deletion, which has no value
+const uint32_t kDeletionSize = 0xffffffffu;
+
+string SegmentFileName(const string& dbname, uint64_t number) {
+    if (number == 0) return dbname + "/vlog.txt";
+    char buf[100];
+    snprintf(buf, sizeof(buf), "/%06llu.vlog", static_cast<unsigned long long>(number));
+    return dbname + buf;
+}
+
+// Sealed segments no longer change, so they can be mapped. Only the first reader of a
+// segment tries, so that the segments nobody reads take none of the Env's mmap slots
+void MapSegment(const string& fname, VLogSegment* segment) {
+    if (!segment->mappable.exchange(false, std::memory_order_acq_rel)) return;
+    RandomAccessFile* mapped;
+    if (adgMod::env->NewMappedRandomAccessFile(fname, &mapped).ok()) {
+        segment->mapped.store(mapped, std::memory_order_release);
+    }
+}
+
+bool ParseSegmentFileName(const string& filename, uint64_t* number) {
+    if (filename == "vlog.txt") {
+        *number = 0;
+        return true;
+    }
+    Slice rest(filename);
+    return ConsumeDecimalNumber(&rest, number) && *number > 0 && rest == Slice(".vlog");
+}
+
+}
+
+void EncodeVlogPointer(char* dst, uint64_t address, uint32_t size) {
+    dst[0] = kVlogPointer;
+    EncodeFixed64(dst + 1, address);
+    EncodeFixed32(dst + 1 + sizeof(uint64_t), size);
+}
+
+bool DecodeVlogPointer(const Slice& stored, uint64_t* address, uint32_t* size) {
+    if (stored.size() == kUntaggedVlogPointerSize) {
+        *address = DecodeFixed64(stored.data());
+        *size = DecodeFixed32(stored.data() + sizeof(uint64_t));
+        return true;
+    }
+    if (stored.size() != kVlogPointerSize || stored[0] != kVlogPointer) return false;
+    *address = DecodeFixed64(stored.data() + 1);
+    *size = DecodeFixed32(stored.data() + 1 + sizeof(uint64_t));
+    return true;
+}
+
+void EncodeInlineValue(const Slice& value, std::string* dst) {
+    dst->assign(1, static_cast<char>(kInlineValue));
+    dst->append(value.data(), value.size());
+    if (dst->size() == kUntaggedVlogPointerSize) {
+        (*dst)[0] = static_cast<char>(kPaddedInlineValue);
+        dst->push_back('\0');
+    }
+}
+
+Slice DecodeInlineValue(const Slice& stored) {
+    assert(!stored.empty());
+    const size_t padding = stored[0] == kPaddedInlineValue ? 1 : 0;
+    return Slice(stored.data() + 1, stored.size() - 1 - padding);
+}
+
+VLog::VLog(const std::string& dbname) : dbname(dbname), segments(std::make_shared<const SegmentMap>()), flush_done(&mutex),
+    writer(nullptr), flush_in_progress(false), head(0) {
     buffer.reserve(buffer_size_max * 2);
-    struct ::stat file_stat;
-    ::stat(vlog_name.c_str(), &file_stat);
-    vlog_size = file_stat.st_size;
 }
 
-uint64_t VLog::AddRecord(const Slice& key, const Slice& value) {
+Status VLog::Open() {
+    SegmentMap loaded;
+    std::vector<string> children;
+    Status s = adgMod::env->GetChildren(dbname, &children);
+    if (!s.ok()) return s;
+    std::vector<uint64_t> numbers;
+    for (const string& child : children) {
+        uint64_t number;
+        if (ParseSegmentFileName(child, &number)) numbers.push_back(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+    for (uint64_t number : numbers) {
+        string fname = SegmentFileName(dbname, number);
+        uint64_t size;
+        s = adgMod::env->GetFileSize(fname, &size);
+        if (!s.ok()) return s;
+        if (number == 0 && size == 0) continue;
+        if (number > 0 && size < kHeaderSize && number == numbers.back()) {
+            // created just before a crash, before it had any record
+            adgMod::env->DeleteFile(fname);
+            continue;
+        }
+        RandomAccessFile* reader;
+        s = adgMod::env->NewRandomAccessFile(fname, &reader);
+        if (!s.ok()) return s;
+        bool checksummed = number > 0;
+        if (number > 0) {
+            char scratch[kHeaderSize];
+            Slice header;
+            s = reader->Read(0, kHeaderSize, &header, scratch);
+            if (s.ok()) {
+                if (header.size() == kHeaderSize && DecodeFixed64(header.data()) == kUnchecksummedSegmentMagic) {
+                    checksummed = false;
+                } else if (header.size() != kHeaderSize || DecodeFixed64(header.data()) != kSegmentMagic) {
+                    s = Status::Corruption("bad vlog segment header", fname);
+                }
+                if (s.ok() && DecodeFixed64(header.data() + sizeof(uint64_t)) != number) {
+                    s = Status::Corruption("bad vlog segment header", fname);
+                }
+            }
+            if (!s.ok()) {
+                delete reader;
+                return s;
+            }
+        }
+        loaded[number] = std::make_shared<VLogSegment>(number, reader, size, checksummed);
+        // appends go to a new segment
+        loaded[number]->mappable.store(true, std::memory_order_release);
+    }
+    segments = std::make_shared<const SegmentMap>(std::move(loaded));
+
+    // the dead bytes counted before the last close
+    string state;
+    if (ReadFileToString(adgMod::env, dbname + "/vlog.gc", &state).ok()) {
+        Slice input(state);
+        uint64_t number, bytes;
+        while (GetVarint64(&input, &number) && GetVarint64(&input, &bytes)) {
+            if (segments->count(number) > 0) garbage[number] = bytes;
+        }
+    }
+    return Status::OK();
+}
+
+std::shared_ptr<VLogSegment> VLog::FindSegment(uint64_t number) const {
+    std::shared_ptr<const SegmentMap> current = std::atomic_load(&segments);
+    auto iter = current->find(number);
+    return iter == current->end() ? nullptr : iter->second;
+}
+
+void VLog::PublishSegment(const std::shared_ptr<VLogSegment>& segment) {
+    // only the appender holding mutex adds segments and only collection drops them, so they
+    // serialize on gc_mutex
+    MutexLock l(&gc_mutex);
+    std::shared_ptr<SegmentMap> updated = std::make_shared<SegmentMap>(*std::atomic_load(&segments));
+    (*updated)[segment->number] = segment;
+    std::atomic_store(&segments, std::shared_ptr<const SegmentMap>(updated));
+}
+
+Status VLog::NewSegment(uint64_t number) {
+    mutex.AssertHeld();
+    // the segment before must be whole on disk before records follow it elsewhere
+    Status s;
+    if (writer != nullptr) s = writer->Sync();
+    if (!s.ok()) return s;
+
+    string fname = SegmentFileName(dbname, number);
+    WritableFile* file;
+    RandomAccessFile* reader;
+    s = adgMod::env->NewWritableFile(fname, &file);
+    if (!s.ok()) return s;
+    string header;
+    PutFixed64(&header, kSegmentMagic);
+    PutFixed64(&header, number);
+    s = file->Append(header);
+    if (s.ok()) s = file->Flush();
+    if (s.ok()) s = adgMod::env->NewRandomAccessFile(fname, &reader);
+    if (!s.ok()) {
+        delete file;
+        adgMod::env->DeleteFile(fname);
+        return s;
+    }
+
+    if (writer != nullptr) {
+        writer->Close();
+        delete writer;
+        active->mappable.store(true, std::memory_order_release);
+    }
+    writer = file;
+    active = std::make_shared<VLogSegment>(number, reader, kHeaderSize, true);
+    PublishSegment(active);
+    return Status::OK();
+}
+
+Status VLog::AddRecord(const Slice& key, const Slice& value, uint64_t* address) {
+    return Append(key, value.size(), value, address);
+}
+
+Status VLog::AddDeletion(const Slice& key) {
+    uint64_t address;
+    Status s = Append(key, kDeletionSize, Slice(), &address);
+    if (!s.ok()) return s;
+    // dead once it is in a table, and the head keeps the segment until then
+    MutexLock l(&gc_mutex);
+    garbage[SegmentOf(address)] += kChecksumSize + VarintLength(key.size()) + key.size() + VarintLength(kDeletionSize);
+    return s;
+}
+
+// Sets *address to the address of the value, which follows the checksum, key and value_size
+Status VLog::Append(const Slice& key, uint32_t value_size, const Slice& value, uint64_t* address) {
+    MutexLock l(&mutex);
+    const uint64_t header_size = kChecksumSize + VarintLength(key.size()) + key.size() + VarintLength(value_size);
+    uint64_t end;
+    while (true) {
+        if (!write_error.ok()) return write_error;
+        end = active == nullptr ? 0 : active->size + flushing.size() + buffer.size();
+        if (active != nullptr && (end == kHeaderSize || end + header_size + value.size() <= vlog_segment_size)) break;
+        // seal the segment once its records are all in the file
+        if (flush_in_progress) {
+            flush_done.Wait();
+        } else if (!buffer.empty()) {
+            Flush();
+        } else {
+            std::shared_ptr<const SegmentMap> current = std::atomic_load(&segments);
+            write_error = NewSegment(current->empty() ? 1 : current->rbegin()->first + 1);
+        }
+    }
+
+    // Flush below lets other appenders in, who may start a new segment
+    *address = MakeAddress(active->number, end + header_size);
+    const size_t start = buffer.size();
+    buffer.append(kChecksumSize, '\0');
     PutLengthPrefixedSlice(&buffer, key);
-    PutVarint32(&buffer, value.size());
-    uint64_t result = vlog_size + buffer.size();
+    PutVarint32(&buffer, value_size);
     buffer.append(value.data(), value.size());
+    const char* checked = buffer.data() + start + kChecksumSize;
+    EncodeFixed32(&buffer[start], crc32c::Mask(crc32c::Value(checked, buffer.data() + buffer.size() - checked)));
+
+    if (buffer.size() >= buffer_size_max) {
+        // one appender writes the buffer while the others keep filling it, up to a limit
+        while (flush_in_progress && buffer.size() >= 2 * buffer_size_max) flush_done.Wait();
+        if (!flush_in_progress) Flush();
+    }
+    // if that flush failed, the record stays readable in memory and the next append or Sync
+    // reports the error
+    return Status::OK();
+}
 
-    if (buffer.size() >= buffer_size_max) Flush();
-    return result;
+Status VLog::ReadRecord(uint64_t address, uint32_t size, string* value) {
+    Slice result;
+    std::shared_ptr<VLogSegment> segment;
+    Status s = Read(address, size, value, &result, &segment);
+    if (!s.ok()) return s;
+    if (result.data() != value->data()) value->assign(result.data(), result.size());
+    return s;
 }
 
-string VLog::ReadRecord(uint64_t address, uint32_t size) {
-    if (address >= vlog_size) return string(buffer.c_str() + address - vlog_size, size);
+Status VLog::ReadRecord(uint64_t address, uint32_t size, PinnableSlice* value) {
+    Slice result;
+    std::shared_ptr<VLogSegment> segment;
+    Status s = Read(address, size, value->GetSelf(), &result, &segment);
+    if (!s.ok()) return s;
+    if (result.data() == value->GetSelf()->data()) {
+        value->PinSelf();
+    } else {
+        // the mapping lives as long as the segment, even once it is dropped
+        value->PinSlice(result, std::move(segment));
+    }
+    return s;
+}
 
-    char* scratch = new char[size];
-    Slice value;
-    reader->Read(address, size, &value, scratch);
-    string result(value.data(), value.size());
-    delete[] scratch;
-    return result;
+// Sets *result to the record, in place if the segment is mapped and in *scratch otherwise.
+// *segment is set to the segment it is in
+Status VLog::Read(uint64_t address, uint32_t size, string* scratch, Slice* result,
+                  std::shared_ptr<VLogSegment>* segment) {
+    *segment = FindSegment(SegmentOf(address));
+    if (*segment == nullptr) return Status::NotFound("vlog segment dropped");
+    const uint64_t number = (*segment)->number;
+    const uint64_t offset = OffsetOf(address);
+    if (offset + size > (*segment)->size.load(std::memory_order_acquire)) {
+        // the record may still be buffered, unless a flush has just written it
+        MutexLock l(&mutex);
+        uint64_t flushed = (*segment)->size.load(std::memory_order_relaxed);
+        if (*segment == active && offset >= flushed) {
+            if (offset < flushed + flushing.size()) {
+                scratch->assign(flushing.data() + offset - flushed, size);
+            } else {
+                scratch->assign(buffer.data() + offset - flushed - flushing.size(), size);
+            }
+            *result = *scratch;
+            return Status::OK();
+        }
+    }
+
+    Status s;
+    if ((*segment)->mappable.load(std::memory_order_relaxed)) {
+        MapSegment(SegmentFileName(dbname, number), segment->get());
+    }
+    RandomAccessFile* mapped = (*segment)->mapped.load(std::memory_order_acquire);
+    if (mapped != nullptr) {
+        s = mapped->Read(offset, size, result, nullptr);
+    } else {
+        scratch->resize(size);
+        s = (*segment)->reader->Read(offset, size, result, &(*scratch)[0]);
+    }
+    if (!s.ok()) {
+        // a dropped segment can no longer be opened; any other error is the caller's
+        if (FindSegment(number) == nullptr) return Status::NotFound("vlog segment dropped");
+        return s;
+    }
+    if (result->size() != size) {
+        return Status::Corruption("vlog record past the end of its segment", SegmentFileName(dbname, number));
+    }
+    return s;
 }
 
-void VLog::Flush() {
-    if (buffer.empty()) return;
+// Write out the buffer. The lock is released meanwhile, so that other appenders can fill
+// the buffer again and readers can still find the records being written
+Status VLog::Flush() {
+    mutex.AssertHeld();
+    if (!write_error.ok()) return write_error;
+    if (buffer.empty() || active == nullptr) return Status::OK();
+    assert(!flush_in_progress);
+    flushing.swap(buffer);
+    flush_in_progress = true;
+    std::shared_ptr<VLogSegment> segment = active;
+    WritableFile* file = writer;
+
+    mutex.Unlock();
+    Status s = file->Append(flushing);
+    if (s.ok()) s = file->Flush();
+    mutex.Lock();
+
+    if (s.ok()) {
+        // only now may readers look for these records in the file
+        segment->size.store(segment->size.load(std::memory_order_relaxed) + flushing.size(), std::memory_order_release);
+        flushing.clear();
+    } else {
+        // how much of flushing made it to the file is unknown; readers keep finding the
+        // records in memory, and nothing is written after them
+        write_error = s;
+    }
+    flush_in_progress = false;
+    flush_done.SignalAll();
+    return s;
+}
 
-    vlog_size += buffer.size();
-    writer->Append(buffer);
-    writer->Flush();
-    buffer.clear();
-    buffer.reserve(buffer_size_max * 2);
+Status VLog::Sync() {
+    MutexLock l(&mutex);
+    while (flush_in_progress) flush_done.Wait();
+    Status s = Flush();
+    if (s.ok() && writer != nullptr) {
+        s = writer->Sync();
+        if (!s.ok()) write_error = s;
+    }
+    return s;
 }
 
-void VLog::Sync() {
-    Flush();
-    writer->Sync();
+uint64_t VLog::End() {
+    MutexLock l(&mutex);
+    if (active != nullptr) return MakeAddress(active->number, active->size + flushing.size() + buffer.size());
+    // the first append starts a new segment
+    std::shared_ptr<const SegmentMap> current = std::atomic_load(&segments);
+    return MakeAddress(current->empty() ? 1 : current->rbegin()->first + 1, kHeaderSize);
 }
 
-VLog::~VLog() {
-    Flush();
+void VLog::SetHead(uint64_t address) {
+    head.store(address, std::memory_order_release);
+}
+
+bool VLog::NextSegment(uint64_t address, uint64_t* next) const {
+    std::shared_ptr<const SegmentMap> current = std::atomic_load(&segments);
+    auto iter = current->upper_bound(SegmentOf(address));
+    if (iter == current->end()) return false;
+    *next = MakeAddress(iter->first, iter->first == 0 ? 0 : kHeaderSize);
+    return true;
 }
 
+void VLog::AddGarbage(const Slice& key, uint64_t address, uint32_t size) {
+    uint64_t number = SegmentOf(address);
+    std::shared_ptr<VLogSegment> segment = FindSegment(number);
+    if (segment == nullptr) return;
+    uint64_t record_size = VarintLength(key.size()) + key.size() + VarintLength(size) + size;
+    if (segment->checksummed) record_size += kChecksumSize;
+    MutexLock l(&gc_mutex);
+    garbage[number] += record_size;
+}
+
+bool VLog::NeedsGC() {
+    uint64_t begin, end;
+    return PickSegment(&begin, &end);
+}
+
+bool VLog::PickSegment(uint64_t* begin, uint64_t* end) {
+    if (vlog_gc_threshold <= 0) return false;
+    std::shared_ptr<const SegmentMap> current = std::atomic_load(&segments);
+    if (current->size() < 2) return false;
+    // leave the segment being appended to alone, and those still needed to replay the
+    // memtables after a crash
+    const uint64_t kept = std::min(current->rbegin()->first, SegmentOf(head.load(std::memory_order_acquire)));
+    MutexLock l(&gc_mutex);
+    double best = vlog_gc_threshold;
+    bool found = false;
+    for (const auto& dead : garbage) {
+        auto iter = current->find(dead.first);
+        if (iter == current->end() || dead.first >= kept) continue;
+        const VLogSegment& segment = *iter->second;
+        const uint64_t first = segment.number == 0 ? 0 : kHeaderSize;
+        const uint64_t size = segment.size.load(std::memory_order_acquire);
+        if (size <= first) continue;
+        double fraction = double(dead.second) / (size - first);
+        if (fraction >= best) {
+            best = fraction;
+            found = true;
+            *begin = MakeAddress(segment.number, first);
+            *end = MakeAddress(segment.number, size);
+        }
+    }
+    return found;
+}
+
+Status VLog::ReadRecords(uint64_t address, uint64_t max_bytes, string* scratch,
+                         std::vector<VLogRecord>* records, uint64_t* next) {
+    records->clear();
+    *next = address;
+    std::shared_ptr<VLogSegment> segment = FindSegment(SegmentOf(address));
+    if (segment == nullptr) return Status::NotFound("vlog segment dropped");
+    const uint64_t offset = OffsetOf(address);
+    const uint64_t size = segment->size.load(std::memory_order_acquire);
+    uint64_t limit = std::min(offset + max_bytes, size);
+    if (offset >= limit) return Status::OK();
+
+    scratch->resize(limit - offset);
+    Slice data;
+    Status s = segment->reader->Read(offset, limit - offset, &data, &(*scratch)[0]);
+    if (!s.ok()) return s;
+    Slice input = data;
+    uint64_t record_size = 0;
+    bool checksum_mismatch = false;
+    while (!input.empty()) {
+        Slice record = input;
+        uint32_t expected_crc = 0;
+        if (segment->checksummed) {
+            if (record.size() < kChecksumSize) break;
+            expected_crc = crc32c::Unmask(DecodeFixed32(record.data()));
+            record.remove_prefix(kChecksumSize);
+        }
+        const char* checked = record.data();
+        Slice key;
+        uint32_t value_size;
+        if (!GetLengthPrefixedSlice(&record, &key) || !GetVarint32(&record, &value_size)) break;
+        const bool deletion = value_size == kDeletionSize;
+        const uint32_t stored_size = deletion ? 0 : value_size;
+        if (record.size() < stored_size) {
+            record_size = record.data() - input.data() + stored_size;
+            break;
+        }
+        if (segment->checksummed &&
+            crc32c::Value(checked, record.data() + stored_size - checked) != expected_crc) {
+            // nothing past a bad record is trusted
+            checksum_mismatch = true;
+            break;
+        }
+        if (deletion) {
+            records->push_back({key, 0, Slice(), true});
+        } else {
+            records->push_back({key, address + (record.data() - data.data()), Slice(record.data(), value_size), false});
+        }
+        record.remove_prefix(stored_size);
+        input = record;
+    }
+    *next = address + (input.data() - data.data());
+
+    if (records->empty() && checksum_mismatch) {
+        return Status::Corruption("vlog record checksum mismatch", SegmentFileName(dbname, segment->number));
+    }
+    if (records->empty()) {
+        // the first record is longer than max_bytes: read it whole, or at least its header
+        if (limit < size) {
+            return ReadRecords(address, std::max(record_size, 2 * max_bytes + 16), scratch, records, next);
+        }
+        return Status::Corruption("bad vlog record", SegmentFileName(dbname, segment->number));
+    }
+    return Status::OK();
+}
 
+void VLog::DropSegment(uint64_t address) {
+    const uint64_t number = SegmentOf(address);
+    {
+        MutexLock l(&gc_mutex);
+        std::shared_ptr<SegmentMap> updated = std::make_shared<SegmentMap>(*std::atomic_load(&segments));
+        if (updated->erase(number) == 0) return;
+        std::atomic_store(&segments, std::shared_ptr<const SegmentMap>(updated));
+        garbage.erase(number);
+        SaveGCState();
+    }
+    // readers that found the segment before keep reading it through their open file
+    adgMod::env->DeleteFile(SegmentFileName(dbname, number));
+}
 
+void VLog::SaveGCState() {
+    gc_mutex.AssertHeld();
+    string state;
+    for (const auto& dead : garbage) {
+        PutVarint64(&state, dead.first);
+        PutVarint64(&state, dead.second);
+    }
+    // files of the log are opened for appending, so a stale copy must go first
+    string tmp = dbname + "/vlog.gc.tmp";
+    if (adgMod::env->FileExists(tmp)) adgMod::env->DeleteFile(tmp);
+    if (WriteStringToFileSync(adgMod::env, state, tmp).ok()) {
+        adgMod::env->RenameFile(tmp, dbname + "/vlog.gc");
+    }
+}
 
+VLog::~VLog() {
+    {
+        MutexLock l(&mutex);
+        while (flush_in_progress) flush_done.Wait();
+        Flush();
+        if (writer != nullptr) {
+            writer->Close();
+            delete writer;
+        }
+    }
+    MutexLock l(&gc_mutex);
+    // nothing to save until something is dead
+    if (!garbage.empty()) SaveGCState();
+}
 
 
 
@@ -95,4 +582,6 @@ VLog::~VLog() {
 
 
 
-}
\ No newline at end of file
+
+
+}
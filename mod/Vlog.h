@@ -1,31 +1,143 @@
 //
 // Created by daiyi on 2020/03/23.
 // A very simple implementation of Wisckey's Value Log
-// Since Bourbon doesn't test on deletion, Vlog garbage collection is not ported
+// The log is a series of numbered segment files. Records are appended to the last one, and
+// once enough of an older segment is dead, its live records are appended again and the file
+// is deleted
 
 #ifndef LEVELDB_VLOG_H
 #define LEVELDB_VLOG_H
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
 #include "leveldb/env.h"
+#include "port/port.h"
 
 using namespace leveldb;
 
 namespace adgMod {
 
+// A record parsed from the log; key and value point into the caller's scratch. A deletion
+// has no value
+struct VLogRecord {
+    Slice key;
+    uint64_t value_address;
+    Slice value;
+    bool deletion;
+};
+
+// What the LSM keeps for a value when the log is in use: a tag, then either the value itself,
+// for values under vlog_value_threshold, or the address and size of its record.
+// Before values were tagged, the LSM kept only the address and size, of a record in segment 0.
+// Nothing tagged is that size: an inline value that would be gets kPaddedInlineValue and a
+// byte of padding
+enum StoredValueTag { kInlineValue = 0, kVlogPointer = 1, kPaddedInlineValue = 2 };
+const size_t kVlogPointerSize = 1 + sizeof(uint64_t) + sizeof(uint32_t);
+const size_t kUntaggedVlogPointerSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+// dst must have room for kVlogPointerSize bytes
+void EncodeVlogPointer(char* dst, uint64_t address, uint32_t size);
+// False if stored holds the value inline
+bool DecodeVlogPointer(const Slice& stored, uint64_t* address, uint32_t* size);
+void EncodeInlineValue(const Slice& value, std::string* dst);
+// The value held inline by stored
+Slice DecodeInlineValue(const Slice& stored);
+
+// One file of the log. Segment 0 is the vlog.txt of logs written before they were
+// segmented, which has no header
+struct VLogSegment {
+    uint64_t number;
+    RandomAccessFile* reader;
+    // bytes written to the file, so readers below it need no lock
+    std::atomic<uint64_t> size;
+    // the whole file, mapped by the first read once the segment is sealed if the Env can
+    // map it; values are read in place
+    std::atomic<RandomAccessFile*> mapped;
+    // sealed, and no read has tried to map it yet
+    std::atomic<bool> mappable;
+    // whether each record starts with a checksum
+    const bool checksummed;
+
+    VLogSegment(uint64_t number, RandomAccessFile* reader, uint64_t size, bool checksummed)
+        : number(number), reader(reader), size(size), mapped(nullptr), mappable(false), checksummed(checksummed) {}
+    ~VLogSegment() { delete reader; delete mapped.load(); }
+};
+
 class VLog {
 private:
+    typedef std::map<uint64_t, std::shared_ptr<VLogSegment>> SegmentMap;
+
+    const std::string dbname;
+    // replaced as a whole when a segment is added or dropped, so that readers can look up
+    // segments without a lock
+    std::shared_ptr<const SegmentMap> segments;
+
+    // the segment appended to, and the records not yet written to it; guarded by mutex.
+    // flushing is being written by one appender outside the lock while buffer fills up
+    port::Mutex mutex;
+    port::CondVar flush_done;
+    std::shared_ptr<VLogSegment> active;
     WritableFile* writer;
-    RandomAccessFile* reader;
     std::string buffer;
-    uint64_t vlog_size;
-
-    void Flush();
+    std::string flushing;
+    bool flush_in_progress;
+    // the first error writing the log; appends fail from then on, and the records that were
+    // not written stay in memory for readers
+    Status write_error;
+
+    // bytes of dead records in each segment; saved next to the log
+    port::Mutex gc_mutex;
+    std::map<uint64_t, uint64_t> garbage;
+    // records from here on are only in memtables, so their segments must stay
+    std::atomic<uint64_t> head;
+
+    std::shared_ptr<VLogSegment> FindSegment(uint64_t number) const;
+    void PublishSegment(const std::shared_ptr<VLogSegment>& segment);
+    Status NewSegment(uint64_t number);
+    Status Append(const Slice& key, uint32_t value_size, const Slice& value, uint64_t* address);
+    Status Read(uint64_t address, uint32_t size, std::string* scratch, Slice* result,
+                std::shared_ptr<VLogSegment>* segment);
+    Status Flush();
+    void SaveGCState();
 
 public:
-    explicit VLog(const std::string& vlog_name);
-    uint64_t AddRecord(const Slice& key, const Slice& value);
-    std::string ReadRecord(uint64_t address, uint32_t size);
-    void Sync();
+    explicit VLog(const std::string& dbname);
+    // Finds the segments of the log. Corruption if one of them has a bad header
+    Status Open();
+    // Sets *address to the address of the value
+    Status AddRecord(const Slice& key, const Slice& value, uint64_t* address);
+    // Records that key was deleted, for replay after a crash
+    Status AddDeletion(const Slice& key);
+    // NotFound if the record was reclaimed before it was read: the key has been relocated
+    // since its address was looked up
+    Status ReadRecord(uint64_t address, uint32_t size, std::string* value);
+    // Pins the value in place if its segment is mapped, or reads it into the buffer of value
+    Status ReadRecord(uint64_t address, uint32_t size, PinnableSlice* value);
+    Status Sync();
+
+    // The address the next record will be appended at, or after
+    uint64_t End();
+    // The records before address are all in tables
+    void SetHead(uint64_t address);
+    // The address of the first record of the segment after the one holding address
+    bool NextSegment(uint64_t address, uint64_t* next) const;
+
+    // The value of key at address is no longer referenced
+    void AddGarbage(const Slice& key, uint64_t address, uint32_t size);
+    // Whether enough of some older segment is dead to collect it
+    bool NeedsGC();
+    // The addresses of the records of the segment with the largest dead fraction, if it
+    // reaches vlog_gc_threshold and lies before the head
+    bool PickSegment(uint64_t* begin, uint64_t* end);
+    // Parse the whole records in about max_bytes starting at address, which must start a
+    // record; *next is the address after the last one. The records stop before one that fails
+    // its checksum, and Corruption if that is the one at address
+    Status ReadRecords(uint64_t address, uint64_t max_bytes, std::string* scratch,
+                       std::vector<VLogRecord>* records, uint64_t* next);
+    // No record of the segment holding address is referenced any more: delete it
+    void DropSegment(uint64_t address);
     ~VLog();
 };
 
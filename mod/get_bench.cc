@@ -0,0 +1,170 @@
+// Multi-threaded Get throughput on the learned read path.
+//
+// Loads --num keys into a fresh DB, compacts it, learns the level and file
+// models as read_cold does, and then reads random loaded keys from 1..N
+// threads at once, for every thread count in --threads. Reports the
+// aggregate throughput and its scaling over one thread. With --batch the
+// keys are read through MultiGet in batches of that size; add --io_uring to
+// keep the block reads of a batch in flight together. Example:
+//
+//   ./get_bench -m 9 -n 10000000 --threads 1,2,4,8,16
+//   ./get_bench -m 9 -n 10000000 --threads 1,4 --batch 32 --io_uring
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "cxxopts.hpp"
+#include "leveldb/db.h"
+#include "db/version_set.h"
+#include "learned_index.h"
+#include "stats.h"
+#include "util.h"
+#include "Vlog.h"
+
+using namespace leveldb;
+using namespace adgMod;
+using std::string;
+using std::vector;
+
+namespace {
+
+// MultiGet batch size, 0 means single Gets
+size_t batch_size = 0;
+
+// Reads lookups_per_thread random keys; returns the number not found
+uint64_t ReadKeys(DB* db, const vector<string>* keys, uint64_t lookups_per_thread, int seed) {
+    std::default_random_engine e(seed);
+    std::uniform_int_distribution<size_t> udist_index(0, keys->size() - 1);
+    ReadOptions read_options;
+    string value;
+    uint64_t missed = 0;
+    if (batch_size == 0) {
+        for (uint64_t i = 0; i < lookups_per_thread; ++i) {
+            Status status = db->Get(read_options, (*keys)[udist_index(e)], &value);
+            if (!status.ok()) ++missed;
+        }
+        return missed;
+    }
+
+    vector<Slice> batch;
+    vector<string> values;
+    vector<Status> statuses;
+    for (uint64_t i = 0; i < lookups_per_thread; i += batch.size()) {
+        batch.clear();
+        for (uint64_t j = i; j < lookups_per_thread && batch.size() < batch_size; ++j) {
+            batch.push_back((*keys)[udist_index(e)]);
+        }
+        db->MultiGet(read_options, batch, &values, &statuses);
+        for (const Status& status : statuses) {
+            if (!status.ok()) ++missed;
+        }
+    }
+    return missed;
+}
+
+// Returns Gets per second over all threads
+double Run(DB* db, const vector<string>& keys, int num_threads, uint64_t lookups_per_thread) {
+    vector<std::thread> threads;
+    vector<uint64_t> missed(num_threads, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() { missed[t] = ReadKeys(db, &keys, lookups_per_thread, t + 1); });
+    }
+    for (std::thread& thread : threads) thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    for (uint64_t m : missed) {
+        if (m != 0) {
+            fprintf(stderr, "%lu loaded keys not found\n", m);
+            exit(1);
+        }
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return num_threads * lookups_per_thread / seconds;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    string db_location, thread_list;
+    uint64_t num_keys, lookups_per_thread;
+
+    cxxopts::Options commandline_options("get_bench", "Multi-threaded Get throughput.");
+    commandline_options.add_options()
+            ("d,directory", "the directory of db", cxxopts::value<string>(db_location)->default_value("/tmp/get_bench_db"))
+            ("n,num", "number of keys loaded", cxxopts::value<uint64_t>(num_keys)->default_value("1000000"))
+            ("l,lookups", "number of Gets per thread", cxxopts::value<uint64_t>(lookups_per_thread)->default_value("1000000"))
+            ("threads", "comma-separated list of reader thread counts", cxxopts::value<string>(thread_list)->default_value("1,2,4,8"))
+            ("batch", "keys per MultiGet, 0 means single Gets", cxxopts::value<size_t>(batch_size)->default_value("0"))
+            ("io_uring", "read table files through io_uring", cxxopts::value<bool>(adgMod::use_io_uring)->default_value("false"))
+            ("m,modification", "if set, run our modified version", cxxopts::value<int>(adgMod::MOD)->default_value("7"))
+            ("k,key_size", "the size of key", cxxopts::value<int>(adgMod::key_size)->default_value("16"))
+            ("v,value_size", "the size of value", cxxopts::value<int>(adgMod::value_size)->default_value("64"))
+            ("file_model_error", "error in file model", cxxopts::value<uint32_t>(adgMod::file_model_error)->default_value("8"))
+            ("level_model_error", "error in level model", cxxopts::value<uint32_t>(adgMod::level_model_error)->default_value("1"))
+            ("h,help", "print help message", cxxopts::value<bool>()->default_value("false"));
+    auto result = commandline_options.parse(argc, argv);
+    if (result.count("help")) {
+        printf("%s", commandline_options.help().c_str());
+        exit(0);
+    }
+
+    vector<int> thread_counts;
+    std::stringstream thread_stream(thread_list);
+    for (string count; std::getline(thread_stream, count, ',');) {
+        if (std::stoi(count) > 0) thread_counts.push_back(std::stoi(count));
+    }
+
+    vector<string> keys;
+    keys.reserve(num_keys);
+    std::default_random_engine e(255);
+    std::uniform_int_distribution<uint64_t> udist_key(0, 999999999999999);
+    for (uint64_t i = 0; i < num_keys; ++i) keys.push_back(generate_key(std::to_string(udist_key(e))));
+    string value(adgMod::value_size, 'v');
+
+    // load, then learn offline on the compacted tree
+    adgMod::fresh_write = true;
+    string command = "rm -rf " + db_location;
+    int rc = system(command.c_str());
+    (void) rc;
+    Options options;
+    options.create_if_missing = true;
+    DB* db;
+    Status status = DB::Open(options, db_location, &db);
+    assert(status.ok() && "Open Error");
+    for (const string& key : keys) {
+        status = db->Put(adgMod::write_options, key, value);
+        assert(status.ok() && "File Put Error");
+    }
+    adgMod::db->vlog->Sync();
+    adgMod::db->WaitForBackground();
+    db->CompactRange(nullptr, nullptr);
+    adgMod::db->WaitForBackground();
+    if (adgMod::MOD == 6 || adgMod::MOD == 7 || adgMod::MOD == 9) {
+        Version* current = adgMod::db->versions_->current();
+        for (int i = 1; i < config::kNumLevels; ++i) {
+            LearnedIndexData::LevelLearn(new VersionAndSelf{current, adgMod::db->version_count, current->learned_index_data_[i].get(), i});
+        }
+        current->FileLearn();
+    }
+    adgMod::db->WaitForBackground();
+
+    printf("MOD:     %d\n", adgMod::MOD);
+    printf("Keys:    %lu\n", num_keys);
+    printf("Gets:    %lu per thread\n", lookups_per_thread);
+    printf("Batch:   %zu%s\n", batch_size, adgMod::use_io_uring ? " (io_uring)" : "");
+    printf("Cores:   %u\n", std::thread::hardware_concurrency());
+    printf("%-8s %14s %10s\n", "threads", "Gets/s", "speedup");
+    double single = 0;
+    for (int num_threads : thread_counts) {
+        double throughput = Run(db, keys, num_threads, lookups_per_thread);
+        if (single == 0) single = throughput / num_threads;
+        printf("%-8d %14.0f %10.2f\n", num_threads, throughput, throughput / single);
+    }
+
+    delete db;
+    return 0;
+}
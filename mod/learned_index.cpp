@@ -5,42 +5,171 @@
 #include "learned_index.h"
 
 #include "db/version_set.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <utility>
 
+#include "port/port.h"
+#include "util/crc32c.h"
 #include "util/mutexlock.h"
 
 #include "util.h"
 
 namespace adgMod {
 
+namespace {
+
+// Binary model file layout. Everything is stored in host byte order and
+// 8-byte aligned so that the contents, read into one buffer, are used in
+// place:
+//   ModelFileHeader
+//   Segment   segments[num_segments]
+//   uint64_t  eytzinger_x[num_segments]      (the search tree, from version 2;
+//   line      eytzinger_lines[num_segments]   node 0 is unused)
+//   uint32_t  eytzinger_index[num_segments], padded to 8 bytes
+//   uint64_t  accumulated_counts[num_accumulated]
+//   uint64_t  key_offsets[num_accumulated + 1]  (into the key area)
+//   char      keys[]
+const uint64_t kModelFileMagic = 0x314c444f4d4e4242ull;  // "BBNMODL1"
+const uint32_t kModelFileVersion = 2;
+// without the search tree, which is built when the model is read
+const uint32_t kModelFileVersionNoTree = 1;
+
+struct ModelFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  // masked crc32c of everything from file_size to the end of the file
+  uint32_t crc;
+  uint64_t file_size;
+  uint64_t block_num_entries;
+  uint64_t block_size;
+  uint64_t entry_size;
+  uint64_t min_key;
+  uint64_t max_key;
+  uint64_t size;
+  uint64_t cost;
+  int32_t level;
+  uint32_t reserved;
+  uint64_t num_segments;
+  uint64_t num_accumulated;
+};
+
+static_assert(sizeof(Segment) == 3 * sizeof(uint64_t),
+              "segments are used in place from model files");
+static_assert(sizeof(ModelFileHeader) % sizeof(uint64_t) == 0,
+              "model file sections must stay 8-byte aligned");
+static_assert(sizeof(line) == 2 * sizeof(double),
+              "the search tree is used in place from model files");
+
+// size of the search tree section of a model file of num_segments segments
+uint64_t SearchTreeSize(uint64_t num_segments) {
+  const uint64_t index_size = num_segments * sizeof(uint32_t);
+  return num_segments * (sizeof(uint64_t) + sizeof(line)) +
+         (index_size + sizeof(uint64_t) - 1) / sizeof(uint64_t) *
+             sizeof(uint64_t);
+}
+
+const size_t kModelFileChecksummed = offsetof(ModelFileHeader, file_size);
+
+// Places segments[i, ...) at the Eytzinger positions of the subtree rooted at
+// node, in order, and returns the index of the next segment to place.
+size_t FillEytzinger(const Segment* segments, size_t i, size_t node, size_t n,
+                     uint64_t* x, line* lines, uint32_t* index) {
+  if (node > n) return i;
+  i = FillEytzinger(segments, i, 2 * node, n, x, lines, index);
+  x[node] = segments[i].x;
+  lines[node].a = segments[i].k;
+  lines[node].b = segments[i].b;
+  index[node] = i;
+  return FillEytzinger(segments, i + 1, 2 * node + 1, n, x, lines, index);
+}
+
+leveldb::Env* ModelEnv() {
+  return env != nullptr ? env : leveldb::Env::Default();
+}
+
+}  // namespace
+
+LearnedIndexData::~LearnedIndexData() { delete[] model_buffer; }
+
+void LearnedIndexData::BuildSearchTree() {
+  size_t n = num_segments - 1;
+  built_x.assign(n + 1, 0);
+  built_lines.assign(n + 1, line{0, 0});
+  built_index.assign(n + 1, 0);
+  FillEytzinger(segments, 0, 1, n, built_x.data(), built_lines.data(),
+                built_index.data());
+  eytzinger_x = built_x.data();
+  eytzinger_lines = built_lines.data();
+  eytzinger_index = built_index.data();
+  eytzinger_nodes = n;
+}
+
+inline size_t LearnedIndexData::SearchTree(uint64_t target) const {
+  const uint64_t* x = eytzinger_x;
+  const size_t n = eytzinger_nodes;
+  size_t node = 1;
+  while (node <= n) {
+    // the 8 descendants three levels down share one cache line
+    __builtin_prefetch(x + 8 * node);
+    node = 2 * node + (x[node] <= target);
+  }
+  // undo the trailing left turns and the last right turn, which was taken at
+  // the last segment starting at or before the target
+  return node >> __builtin_ffsll(node);
+}
+
+inline size_t LearnedIndexData::FindSegment(uint64_t target, double* k,
+                                            double* b) const {
+  if (eytzinger_search && eytzinger_x != nullptr) {
+    size_t node = SearchTree(target);
+    if (node != 0) {
+      *k = eytzinger_lines[node].a;
+      *b = eytzinger_lines[node].b;
+      return eytzinger_index[node];
+    }
+  } else {
+    // binary search between segments
+    uint32_t left = 0, right = (uint32_t)num_segments - 1;
+    while (left != right - 1) {
+      uint32_t mid = (right + left) / 2;
+      if (target < segments[mid].x)
+        right = mid;
+      else
+        left = mid;
+    }
+    *k = segments[left].k;
+    *b = segments[left].b;
+    return left;
+  }
+  *k = segments[0].k;
+  *b = segments[0].b;
+  return 0;
+}
+
 std::pair<uint64_t, uint64_t> LearnedIndexData::GetPosition(
     const Slice& target_x) const {
-  assert(string_segments.size() > 1);
-  ++served;
+  assert(num_segments > 1);
+#ifdef RECORD_LEVEL_INFO
+  // a shared write on every lookup, so only counted when recording level info
+  served.fetch_add(1, std::memory_order_relaxed);
+#endif
 
   // check if the key is within the model bounds
   uint64_t target_int = SliceToInteger(target_x);
   if (target_int > max_key) return std::make_pair(size, size);
   if (target_int < min_key) return std::make_pair(size, size);
 
-  // binary search between segments
-  uint32_t left = 0, right = (uint32_t)string_segments.size() - 1;
-  while (left != right - 1) {
-    uint32_t mid = (right + left) / 2;
-    if (target_int < string_segments[mid].x)
-      right = mid;
-    else
-      left = mid;
-  }
-
   // calculate the interval according to the selected segment
-  double result =
-      target_int * string_segments[left].k + string_segments[left].b;
+  double k, b;
+  FindSegment(target_int, &k, &b);
+  double result = target_int * k + b;
   result = is_level ? result / 2 : result;
   uint64_t lower =
       result - error > 0 ? (uint64_t)std::floor(result - error) : 0;
@@ -54,6 +183,42 @@ std::pair<uint64_t, uint64_t> LearnedIndexData::GetPosition(
   return std::make_pair(lower, upper);
 }
 
+uint64_t LearnedIndexData::NumEntriesBelow(const Slice& target_x) const {
+  assert(!is_level);
+  if (num_segments < 2) return 0;
+
+  uint64_t target_int = SliceToInteger(target_x);
+  if (target_int > max_key) return size;
+  if (target_int <= min_key) return 0;
+
+  // the last segment starting below the target: one starting at the target
+  // may begin in the middle of a run of entries with the target key
+  double k, b;
+  size_t left = FindSegment(target_int - 1, &k, &b);
+
+  // Let c be the number of entries smaller than the target. The first entry
+  // not smaller than the target is either in the selected segment, where the
+  // (non-decreasing) segment line at the target is below its prediction, or
+  // it starts the next segment, whose prediction at its start is exact up to
+  // the error. Either way c >= min(both predictions) - error.  A segment
+  // over a run of equal keys alone has no slope; if the next one is such a
+  // segment, its entries are only known to follow the start of this one.
+  if (!(k >= 0) || !std::isfinite(k)) return 0;
+  double result = target_int * k + b;
+  if (left + 2 < num_segments) {
+    const Segment& next = segments[left + 1];
+    const double next_start = next.x * next.k + next.b;
+    result = std::min(result, std::isfinite(next_start)
+                                  ? next_start
+                                  : segments[left].x * k + b);
+  }
+  // one extra entry of slack for floating point rounding
+  result -= error + 1;
+  if (!(result > 0)) return 0;
+  uint64_t lower = (uint64_t)std::floor(result);
+  return lower < size ? lower : size;
+}
+
 uint64_t LearnedIndexData::MaxPosition() const { return size - 1; }
 
 double LearnedIndexData::GetError() const { return error; }
@@ -64,33 +229,315 @@ bool LearnedIndexData::Learn() {
   PLR plr = PLR(error);
 
   // check if data if filled
-  if (string_keys.empty()) assert(false);
-
-  // fill in some bounds for the model
-  uint64_t temp = atoll(string_keys.back().c_str());
-  min_key = atoll(string_keys.front().c_str());
-  max_key = atoll(string_keys.back().c_str());
-  size = string_keys.size();
+  if (keys.empty()) assert(false);
 
   // actual training
-  std::vector<Segment> segs = plr.train(string_keys, !is_level);
+  std::vector<Segment> segs = plr.train(keys.data(), keys.size(), !is_level);
   if (segs.empty()) return false;
+  Install(std::move(segs), keys.front(), keys.back(), keys.size());
+  // keys.clear();
+  return true;
+}
+
+void LearnedIndexData::Install(std::vector<Segment>&& segs, uint64_t min,
+                               uint64_t max, uint64_t num_entries) {
+  assert(!segs.empty());
+  // fill in some bounds for the model
+  min_key = min;
+  max_key = max;
+  size = num_entries;
+
   // fill in a dummy last segment (used in segment binary search)
-  segs.push_back((Segment){temp, 0, 0});
+  segs.push_back((Segment){max, 0, 0});
   string_segments = std::move(segs);
+  segments = string_segments.data();
+  num_segments = string_segments.size();
+  BuildSearchTree();
+
+  learned.store(true);
+}
 
-  for (auto& str : string_segments) {
-    // printf("%s %f\n", str.first.c_str(), str.second);
+bool LearnedIndexData::UpdateLevel(LearnedIndexData* previous,
+                                   const std::vector<FileMetaData*>& old_files,
+                                   const std::vector<FileMetaData*>& new_files) {
+  if (!previous->Learned() || old_files.empty() || new_files.empty()) {
+    return false;
   }
+  const Segment* old_segments = previous->segments;
+  // without the dummy last segment
+  if (previous->num_segments < 2) return false;
 
-  learned.store(true);
-  // string_keys.clear();
+  std::vector<uint64_t> old_keys(old_files.size());
+  for (size_t i = 0; i < old_files.size(); ++i) {
+    old_keys[i] = SliceToInteger(old_files[i]->smallest.user_key());
+  }
+  std::vector<uint64_t> new_keys(new_files.size());
+  for (size_t i = 0; i < new_files.size(); ++i) {
+    new_keys[i] = SliceToInteger(new_files[i]->smallest.user_key());
+  }
+  // A segment may start at the smallest or at the largest key of a file, and
+  // a file may hold a single key.  Only a segment starting at a key that is
+  // the smallest of a file and no other bound opens a region: region j, from
+  // segment starts[j] up to starts[j+1], holds the files with smallest keys in
+  // [x_j, x_j+1) and no point of any other file.  It is kept if the edit
+  // deleted none of its files and added none in its range; its files then
+  // moved by the same number of places.
+  std::vector<size_t> starts(1, 0);
+  for (size_t s = 1; s + 1 < previous->num_segments; ++s) {
+    const uint64_t x = old_segments[s].x;
+    const size_t i =
+        std::lower_bound(old_keys.begin(), old_keys.end(), x) - old_keys.begin();
+    if (i < old_keys.size() && old_keys[i] == x &&
+        SliceToInteger(old_files[i]->largest.user_key()) != x &&
+        (i == 0 || SliceToInteger(old_files[i - 1]->largest.user_key()) != x)) {
+      starts.push_back(s);
+    }
+  }
+  const size_t num_regions = starts.size();
+  starts.push_back(previous->num_segments - 1);
+  auto region_x = [&](size_t j) { return old_segments[starts[j]].x; };
+
+  std::vector<bool> changed(num_regions, false);
+  std::vector<int64_t> shift(num_regions, 0);
+  std::vector<bool> has_files(num_regions, false);
+  size_t region = 0;
+  size_t next = 0;
+  auto region_of = [&](uint64_t key) {
+    while (region + 1 < num_regions && key >= region_x(region + 1)) {
+      ++region;
+    }
+    return region;
+  };
+  for (size_t i = 0; i < old_files.size(); ++i) {
+    const uint64_t key = old_keys[i];
+    // files added before this one
+    while (next < new_files.size() && new_keys[next] <= key &&
+           new_files[next]->number != old_files[i]->number) {
+      changed[region_of(new_keys[next])] = true;
+      ++next;
+    }
+    const size_t j = region_of(key);
+    if (next < new_files.size() &&
+        new_files[next]->number == old_files[i]->number) {
+      const int64_t moved = (int64_t)next - (int64_t)i;
+      if (has_files[j] && shift[j] != moved) changed[j] = true;
+      shift[j] = moved;
+      ++next;
+    } else {
+      changed[j] = true;
+    }
+    has_files[j] = true;
+  }
+  for (; next < new_files.size(); ++next) {
+    changed[region_of(new_keys[next])] = true;
+  }
+
+  std::vector<Segment> segs;
+  for (size_t j = 0; j < num_regions;) {
+    if (has_files[j] && !changed[j]) {
+      for (size_t s = starts[j]; s < starts[j + 1]; ++s) {
+        const Segment& old_segment = old_segments[s];
+        segs.push_back((Segment){old_segment.x, old_segment.k,
+                                 old_segment.b + 2 * (double)shift[j]});
+      }
+      ++j;
+      continue;
+    }
+    // Fit the files of the changed regions from j on as FillLevel and Learn
+    // would
+    size_t end = j + 1;
+    while (end < num_regions && (!has_files[end] || changed[end])) ++end;
+    const size_t first =
+        j == 0 ? 0
+               : std::lower_bound(new_keys.begin(), new_keys.end(),
+                                  region_x(j)) -
+                     new_keys.begin();
+    const size_t last =
+        end == num_regions
+            ? new_keys.size()
+            : std::lower_bound(new_keys.begin(), new_keys.end(),
+                               region_x(end)) -
+                  new_keys.begin();
+    // (not through PLR::train, which gives up on level models while a
+    // compaction is waiting, as the caller may well be one)
+    GreedyPLR plr(error);
+    for (size_t i = first; i < last; ++i) {
+      const uint64_t bounds[2] = {
+          new_keys[i], SliceToInteger(new_files[i]->largest.user_key())};
+      for (int side = 0; side < 2; ++side) {
+        Segment seg = plr.process(point((double)bounds[side], 2 * i + side),
+                                  false);
+        if (seg.x != 0 || seg.k != 0 || seg.b != 0) segs.push_back(seg);
+      }
+    }
+    if (first < last) {
+      Segment seg = plr.finish();
+      if (seg.x != 0 || seg.k != 0 || seg.b != 0) segs.push_back(seg);
+    }
+    j = end;
+  }
+  if (segs.empty()) return false;
+
+  Install(std::move(segs), new_keys.front(),
+          SliceToInteger(new_files.back()->largest.user_key()),
+          2 * new_files.size());
+  return true;
+}
+
+const size_t FileModelBuilder::kMinCopiedRun;
+
+FileModelBuilder::FileModelBuilder(LearnedIndexData* data)
+    : data(data), plr(data->GetError()), num_entries(0), min_key(0),
+      max_key(0), run_source(nullptr), run_start(0), run_offset(0),
+      run_min_key(0), run_tail_start(0), run_before_tail_key(0),
+      run_min_length(kMinCopiedRun) {}
+
+void FileModelBuilder::Add(const Slice& user_key,
+                           const LearnedIndexData* source,
+                           uint64_t source_position) {
+  uint64_t key = SliceToInteger(user_key);
+  const uint64_t position = num_entries;
+  if (run_source != nullptr && source == run_source &&
+      position - source_position == run_offset) {
+    if (key != max_key) {
+      run_tail_start = position;
+      run_before_tail_key = max_key;
+    }
+    if (!run_pending.empty()) {
+      run_pending.push_back(key);
+      if (run_pending.size() >= run_min_length) {
+        // the run is long enough: close the fitted segment before it
+        CloseFit();
+        run_pending.clear();
+      }
+    }
+  } else {
+    EndRun(true, key);
+    // a run must start at a new user key, so that no segment outside of it
+    // covers one of its keys.  A source without a segment besides the dummy
+    // last one has nothing to copy, and its entries are fitted
+    if (source != nullptr && source->num_segments > 1 &&
+        source->GetError() <= data->GetError() &&
+        (num_entries == 0 || key > max_key)) {
+      run_source = source;
+      run_start = position;
+      run_offset = position - source_position;
+      run_min_key = key;
+      run_tail_start = position;
+      run_min_length = std::max<size_t>(
+          kMinCopiedRun, 4 * source->size / (source->num_segments - 1));
+      run_pending.push_back(key);
+    } else {
+      Fit(key, position);
+    }
+  }
+  if (num_entries == 0) min_key = key;
+  max_key = key;
+  ++num_entries;
+}
+
+void FileModelBuilder::Fit(uint64_t key, uint64_t position) {
+  Segment seg = plr.process(point((double)key, position), true);
+  if (seg.x != 0 || seg.k != 0 || seg.b != 0) segments.push_back(seg);
+}
+
+void FileModelBuilder::CloseFit() {
+  Segment last = plr.finish();
+  if (last.x != 0 || last.k != 0 || last.b != 0) segments.push_back(last);
+  plr = GreedyPLR(data->GetError());
+}
+
+void FileModelBuilder::EndRun(bool has_next, uint64_t next_key) {
+  if (run_source == nullptr) return;
+  if (!run_pending.empty()) {
+    for (size_t i = 0; i < run_pending.size(); ++i) {
+      Fit(run_pending[i], run_start + i);
+    }
+    run_pending.clear();
+  } else if (has_next && next_key == max_key) {
+    // The key of the last entries of the run goes on after it, so they are
+    // fitted together with the entries that follow
+    if (run_tail_start > run_start) {
+      CopySegments(run_min_key, run_before_tail_key);
+    }
+    for (uint64_t position = run_tail_start; position < num_entries;
+         ++position) {
+      Fit(max_key, position);
+    }
+  } else {
+    CopySegments(run_min_key, max_key);
+  }
+  run_source = nullptr;
+}
+
+void FileModelBuilder::CopySegments(uint64_t first_key, uint64_t last_key) {
+  const Segment* source = run_source->segments;
+  // without the dummy last segment
+  const size_t count = run_source->num_segments - 1;
+  // the segment covering first_key
+  size_t i = std::upper_bound(source + 1, source + count, first_key,
+                              [](uint64_t key, const Segment& segment) {
+                                return key < segment.x;
+                              }) -
+             source - 1;
+  const double offset = (double)(int64_t)run_offset;
+  segments.push_back((Segment){first_key, source[i].k, source[i].b + offset});
+  for (++i; i < count && source[i].x <= last_key; ++i) {
+    segments.push_back((Segment){source[i].x, source[i].k, source[i].b + offset});
+  }
+}
+
+void FileModelBuilder::FinishBlock(const Slice& last_user_key,
+                                   uint64_t block_entries,
+                                   uint64_t entries_size,
+                                   uint64_t block_size_on_disk) {
+  if (block_entries == 0) return;
+  // the same layout constants Table::FillData records from the first block
+  // it reads
+  RecordBlockLayout(block_entries, entries_size / block_entries,
+                    block_size_on_disk);
+  accumulated.Add(num_entries, last_user_key.ToString());
+}
+
+bool FileModelBuilder::AddTable(const LearnedIndexData* model) {
+  // the segments of the table are copied whole, so its keys must all come
+  // after the entries added so far
+  if (model->GetError() > data->GetError() || model->num_segments < 2 ||
+      model->size == 0 || (num_entries > 0 && model->min_key <= max_key)) {
+    return false;
+  }
+  EndRun(true, model->min_key);
+  CloseFit();
+  if (num_entries == 0) min_key = model->min_key;
+  run_source = model;
+  run_start = num_entries;
+  run_offset = num_entries;
+  run_min_key = model->min_key;
+  max_key = model->max_key;
+  num_entries += model->size;
+  EndRun(false, 0);
+  return true;
+}
+
+void FileModelBuilder::FinishTable(const Slice& largest_user_key) {
+  accumulated.Add(num_entries, largest_user_key.ToString());
+}
+
+bool FileModelBuilder::Finish() {
+  if (num_entries == 0) return false;
+  EndRun(false, 0);
+  Segment last = plr.finish();
+  if (last.x != 0 || last.k != 0 || last.b != 0) segments.push_back(last);
+  if (segments.empty()) return false;
+
+  data->num_entries_accumulated = std::move(accumulated);
+  data->Install(std::move(segments), min_key, max_key, num_entries);
   return true;
 }
 
 // static learning function to be used with LevelDB background scheduling
 // level learning
-void LearnedIndexData::LevelLearn(void* arg, bool nolock) {
+void LearnedIndexData::LevelLearn(void* arg) {
   Stats* instance = Stats::GetInstance();
   bool success = false;
   bool entered = false;
@@ -98,28 +545,27 @@ void LearnedIndexData::LevelLearn(void* arg, bool nolock) {
 
   VersionAndSelf* vas = reinterpret_cast<VersionAndSelf*>(arg);
   LearnedIndexData* self = vas->self;
-  self->is_level = true;
   self->level = vas->level;
-  Version* c;
-  if (!nolock) {
-    c = db->GetCurrentVersion();
-  }
-  if (db->version_count == vas->v_count) {
+  // A model is shared by the versions in which its level is unchanged, so it
+  // is only worth learning while the current version still has it, however
+  // many other edits were applied since vas->version.
+  Version* c = db->GetCurrentVersion();
+  if (c->learned_index_data_[vas->level].get() == self && !self->Learned() &&
+      !self->learning.exchange(true)) {
     entered = true;
-    if (vas->version->FillLevel(adgMod::read_options, vas->level)) {
+    // keys left over by an attempt given up for a compaction
+    self->keys.clear();
+    if (adgMod::level_entry_model) {
+      success = vas->version->LearnLevelEntries(adgMod::read_options, vas->level);
+    } else if (vas->version->FillLevel(adgMod::read_options, vas->level)) {
       self->filled = true;
-      if (db->version_count == vas->v_count) {
-        if (env->compaction_awaiting.load() == 0 && self->Learn()) {
-          success = true;
-        } else {
-          self->learning.store(false);
-        }
+      if (env->compaction_awaiting.load() == 0 && self->Learn()) {
+        success = true;
       }
     }
+    if (!success) self->learning.store(false);
   }
-  if (!nolock) {
-    adgMod::db->ReturnCurrentVersion(c);
-  }
+  adgMod::db->ReturnCurrentVersion(c);
 
   auto time = instance->PauseTimer(8, true);
 
@@ -240,11 +686,21 @@ bool LearnedIndexData::FillData(Version* version, FileMetaData* meta) {
 void LearnedIndexData::WriteModel(const string& filename) {
   if (!learned.load()) return;
 
+  LoadAccumulated();
+  if (text_model || !leveldb::port::kLittleEndian) {
+    WriteTextModel(filename);
+  } else {
+    WriteBinaryModel(filename);
+  }
+}
+
+void LearnedIndexData::WriteTextModel(const string& filename) {
   std::ofstream output_file(filename);
   output_file.precision(15);
   output_file << adgMod::block_num_entries << " " << adgMod::block_size << " "
               << adgMod::entry_size << "\n";
-  for (Segment& item : string_segments) {
+  for (size_t i = 0; i < num_segments; ++i) {
+    const Segment& item = segments[i];
     output_file << item.x << " " << item.k << " " << item.b << "\n";
   }
   output_file << "StartAcc"
@@ -255,7 +711,208 @@ void LearnedIndexData::WriteModel(const string& filename) {
   }
 }
 
+void LearnedIndexData::WriteBinaryModel(const string& filename) {
+  const std::vector<std::pair<uint64_t, string>>& accumulated =
+      num_entries_accumulated.array;
+
+  ModelFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kModelFileMagic;
+  header.version = kModelFileVersion;
+  header.block_num_entries = adgMod::block_num_entries;
+  header.block_size = adgMod::block_size;
+  header.entry_size = adgMod::entry_size;
+  header.min_key = min_key;
+  header.max_key = max_key;
+  header.size = size;
+  header.cost = cost;
+  header.level = level;
+  header.num_segments = num_segments;
+  header.num_accumulated = accumulated.size();
+
+  uint64_t keys_size = 0;
+  for (auto& pair : accumulated) keys_size += pair.second.size();
+  const uint64_t tree_size = SearchTreeSize(num_segments);
+  header.file_size = sizeof(header) + num_segments * sizeof(Segment) +
+                     tree_size +
+                     (2 * accumulated.size() + 1) * sizeof(uint64_t) +
+                     keys_size;
+
+  string contents;
+  contents.reserve(header.file_size);
+  contents.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  contents.append(reinterpret_cast<const char*>(segments),
+                  num_segments * sizeof(Segment));
+  const size_t tree_start = contents.size();
+  assert(eytzinger_nodes + 1 == num_segments);
+  contents.append(reinterpret_cast<const char*>(eytzinger_x),
+                  num_segments * sizeof(uint64_t));
+  contents.append(reinterpret_cast<const char*>(eytzinger_lines),
+                  num_segments * sizeof(line));
+  contents.append(reinterpret_cast<const char*>(eytzinger_index),
+                  num_segments * sizeof(uint32_t));
+  contents.resize(tree_start + tree_size, 0);
+  for (auto& pair : accumulated) {
+    contents.append(reinterpret_cast<const char*>(&pair.first),
+                    sizeof(uint64_t));
+  }
+  uint64_t offset = 0;
+  for (auto& pair : accumulated) {
+    contents.append(reinterpret_cast<const char*>(&offset), sizeof(uint64_t));
+    offset += pair.second.size();
+  }
+  contents.append(reinterpret_cast<const char*>(&offset), sizeof(uint64_t));
+  for (auto& pair : accumulated) contents.append(pair.second);
+  assert(contents.size() == header.file_size);
+
+  uint32_t crc = leveldb::crc32c::Mask(
+      leveldb::crc32c::Value(contents.data() + kModelFileChecksummed,
+                             contents.size() - kModelFileChecksummed));
+  memcpy(&contents[offsetof(ModelFileHeader, crc)], &crc, sizeof(crc));
+
+  leveldb::WritableFile* file;
+  leveldb::Status s = ModelEnv()->NewWritableFile(filename, &file);
+  if (!s.ok()) return;
+  s = file->Append(contents);
+  if (s.ok()) s = file->Close();
+  delete file;
+  if (!s.ok()) ModelEnv()->DeleteFile(filename);
+}
+
 void LearnedIndexData::ReadModel(const string& filename) {
+  leveldb::Env* model_env = ModelEnv();
+  uint64_t file_size;
+  if (!model_env->GetFileSize(filename, &file_size).ok()) return;
+
+  // binary model files start with the magic number; anything else is taken
+  // to be the old text format
+  if (leveldb::port::kLittleEndian) {
+    leveldb::RandomAccessFile* file;
+    if (!model_env->NewRandomAccessFile(filename, &file).ok()) return;
+    const uint64_t magic = kModelFileMagic;
+    const size_t magic_size = std::min<uint64_t>(sizeof(magic), file_size);
+    char magic_buf[sizeof(magic)];
+    Slice magic_slice;
+    bool binary = magic_size > 0 &&
+                  file->Read(0, magic_size, &magic_slice, magic_buf).ok() &&
+                  magic_slice.size() == magic_size &&
+                  memcmp(magic_slice.data(), &magic, magic_size) == 0;
+    if (binary) {
+      // a damaged or truncated binary model is dropped, the model is learned
+      // again
+      if (file_size >= sizeof(ModelFileHeader)) {
+        ReadBinaryModel(file, file_size);
+      }
+      delete file;
+      return;
+    }
+    delete file;
+  }
+  ReadTextModel(filename);
+}
+
+bool LearnedIndexData::ReadBinaryModel(leveldb::RandomAccessFile* file,
+                                       uint64_t file_size) {
+  // The contents are read once into a buffer that the model keeps and uses in
+  // place: the segments, the search tree and the accumulated array are not
+  // copied out of it.  The file itself is closed, as a DB has a model file
+  // for every table, and mapping each for the lifetime of its model would use
+  // up the mmap slots of the Env, past which it reads through pread anyway.
+  // (A mapped read returns the contents without filling scratch; they are
+  // copied into it then.)
+  char* scratch = new char[file_size];
+  Slice contents;
+  leveldb::Status s = file->Read(0, file_size, &contents, scratch);
+  if (!s.ok() || contents.size() != file_size) {
+    delete[] scratch;
+    return false;
+  }
+  if (contents.data() != scratch) memcpy(scratch, contents.data(), file_size);
+
+  const char* base = scratch;
+  ModelFileHeader header;
+  memcpy(&header, base, sizeof(header));
+  uint32_t expected_crc;
+  memcpy(&expected_crc, base + offsetof(ModelFileHeader, crc),
+         sizeof(expected_crc));
+  const bool has_tree = header.version == kModelFileVersion;
+  const uint64_t tree_size =
+      has_tree ? SearchTreeSize(header.num_segments) : 0;
+  const uint64_t fixed_size =
+      sizeof(header) + header.num_segments * sizeof(Segment) + tree_size +
+      (2 * header.num_accumulated + 1) * sizeof(uint64_t);
+  bool valid =
+      (has_tree || header.version == kModelFileVersionNoTree) &&
+      header.file_size == file_size &&
+      header.num_segments >= 2 && header.num_segments <= file_size &&
+      header.num_accumulated <= file_size && fixed_size <= file_size &&
+      leveldb::crc32c::Unmask(expected_crc) ==
+          leveldb::crc32c::Value(base + kModelFileChecksummed,
+                                 file_size - kModelFileChecksummed);
+
+  const char* pos = base + sizeof(header);
+  const Segment* file_segments = reinterpret_cast<const Segment*>(pos);
+  pos += header.num_segments * sizeof(Segment);
+  const uint64_t* tree_x = reinterpret_cast<const uint64_t*>(pos);
+  const line* tree_lines =
+      reinterpret_cast<const line*>(pos + header.num_segments * sizeof(uint64_t));
+  const uint32_t* tree_index = reinterpret_cast<const uint32_t*>(
+      pos + header.num_segments * (sizeof(uint64_t) + sizeof(line)));
+  pos += tree_size;
+  const uint64_t* counts = reinterpret_cast<const uint64_t*>(pos);
+  pos += header.num_accumulated * sizeof(uint64_t);
+  const uint64_t* key_offsets = reinterpret_cast<const uint64_t*>(pos);
+  pos += (header.num_accumulated + 1) * sizeof(uint64_t);
+  if (valid) {
+    valid = key_offsets[0] == 0 &&
+            key_offsets[header.num_accumulated] == file_size - fixed_size;
+    for (uint64_t i = 0; valid && i < header.num_accumulated; ++i) {
+      valid = key_offsets[i] <= key_offsets[i + 1];
+    }
+    // the tree indexes segments, which would otherwise be read out of bounds
+    for (uint64_t node = 1; valid && has_tree && node < header.num_segments;
+         ++node) {
+      valid = tree_index[node] < header.num_segments - 1;
+    }
+  }
+  if (!valid) {
+    delete[] scratch;
+    return false;
+  }
+
+  model_buffer = scratch;
+
+  adgMod::block_num_entries = header.block_num_entries;
+  adgMod::block_size = header.block_size;
+  adgMod::entry_size = header.entry_size;
+  min_key = header.min_key;
+  max_key = header.max_key;
+  size = header.size;
+  level = header.level;
+  cost = header.cost;
+  segments = file_segments;
+  num_segments = header.num_segments;
+  if (has_tree) {
+    eytzinger_x = tree_x;
+    eytzinger_lines = tree_lines;
+    eytzinger_index = tree_index;
+    eytzinger_nodes = num_segments - 1;
+  } else {
+    BuildSearchTree();
+  }
+  stored_num_accumulated = header.num_accumulated;
+  stored_counts = counts;
+  stored_key_offsets = key_offsets;
+  stored_keys = pos;
+  // level models search the accumulated array on every lookup; file models
+  // only need it when they are written out again
+  if (is_level) LoadAccumulated();
+
+  learned.store(true);
+  return true;
+}
+
+void LearnedIndexData::ReadTextModel(const string& filename) {
   std::ifstream input_file(filename);
 
   if (!input_file.good()) return;
@@ -264,11 +921,18 @@ void LearnedIndexData::ReadModel(const string& filename) {
   while (true) {
     string x;
     double k, b;
-    input_file >> x;
+    if (!(input_file >> x)) {
+      string_segments.clear();
+      return;
+    }
     if (x == "StartAcc") break;
     input_file >> k >> b;
     string_segments.emplace_back(atoll(x.c_str()), k, b);
   }
+  segments = string_segments.data();
+  num_segments = string_segments.size();
+  if (num_segments < 2) return;
+  BuildSearchTree();
   input_file >> min_key >> max_key >> size >> level >> cost;
   while (true) {
     uint64_t first;
@@ -280,6 +944,17 @@ void LearnedIndexData::ReadModel(const string& filename) {
   learned.store(true);
 }
 
+void LearnedIndexData::LoadAccumulated() {
+  if (stored_counts == nullptr) return;
+  for (uint64_t i = 0; i < stored_num_accumulated; ++i) {
+    num_entries_accumulated.Add(
+        stored_counts[i],
+        string(stored_keys + stored_key_offsets[i],
+               stored_key_offsets[i + 1] - stored_key_offsets[i]));
+  }
+  stored_counts = nullptr;
+}
+
 void LearnedIndexData::ReportStats() {
   //        double neg_gain, pos_gain;
   //        if (num_neg_model == 0 || num_neg_baseline == 0) {
@@ -295,8 +970,14 @@ void LearnedIndexData::ReportStats() {
   //            (double) time_pos_model / num_pos_model) * num_pos_model;
   //        }
 
-  printf("%d %d %lu %lu %lu\n", level, served, string_segments.size(), cost,
+#ifdef RECORD_LEVEL_INFO
+  printf("%d %d %lu %lu %lu\n", level,
+         served.load(std::memory_order_relaxed), num_segments, cost,
          size);  //, file_size);
+#else
+  // lookups are not counted, so there is no served column
+  printf("%d %lu %lu %lu\n", level, num_segments, cost, size);
+#endif
   //        printf("\tPredicted: %lu %lu %lu %lu %d %d %d %d %d %lf\n",
   //        time_neg_baseline_p, time_neg_model_p, time_pos_baseline_p,
   //        time_pos_model_p,
@@ -318,13 +999,38 @@ void LearnedIndexData::FillCBAStat(bool positive, bool model, uint64_t time) {
   //        num_to_update += 1;
 }
 
+FileLearnedIndexData::FileLearnedIndexData() : num_models(0), watermark(0) {
+  for (auto& chunk : chunks) chunk.store(nullptr, std::memory_order_relaxed);
+}
+
 LearnedIndexData* FileLearnedIndexData::GetModel(int number) {
+  size_t chunk_index = (size_t)number >> kChunkBits;
+  assert(chunk_index < kNumChunks);
+  Slot* chunk = chunks[chunk_index].load(std::memory_order_acquire);
+  if (chunk != nullptr) {
+    LearnedIndexData* model =
+        chunk[number & (kChunkSize - 1)].load(std::memory_order_acquire);
+    if (model != nullptr) return model;
+  }
+
+  // first use of this file number: create the model under the mutex
   leveldb::MutexLock l(&mutex);
-  if (file_learned_index_data.size() <= number)
-    file_learned_index_data.resize(number + 1, nullptr);
-  if (file_learned_index_data[number] == nullptr)
-    file_learned_index_data[number] = new LearnedIndexData(file_allowed_seek, false);
-  return file_learned_index_data[number];
+  chunk = chunks[chunk_index].load(std::memory_order_relaxed);
+  if (chunk == nullptr) {
+    chunk = new Slot[kChunkSize];
+    for (size_t i = 0; i < kChunkSize; ++i)
+      chunk[i].store(nullptr, std::memory_order_relaxed);
+    chunks[chunk_index].store(chunk, std::memory_order_release);
+  }
+  Slot& slot = chunk[number & (kChunkSize - 1)];
+  LearnedIndexData* model = slot.load(std::memory_order_relaxed);
+  if (model == nullptr) {
+    model = new LearnedIndexData(file_allowed_seek, false);
+    slot.store(model, std::memory_order_release);
+    if ((size_t)number >= num_models.load(std::memory_order_relaxed))
+      num_models.store(number + 1, std::memory_order_relaxed);
+  }
+  return model;
 }
 
 bool FileLearnedIndexData::FillData(Version* version, FileMetaData* meta) {
@@ -332,9 +1038,9 @@ bool FileLearnedIndexData::FillData(Version* version, FileMetaData* meta) {
   return model->FillData(version, meta);
 }
 
-std::vector<std::string>& FileLearnedIndexData::GetData(FileMetaData* meta) {
+std::vector<uint64_t>& FileLearnedIndexData::GetData(FileMetaData* meta) {
   auto* model = GetModel(meta->number);
-  return model->string_keys;
+  return model->keys;
 }
 
 bool FileLearnedIndexData::Learned(Version* version, FileMetaData* meta,
@@ -346,18 +1052,23 @@ bool FileLearnedIndexData::Learned(Version* version, FileMetaData* meta,
 AccumulatedNumEntriesArray* FileLearnedIndexData::GetAccumulatedArray(
     int file_num) {
   auto* model = GetModel(file_num);
+  leveldb::MutexLock l(&mutex);
+  model->LoadAccumulated();
   return &model->num_entries_accumulated;
 }
 
 std::pair<uint64_t, uint64_t> FileLearnedIndexData::GetPosition(
     const Slice& key, int file_num) {
-  return file_learned_index_data[file_num]->GetPosition(key);
+  return GetModel(file_num)->GetPosition(key);
 }
 
 FileLearnedIndexData::~FileLearnedIndexData() {
   leveldb::MutexLock l(&mutex);
-  for (auto pointer : file_learned_index_data) {
-    delete pointer;
+  for (auto& chunk : chunks) {
+    Slot* pointer = chunk.load(std::memory_order_relaxed);
+    if (pointer == nullptr) continue;
+    for (size_t i = 0; i < kChunkSize; ++i) delete pointer[i].load();
+    delete[] pointer;
   }
 }
 
@@ -367,8 +1078,10 @@ void FileLearnedIndexData::Report() {
   std::set<uint64_t> live_files;
   adgMod::db->versions_->AddLiveFiles(&live_files);
 
-  for (size_t i = 0; i < file_learned_index_data.size(); ++i) {
-    auto pointer = file_learned_index_data[i];
+  size_t size = num_models.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < size; ++i) {
+    Slot* chunk = chunks[i >> kChunkBits].load(std::memory_order_relaxed);
+    auto pointer = chunk == nullptr ? nullptr : chunk[i & (kChunkSize - 1)].load();
     if (pointer != nullptr && pointer->cost != 0) {
       printf("FileModel %lu %d ", i, i > watermark);
       pointer->ReportStats();
@@ -76,14 +76,49 @@ namespace adgMod {
         // some params for level triggering policy, deprecated
         int allowed_seek;
         int current_seek;
+        // backing storage of a model read from a binary model file: its contents, read once and
+        // used in place
+        char* model_buffer;
+        // accumulated array of a binary model file, copied into num_entries_accumulated on demand
+        uint64_t stored_num_accumulated;
+        const uint64_t* stored_counts;
+        const uint64_t* stored_key_offsets;
+        const char* stored_keys;
+
+        // Segment start keys in Eytzinger (breadth-first) order, 1-based, so that the segment
+        // search walks down a few packed cache lines. The slope and intercept, and the index in
+        // segments, of each segment are kept in the same order in separate arrays.
+        // The dummy last segment is not part of the tree, which has eytzinger_nodes nodes.
+        // Like segments, the arrays point either into the built_* vectors or into model_buffer.
+        const uint64_t* eytzinger_x;
+        const line* eytzinger_lines;
+        const uint32_t* eytzinger_index;
+        size_t eytzinger_nodes;
+        std::vector<uint64_t> built_x;
+        std::vector<line> built_lines;
+        std::vector<uint32_t> built_index;
+
+        void BuildSearchTree();
+        // return the Eytzinger node of the segment covering param:target, 0 if there is none
+        size_t SearchTree(uint64_t target) const;
+        // return the index of the segment covering param:target and its slope and intercept
+        size_t FindSegment(uint64_t target, double* k, double* b) const;
+        bool ReadBinaryModel(leveldb::RandomAccessFile* file, uint64_t file_size);
+        void ReadTextModel(const string& filename);
+        void WriteBinaryModel(const string& filename);
+        void WriteTextModel(const string& filename);
     public:
         // is the data of this model filled (ready for learning)
         bool filled;
         // is this a level model
         bool is_level;
 
-        // Learned linear segments and some other data needed
+        // Learned linear segments and some other data needed.
+        // Inference reads segments[0, num_segments), which points either into string_segments
+        // or, for a model read from a binary model file, into the file contents used in place.
         std::vector<Segment> string_segments;
+        const Segment* segments;
+        size_t num_segments;
         uint64_t min_key;
         uint64_t max_key;
         uint64_t size;
@@ -91,13 +126,14 @@ namespace adgMod {
 
 
     public:
-        // all keys in the file/level to be leraned from
-        std::vector<std::string> string_keys;
+        // all keys in the file/level to be leraned from, as integers
+        std::vector<uint64_t> keys;
         // only used in level models
         AccumulatedNumEntriesArray num_entries_accumulated;
 
         int level;
-        mutable int served;
+        // lookups served, only counted when recording level info
+        mutable std::atomic<int> served;
         uint64_t cost;
 
 //        int num_neg_model = 0, num_pos_model = 0, num_neg_baseline = 0, num_pos_baseline = 0;
@@ -112,31 +148,52 @@ namespace adgMod {
 
 
         explicit LearnedIndexData(int allowed_seek, bool level_model) : error(level_model?level_model_error:file_model_error), learned(false), aborted(false), learning(false),
-            learned_not_atomic(false), allowed_seek(allowed_seek), current_seek(0), filled(false), is_level(level_model), level(0), served(0), cost(0) {};
+            learned_not_atomic(false), allowed_seek(allowed_seek), current_seek(0), model_buffer(nullptr),
+            stored_num_accumulated(0), stored_counts(nullptr), stored_key_offsets(nullptr), stored_keys(nullptr),
+            eytzinger_x(nullptr), eytzinger_lines(nullptr), eytzinger_index(nullptr), eytzinger_nodes(0),
+            filled(false), is_level(level_model), segments(nullptr), num_segments(0), level(0), served(0), cost(0) {};
         LearnedIndexData(const LearnedIndexData& other) = delete;
+        ~LearnedIndexData();
 
         // Inference function. Return the predicted interval.
         // If the key is in the training set, the output interval guarantees to include the key
         // otherwise, the output is undefined!
         // If the output lower bound is larger than MaxPosition(), the target key is not in the file
         std::pair<uint64_t, uint64_t> GetPosition(const Slice& key) const;
+        // Return a number of entries that are guaranteed to have keys smaller than param:key.
+        // Unlike GetPosition, the key need not be in the training set; the result is a lower
+        // bound and may be 0. Only valid for file models. Used by learned merge in compaction.
+        uint64_t NumEntriesBelow(const Slice& key) const;
         uint64_t MaxPosition() const;
         double GetError() const;
         
         // Learning function and checker (check if this model is available)
         bool Learn();
+        // Make this model serve the given segments, learned over keys [param:min, param:max]
+        // at positions [0, param:num_entries). param:segs must not be empty.
+        void Install(std::vector<Segment>&& segs, uint64_t min, uint64_t max, uint64_t num_entries);
+        // Make this level model serve param:new_files from the model param:previous of the same
+        // level over param:old_files, without learning it anew. The segments of previous are
+        // regions of files: those whose files an edit left in place are shifted to their new
+        // index, and only the regions with deleted or added files are fitted again. False if
+        // previous is not learned.
+        bool UpdateLevel(LearnedIndexData* previous, const std::vector<FileMetaData*>& old_files,
+                         const std::vector<FileMetaData*>& new_files);
         bool Learned();
         bool Learned(Version* version, int v_count, int level);
         bool Learned(Version* version, int v_count, FileMetaData* meta, int level);
-        static void LevelLearn(void* arg, bool no_lock=false);
+        static void LevelLearn(void* arg);
         static uint64_t FileLearn(void* arg);
 
         // Load all the keys in the file/level
         bool FillData(Version* version, FileMetaData* meta);
 
-        // writing this model to disk and load this model from disk
+        // writing this model to disk and load this model from disk.
+        // Models are written in the binary format unless text_model is set; ReadModel accepts both.
         void WriteModel(const string& filename);
         void ReadModel(const string& filename);
+        // copy the accumulated array of a model read from a binary model file into num_entries_accumulated
+        void LoadAccumulated();
         
         // print model stats
         void ReportStats();
@@ -147,18 +204,86 @@ namespace adgMod {
         bool Learn(bool file);
     };
 
+    // Learns a file model from the keys of a table while the table is being built
+    // (see TableBuilder::TrainModel), so that a new file has its model without being read back.
+    // Where the entries are a run copied in order from a table with a model, such as a compaction
+    // input, the segments of that model are reused with their intercepts shifted by the offset of
+    // the run, and only the entries in between are fitted.
+    class FileModelBuilder {
+    public:
+        explicit FileModelBuilder(LearnedIndexData* data);
+        // called with the user key of every entry, in order; source is the learned model of the
+        // table the entry was copied from and source_position its index there, if known
+        void Add(const Slice& user_key, const LearnedIndexData* source = nullptr,
+                 uint64_t source_position = 0);
+        // called when a data block is written, with its last user key, its number of entries,
+        // the size of its entries (without the restart array) and its size on disk
+        void FinishBlock(const Slice& last_user_key, uint64_t block_entries, uint64_t entries_size,
+                         uint64_t block_size_on_disk);
+        // for a level model: called instead of Add for all the entries of a table whose file model
+        // is param:model, copying its segments; false, with nothing added, if they cannot be
+        // copied and the entries must be added one by one
+        bool AddTable(const LearnedIndexData* model);
+        // for a level model: called after the entries of each table, with its largest user key
+        void FinishTable(const Slice& largest_user_key);
+        // install the model in the LearnedIndexData; false if there was nothing to learn
+        bool Finish();
+
+    private:
+        // runs shorter than this, or than four average segments of their source, are fitted, as
+        // the segments split at both ends of a copied run would grow the model
+        static const size_t kMinCopiedRun = 64;
+
+        LearnedIndexData* data;
+        GreedyPLR plr;
+        std::vector<Segment> segments;
+        AccumulatedNumEntriesArray accumulated;
+        uint64_t num_entries;
+        uint64_t min_key;
+        uint64_t max_key;
+
+        // the run being copied, if any: its source, the output position of its first entry and
+        // the output position minus the source position of its entries
+        const LearnedIndexData* run_source;
+        uint64_t run_start;
+        uint64_t run_offset;
+        uint64_t run_min_key;
+        // the first entry of the run with key max_key, and the key before it
+        uint64_t run_tail_start;
+        uint64_t run_before_tail_key;
+        size_t run_min_length;
+        // keys of a run not yet kMinCopiedRun long, fitted if it ends before
+        std::vector<uint64_t> run_pending;
+
+        void Fit(uint64_t key, uint64_t position);
+        // finish the segment being fitted, so that copied segments can follow it
+        void CloseFit();
+        // close the run; next_key is the key of the entry after it, if there is one
+        void EndRun(bool has_next, uint64_t next_key);
+        void CopySegments(uint64_t first_key, uint64_t last_key);
+    };
+
     // an array storing all file models and provide similar access interface with multithread protection
     class FileLearnedIndexData {
     private:
+        // Models are kept in fixed chunks indexed by file number. Chunks never move once
+        // allocated, so readers find an existing model without taking the mutex.
+        static const int kChunkBits = 12;
+        static const size_t kChunkSize = 1 << kChunkBits;
+        static const size_t kNumChunks = 1 << 16;
+        typedef std::atomic<LearnedIndexData*> Slot;
+
         leveldb::port::Mutex mutex;
-        std::vector<LearnedIndexData*> file_learned_index_data;
+        std::atomic<Slot*> chunks[kNumChunks];
+        std::atomic<size_t> num_models;
     public:
         uint64_t watermark;
 
+        FileLearnedIndexData();
 
         bool Learned(Version* version, FileMetaData* meta, int level);
         bool FillData(Version* version, FileMetaData* meta);
-        std::vector<std::string>& GetData(FileMetaData* meta);
+        std::vector<uint64_t>& GetData(FileMetaData* meta);
         std::pair<uint64_t, uint64_t> GetPosition(const Slice& key, int file_num);
         AccumulatedNumEntriesArray* GetAccumulatedArray(int file_num);
         LearnedIndexData* GetModel(int number);
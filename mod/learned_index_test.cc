@@ -0,0 +1,538 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "mod/learned_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db/dbformat.h"
+#include "db/version_edit.h"
+#include "leveldb/env.h"
+#include "util/random.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace adgMod {
+
+namespace {
+
+std::string Key(uint64_t k) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016llu", static_cast<unsigned long long>(k));
+  return std::string(buf);
+}
+
+}  // namespace
+
+class LearnedIndexTest {
+ public:
+  LearnedIndexTest() : rnd_(301) {
+    filename_ = leveldb::test::TmpDir() + "/learned_index_test.fmodel";
+    leveldb::Env::Default()->DeleteFile(filename_);
+  }
+
+  ~LearnedIndexTest() { leveldb::Env::Default()->DeleteFile(filename_); }
+
+  // Increasing keys with gaps of varying size, so that the model has
+  // several segments
+  std::vector<uint64_t> RandomKeys(size_t n) {
+    std::vector<uint64_t> keys;
+    uint64_t key = 1000;
+    for (size_t i = 0; i < n; i++) {
+      key += 1 + (rnd_.OneIn(50) ? rnd_.Uniform(100000) : rnd_.Uniform(10));
+      keys.push_back(key);
+    }
+    return keys;
+  }
+
+  // Every key must be found within the predicted interval
+  void CheckPositions(const LearnedIndexData& model,
+                      const std::vector<uint64_t>& keys) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::pair<uint64_t, uint64_t> bounds = model.GetPosition(Key(keys[i]));
+      ASSERT_LE(bounds.first, i);
+      ASSERT_GE(bounds.second, i);
+    }
+  }
+
+  // A level model predicts files: both bounds of file i, at 2i and 2i + 1,
+  // must find it within the predicted interval
+  void CheckFiles(const LearnedIndexData& model,
+                  const std::vector<uint64_t>& bounds) {
+    for (size_t i = 0; i < bounds.size(); i++) {
+      std::pair<uint64_t, uint64_t> files = model.GetPosition(Key(bounds[i]));
+      ASSERT_LE(files.first, i / 2);
+      ASSERT_GE(files.second, i / 2);
+    }
+  }
+
+  std::string ReadFile() {
+    std::string contents;
+    ASSERT_OK(leveldb::ReadFileToString(leveldb::Env::Default(), filename_,
+                                        &contents));
+    return contents;
+  }
+
+  void WriteFile(const std::string& contents) {
+    ASSERT_OK(leveldb::WriteStringToFile(leveldb::Env::Default(), contents,
+                                         filename_));
+  }
+
+  // Learn a model over keys, with the accumulated array a level model has
+  // for files of 100 keys each, and write it to the model file
+  void WriteModel(const std::vector<uint64_t>& keys) {
+    LearnedIndexData model(0, false);
+    model.keys = keys;
+    ASSERT_TRUE(model.Learn());
+    for (size_t i = 100; i <= keys.size(); i += 100) {
+      model.num_entries_accumulated.Add(i, Key(keys[i - 1]));
+    }
+    model.WriteModel(filename_);
+  }
+
+  std::string filename_;
+  leveldb::Random rnd_;
+};
+
+TEST(LearnedIndexTest, BinaryModelRoundTrip) {
+  std::vector<uint64_t> keys = RandomKeys(10000);
+  LearnedIndexData model(0, false);
+  model.keys = keys;
+  ASSERT_TRUE(model.Learn());
+  ASSERT_GT(model.num_segments, 2);
+  model.WriteModel(filename_);
+
+  LearnedIndexData read(0, false);
+  read.ReadModel(filename_);
+  ASSERT_TRUE(read.Learned());
+  ASSERT_EQ(model.num_segments, read.num_segments);
+  for (size_t i = 0; i < model.num_segments; i++) {
+    ASSERT_EQ(model.segments[i].x, read.segments[i].x);
+    ASSERT_EQ(model.segments[i].k, read.segments[i].k);
+    ASSERT_EQ(model.segments[i].b, read.segments[i].b);
+  }
+  ASSERT_EQ(model.min_key, read.min_key);
+  ASSERT_EQ(model.max_key, read.max_key);
+  ASSERT_EQ(model.MaxPosition(), read.MaxPosition());
+  CheckPositions(read, keys);
+  // the search tree stored in the file finds what the one built does
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_TRUE(model.GetPosition(Key(keys[i])) ==
+                read.GetPosition(Key(keys[i])));
+  }
+}
+
+TEST(LearnedIndexTest, AccumulatedArrayRoundTrip) {
+  std::vector<uint64_t> keys = RandomKeys(10000);
+  WriteModel(keys);
+
+  LearnedIndexData read(0, true);
+  read.ReadModel(filename_);
+  ASSERT_TRUE(read.Learned());
+  const std::vector<std::pair<uint64_t, std::string>>& accumulated =
+      read.num_entries_accumulated.array;
+  ASSERT_EQ(100, accumulated.size());
+  for (size_t i = 0; i < accumulated.size(); i++) {
+    ASSERT_EQ(100 * (i + 1), accumulated[i].first);
+    ASSERT_EQ(Key(keys[100 * i + 99]), accumulated[i].second);
+  }
+}
+
+TEST(LearnedIndexTest, TruncatedModelRejected) {
+  std::vector<uint64_t> keys = RandomKeys(10000);
+  WriteModel(keys);
+  const std::string contents = ReadFile();
+
+  // cut in the keys, in the segments and in the header
+  const size_t lengths[] = {contents.size() - 1, contents.size() / 2, 100, 8,
+                            3};
+  for (size_t length : lengths) {
+    WriteFile(contents.substr(0, length));
+    LearnedIndexData read(0, false);
+    read.ReadModel(filename_);
+    ASSERT_TRUE(!read.Learned());
+
+    // the model is learned again as if there were no model file
+    read.keys = keys;
+    ASSERT_TRUE(read.Learn());
+    CheckPositions(read, keys);
+  }
+}
+
+TEST(LearnedIndexTest, CorruptModelRejected) {
+  std::vector<uint64_t> keys = RandomKeys(10000);
+  WriteModel(keys);
+  const std::string contents = ReadFile();
+
+  // a flipped bit anywhere past the magic number
+  for (size_t offset = 8; offset < contents.size(); offset += 97) {
+    std::string corrupt = contents;
+    corrupt[offset] ^= 0x10;
+    WriteFile(corrupt);
+    LearnedIndexData read(0, false);
+    read.ReadModel(filename_);
+    ASSERT_TRUE(!read.Learned());
+
+    read.keys = keys;
+    ASSERT_TRUE(read.Learn());
+    CheckPositions(read, keys);
+  }
+}
+
+// The segment search through the Eytzinger tree finds the segment the binary
+// search finds: for trees of every shape, down to a single segment besides
+// the dummy last one, for keys at segment starts, next to them, and below the
+// first segment.
+TEST(LearnedIndexTest, EytzingerMatchesBinarySearch) {
+  const bool saved_eytzinger_search = eytzinger_search;
+  for (size_t count : {1, 2, 3, 5, 6, 7, 8, 9, 15, 16, 17, 31, 33, 100, 1000}) {
+    std::vector<Segment> segs;
+    uint64_t x = 1000000;
+    for (size_t i = 0; i < count; i++) {
+      segs.push_back((Segment){x, 0.001 * (1 + rnd_.Uniform(1000)),
+                               (double)rnd_.Uniform(1000000)});
+      x += 1 + rnd_.Uniform(10000);
+    }
+    LearnedIndexData model(0, false);
+    // bounds beyond the segments, so that no key is cut off before the search
+    model.Install(std::move(segs), 1000, x + 1000, 1ull << 40);
+    ASSERT_EQ(count + 1, model.num_segments);
+
+    std::vector<uint64_t> targets = {1000, 1001, 999999, model.max_key};
+    for (size_t i = 0; i + 1 < model.num_segments; i++) {
+      targets.push_back(model.segments[i].x - 1);
+      targets.push_back(model.segments[i].x);
+      targets.push_back(model.segments[i].x + 1);
+    }
+    for (int i = 0; i < 100; i++) {
+      targets.push_back(1000 + rnd_.Uniform(x - 1000));
+    }
+    for (uint64_t target : targets) {
+      eytzinger_search = true;
+      std::pair<uint64_t, uint64_t> tree = model.GetPosition(Key(target));
+      uint64_t tree_below = model.NumEntriesBelow(Key(target));
+      eytzinger_search = false;
+      std::pair<uint64_t, uint64_t> binary = model.GetPosition(Key(target));
+      uint64_t binary_below = model.NumEntriesBelow(Key(target));
+      ASSERT_EQ(binary.first, tree.first);
+      ASSERT_EQ(binary.second, tree.second);
+      ASSERT_EQ(binary_below, tree_below);
+    }
+  }
+  eytzinger_search = saved_eytzinger_search;
+}
+
+// NumEntriesBelow never counts more entries than there are below a key, for
+// keys in the table or not, including keys with runs of equal entries
+TEST(LearnedIndexTest, NumEntriesBelowIsLowerBound) {
+  uint64_t total = 0;
+  for (int trial = 0; trial < 30; trial++) {
+    std::vector<uint64_t> keys = RandomKeys(1000 + rnd_.Uniform(20000));
+    // runs of equal keys, as a table holds for several versions of a key
+    for (size_t i = 1; i < keys.size(); i++) {
+      if (rnd_.OneIn(10)) {
+        for (size_t length = 1 + rnd_.Uniform(30);
+             length > 0 && i < keys.size(); length--, i++) {
+          keys[i] = keys[i - 1];
+        }
+      }
+    }
+    LearnedIndexData model(0, false);
+    model.keys = keys;
+    ASSERT_TRUE(model.Learn());
+
+    std::vector<uint64_t> targets = {0, keys.front(), keys.back(),
+                                     keys.back() + 1};
+    for (int i = 0; i < 2000; i++) {
+      const uint64_t key = keys[rnd_.Uniform(keys.size())];
+      targets.push_back(key);
+      targets.push_back(key - 1);
+      targets.push_back(key + 1);
+      targets.push_back(keys.front() +
+                        rnd_.Uniform(keys.back() - keys.front() + 1));
+    }
+    for (uint64_t target : targets) {
+      const uint64_t below =
+          std::lower_bound(keys.begin(), keys.end(), target) - keys.begin();
+      const uint64_t predicted = model.NumEntriesBelow(Key(target));
+      ASSERT_LE(predicted, below);
+      total += predicted;
+    }
+  }
+  // not a bound of 0 everywhere
+  ASSERT_GT(total, 0);
+}
+
+// Entries merged from several tables, as a compaction writes them, get a
+// model composed of the segments of their sources and of segments fitted in
+// between.  Sources without a segment to copy, such as one whose model is only
+// the dummy last segment, have their entries fitted.  Either way every entry
+// must be found within the error bound, as with a model learned anew.
+TEST(LearnedIndexTest, ComposedModelWithinError) {
+  for (int trial = 0; trial < 30; trial++) {
+    const int num_sources = 1 + rnd_.Uniform(4);
+    std::vector<uint64_t> keys = RandomKeys(1000 + rnd_.Uniform(9000));
+    // the source of each entry, in runs of all lengths
+    std::vector<int> owners(keys.size());
+    for (size_t i = 0; i < keys.size();) {
+      const int owner = rnd_.Uniform(num_sources);
+      size_t length = 1 + (rnd_.OneIn(2) ? rnd_.Uniform(1000) : rnd_.Uniform(10));
+      for (; length > 0 && i < keys.size(); length--) owners[i++] = owner;
+    }
+
+    std::vector<std::vector<uint64_t>> source_keys(num_sources);
+    std::vector<uint64_t> positions(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      positions[i] = source_keys[owners[i]].size();
+      source_keys[owners[i]].push_back(keys[i]);
+    }
+    std::vector<std::unique_ptr<LearnedIndexData>> sources;
+    for (int s = 0; s < num_sources; s++) {
+      sources.emplace_back(new LearnedIndexData(0, false));
+      LearnedIndexData* source = sources.back().get();
+      if (source_keys[s].empty()) continue;
+      source->keys = source_keys[s];
+      if (rnd_.OneIn(4)) {
+        // only the dummy last segment
+        source->string_segments.push_back(
+            (Segment){source_keys[s].back(), 0, 0});
+        source->segments = source->string_segments.data();
+        source->num_segments = 1;
+        source->min_key = source_keys[s].front();
+        source->max_key = source_keys[s].back();
+        source->size = source_keys[s].size();
+      } else if (!rnd_.OneIn(4)) {
+        ASSERT_TRUE(source->Learn());
+        CheckPositions(*source, source_keys[s]);
+      }
+    }
+
+    LearnedIndexData composed(0, false);
+    FileModelBuilder builder(&composed);
+    for (size_t i = 0; i < keys.size(); i++) {
+      builder.Add(Key(keys[i]), sources[owners[i]].get(), positions[i]);
+    }
+    ASSERT_TRUE(builder.Finish());
+    ASSERT_EQ(keys.size(), composed.size);
+    CheckPositions(composed, keys);
+
+    LearnedIndexData refit(0, false);
+    refit.keys = keys;
+    ASSERT_TRUE(refit.Learn());
+    CheckPositions(refit, keys);
+    ASSERT_EQ(refit.MaxPosition(), composed.MaxPosition());
+  }
+}
+
+// A level model refitted only where an edit changed the level finds every
+// file bound within the error bound, as one learned anew over the whole level
+// does, through any sequence of edits.  Files are deleted, added in gaps and
+// replaced by files of other bounds.  Some edits apply to a model fitted
+// without restarting segments at the smallest key of a file, whose segments
+// start at the largest key of a file as well.
+TEST(LearnedIndexTest, UpdatedLevelWithinError) {
+  // level models are learned through PLR::train, which looks at the env
+  leveldb::Env* saved_env = env;
+  env = leveldb::Env::Default();
+
+  struct File {
+    uint64_t smallest, largest, number;
+  };
+  uint64_t next_number = 1;
+  std::vector<File> level;
+  uint64_t key = 1000;
+  for (int i = 0; i < 2000; i++) {
+    key += 1 + (rnd_.OneIn(20) ? rnd_.Uniform(100000) : rnd_.Uniform(1000));
+    File file;
+    file.smallest = key;
+    if (!rnd_.OneIn(8)) key += 1 + rnd_.Uniform(1000);
+    file.largest = key;
+    file.number = next_number++;
+    level.push_back(file);
+  }
+
+  std::vector<std::unique_ptr<leveldb::FileMetaData>> metas;
+  auto files_of = [&](const std::vector<File>& files) {
+    std::vector<leveldb::FileMetaData*> result;
+    for (const File& file : files) {
+      metas.emplace_back(new leveldb::FileMetaData);
+      leveldb::FileMetaData* meta = metas.back().get();
+      meta->number = file.number;
+      meta->smallest = leveldb::InternalKey(Key(file.smallest), 100,
+                                            leveldb::kTypeValue);
+      meta->largest =
+          leveldb::InternalKey(Key(file.largest), 100, leveldb::kTypeValue);
+      result.push_back(meta);
+    }
+    return result;
+  };
+  auto bounds_of = [](const std::vector<File>& files) {
+    std::vector<uint64_t> bounds;
+    for (const File& file : files) {
+      bounds.push_back(file.smallest);
+      bounds.push_back(file.largest);
+    }
+    return bounds;
+  };
+
+  auto fit_anywhere = [&](const std::vector<uint64_t>& bounds) {
+    std::unique_ptr<LearnedIndexData> model(new LearnedIndexData(0, true));
+    GreedyPLR plr(model->GetError());
+    std::vector<Segment> segs;
+    for (size_t i = 0; i < bounds.size(); i++) {
+      Segment seg = plr.process(point((double)bounds[i], i), true);
+      if (seg.x != 0 || seg.k != 0 || seg.b != 0) segs.push_back(seg);
+    }
+    segs.push_back(plr.finish());
+    model->Install(std::move(segs), bounds.front(), bounds.back(),
+                   bounds.size());
+    return model;
+  };
+
+  std::unique_ptr<LearnedIndexData> model(new LearnedIndexData(0, true));
+  model->keys = bounds_of(level);
+  ASSERT_TRUE(model->Learn());
+  int updated = 0;
+  for (int edit = 0; edit < 300; edit++) {
+    if (rnd_.OneIn(3)) {
+      model = fit_anywhere(bounds_of(level));
+      CheckFiles(*model, bounds_of(level));
+    }
+    std::vector<File> edited;
+    bool changed = false;
+    do {
+      // files [start, start + removed) give way to up to three new ones in
+      // the room they and the gaps around them leave
+      const size_t start = rnd_.Uniform(level.size() + 1);
+      const size_t removed =
+          std::min<size_t>(rnd_.Uniform(4), level.size() - start);
+      const uint64_t low = start == 0 ? 1 : level[start - 1].largest + 1;
+      const uint64_t high = start + removed == level.size()
+                                ? level.back().largest + 200000
+                                : level[start + removed].smallest - 1;
+      std::vector<uint64_t> bounds;
+      const int added = high < low + 10 ? 0 : rnd_.Uniform(4);
+      for (int i = 0; i < 2 * added; i++) {
+        bounds.push_back(low + rnd_.Uniform(high - low + 1));
+      }
+      std::sort(bounds.begin(), bounds.end());
+      bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+      edited.assign(level.begin(), level.begin() + start);
+      for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+        File file;
+        file.smallest = bounds[i];
+        file.largest = rnd_.OneIn(8) ? bounds[i] : bounds[i + 1];
+        file.number = next_number++;
+        edited.push_back(file);
+      }
+      changed = removed > 0 || bounds.size() > 1;
+      edited.insert(edited.end(), level.begin() + start + removed, level.end());
+    } while (!changed || edited.empty());
+
+    const std::vector<uint64_t> bounds = bounds_of(edited);
+    std::unique_ptr<LearnedIndexData> full(new LearnedIndexData(0, true));
+    full->keys = bounds;
+    ASSERT_TRUE(full->Learn());
+    CheckFiles(*full, bounds);
+
+    std::unique_ptr<LearnedIndexData> incremental(
+        new LearnedIndexData(0, true));
+    if (incremental->UpdateLevel(model.get(), files_of(level),
+                                 files_of(edited))) {
+      updated++;
+      for (size_t s = 1; s < incremental->num_segments; s++) {
+        ASSERT_LE(incremental->segments[s - 1].x, incremental->segments[s].x);
+      }
+      CheckFiles(*incremental, bounds);
+      ASSERT_EQ(full->MaxPosition(), incremental->MaxPosition());
+      model = std::move(incremental);
+    } else {
+      model = std::move(full);
+    }
+    level = edited;
+  }
+  ASSERT_GT(updated, 250);
+
+  env = saved_env;
+}
+
+// A level model over the entries of a level, as Version::LearnLevelEntries
+// composes it from the tables of the level: the segments of learned tables are
+// copied, the entries of the others are added one by one.  Every entry must be
+// found within the error bound, and the accumulated array must turn the
+// predicted interval into its table and an interval of entries there holding
+// it.
+TEST(LearnedIndexTest, LevelEntriesWithinError) {
+  const uint32_t saved_file_model_error = file_model_error;
+  int copied = 0;
+  for (int trial = 0; trial < 30; trial++) {
+    std::vector<uint64_t> keys = RandomKeys(1000 + rnd_.Uniform(20000));
+    // tables of all sizes, down to a single entry
+    std::vector<size_t> table_ends;
+    for (size_t i = 0; i < keys.size();) {
+      i += 1 + (rnd_.OneIn(4) ? rnd_.Uniform(5) : rnd_.Uniform(3000));
+      table_ends.push_back(std::min(i, keys.size()));
+      i = table_ends.back();
+    }
+
+    LearnedIndexData level(0, false);
+    FileModelBuilder builder(&level);
+    std::vector<size_t> tables(keys.size());
+    std::vector<uint64_t> positions(keys.size());
+    size_t begin = 0;
+    for (size_t t = 0; t < table_ends.size(); t++) {
+      const size_t end = table_ends[t];
+      for (size_t i = begin; i < end; i++) {
+        tables[i] = t;
+        positions[i] = i - begin;
+      }
+      // a table learned with a larger error cannot have its segments copied
+      if (rnd_.OneIn(5)) file_model_error = 2 * saved_file_model_error;
+      LearnedIndexData table(0, false);
+      file_model_error = saved_file_model_error;
+      if (!rnd_.OneIn(4)) {
+        table.keys.assign(keys.begin() + begin, keys.begin() + end);
+        ASSERT_TRUE(table.Learn());
+      }
+      if (table.Learned() && builder.AddTable(&table)) {
+        copied++;
+      } else {
+        for (size_t i = begin; i < end; i++) builder.Add(Key(keys[i]));
+      }
+      builder.FinishTable(Key(keys[end - 1]));
+      begin = end;
+    }
+    ASSERT_TRUE(builder.Finish());
+    ASSERT_EQ(keys.size(), level.size);
+    ASSERT_EQ(keys.size(), level.num_entries_accumulated.NumEntries());
+    CheckPositions(level, keys);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      const std::string key = Key(keys[i]);
+      std::pair<uint64_t, uint64_t> bounds = level.GetPosition(key);
+      size_t index;
+      uint64_t lower, upper;
+      ASSERT_TRUE(level.num_entries_accumulated.Search(
+          key, bounds.first, bounds.second, &index, &lower, &upper));
+      ASSERT_EQ(tables[i], index);
+      ASSERT_LE(lower, positions[i]);
+      ASSERT_GE(upper, positions[i]);
+    }
+
+    LearnedIndexData refit(0, false);
+    refit.keys = keys;
+    ASSERT_TRUE(refit.Learn());
+    ASSERT_EQ(refit.MaxPosition(), level.MaxPosition());
+  }
+  ASSERT_GT(copied, 0);
+}
+
+}  // namespace adgMod
+
+int main(int argc, char** argv) { return leveldb::test::RunAllTests(); }
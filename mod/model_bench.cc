@@ -0,0 +1,144 @@
+// Microbenchmark of the segment search in LearnedIndexData::GetPosition.
+//
+// Learns file models over consecutive chunks of a key set and one level
+// model over all of it, then reports nanoseconds per GetPosition with the
+// binary search and with the Eytzinger tree. Keys are read from -f (one
+// integer per line, as read_cold takes them) or drawn uniformly. Example:
+//
+//   ./model_bench -f osm_keys.txt --file_entries 100000 --lookups 10000000
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include "cxxopts.hpp"
+#include "learned_index.h"
+#include "util.h"
+
+using namespace adgMod;
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Lookup {
+    const LearnedIndexData* model;
+    Slice key;
+};
+
+// Returns ns per lookup; checksum keeps the predictions alive
+double Run(const vector<Lookup>& lookups, uint64_t* checksum) {
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Lookup& lookup : lookups) {
+        std::pair<uint64_t, uint64_t> position = lookup.model->GetPosition(lookup.key);
+        sum += position.first + position.second;
+    }
+    auto end = std::chrono::steady_clock::now();
+    *checksum = sum;
+    return std::chrono::duration<double, std::nano>(end - start).count() / lookups.size();
+}
+
+void Report(const char* name, const vector<LearnedIndexData*>& models, const vector<Lookup>& lookups, int repeats) {
+    size_t num_segments = 0;
+    for (LearnedIndexData* model : models) num_segments += model->string_segments.size();
+
+    double best[2] = {0, 0};
+    uint64_t checksums[2];
+    for (int search = 0; search < 2; ++search) {
+        eytzinger_search = search == 1;
+        for (int r = 0; r < repeats; ++r) {
+            double ns = Run(lookups, &checksums[search]);
+            if (r == 0 || ns < best[search]) best[search] = ns;
+        }
+    }
+    if (checksums[0] != checksums[1]) {
+        fprintf(stderr, "%s: the two searches disagree\n", name);
+        exit(1);
+    }
+    printf("%-6s %8zu %14.1f %14.1f %16.1f\n", name, models.size(),
+           (double) num_segments / models.size(), best[0], best[1]);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    string input_filename;
+    int file_entries, num_lookups, repeats;
+
+    cxxopts::Options commandline_options("model_bench", "Segment search in learned models.");
+    commandline_options.add_options()
+            ("f,input_file", "the filename of input file", cxxopts::value<string>(input_filename)->default_value(""))
+            ("k,key_size", "the size of key", cxxopts::value<int>(adgMod::key_size)->default_value("16"))
+            ("file_entries", "number of keys per file model", cxxopts::value<int>(file_entries)->default_value("100000"))
+            ("n,lookups", "number of lookups", cxxopts::value<int>(num_lookups)->default_value("10000000"))
+            ("repeats", "repetitions per search, the fastest is reported", cxxopts::value<int>(repeats)->default_value("3"))
+            ("file_model_error", "error in file model", cxxopts::value<uint32_t>(adgMod::file_model_error)->default_value("8"))
+            ("level_model_error", "error in level model", cxxopts::value<uint32_t>(adgMod::level_model_error)->default_value("1"))
+            ("h,help", "print help message", cxxopts::value<bool>()->default_value("false"));
+    auto result = commandline_options.parse(argc, argv);
+    if (result.count("help")) {
+        printf("%s", commandline_options.help().c_str());
+        exit(0);
+    }
+
+    adgMod::env = leveldb::Env::Default();
+
+    vector<uint64_t> integers;
+    if (!input_filename.empty()) {
+        std::ifstream input(input_filename);
+        uint64_t key;
+        while (input >> key) integers.push_back(key);
+    } else {
+        std::default_random_engine e(255);
+        std::uniform_int_distribution<uint64_t> udist_key(0, 999999999999999);
+        for (int i = 0; i < 10000000; ++i) integers.push_back(udist_key(e));
+    }
+    std::sort(integers.begin(), integers.end());
+    integers.erase(std::unique(integers.begin(), integers.end()), integers.end());
+    if (integers.size() < 2) {
+        fprintf(stderr, "need at least two distinct keys\n");
+        exit(1);
+    }
+    vector<string> keys;
+    keys.reserve(integers.size());
+    for (uint64_t key : integers) keys.push_back(generate_key(std::to_string(key)));
+
+    vector<LearnedIndexData*> file_models;
+    for (size_t i = 0; i < keys.size(); i += file_entries) {
+        size_t end = std::min(keys.size(), i + file_entries);
+        if (end - i < 2) break;
+        LearnedIndexData* model = new LearnedIndexData(file_allowed_seek, false);
+        model->keys.assign(integers.begin() + i, integers.begin() + end);
+        model->Learn();
+        model->keys.clear();
+        file_models.push_back(model);
+    }
+    LearnedIndexData* level_model = new LearnedIndexData(level_allowed_seek, true);
+    level_model->keys = integers;
+    level_model->Learn();
+    level_model->keys.clear();
+
+    std::default_random_engine e(0);
+    size_t covered = std::min(keys.size(), file_models.size() * file_entries);
+    std::uniform_int_distribution<size_t> udist_index(0, covered - 1);
+    vector<Lookup> file_lookups, level_lookups;
+    file_lookups.reserve(num_lookups);
+    level_lookups.reserve(num_lookups);
+    for (int i = 0; i < num_lookups; ++i) {
+        size_t index = udist_index(e);
+        file_lookups.push_back({file_models[index / file_entries], keys[index]});
+        level_lookups.push_back({level_model, keys[index]});
+    }
+
+    printf("Keys:    %zu\n", keys.size());
+    printf("Lookups: %d\n", num_lookups);
+    printf("%-6s %8s %14s %14s %16s\n", "model", "models", "segments/model", "binary ns/op", "eytzinger ns/op");
+    Report("file", file_models, file_lookups, repeats);
+    Report("level", {level_model}, level_lookups, repeats);
+
+    for (LearnedIndexData* model : file_models) delete model;
+    delete level_model;
+    return 0;
+}
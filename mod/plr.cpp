@@ -54,7 +54,7 @@ get_lower_bound(struct point pt, double gamma) {
 }
 
 GreedyPLR::GreedyPLR(double gamma) {
-    this->state = "need2";
+    this->state = kNeed2;
     this->gamma = gamma;
 }
 
@@ -63,14 +63,14 @@ int counter = 0;
 Segment
 GreedyPLR::process(const struct point& pt, bool file) {
     Segment s = {0, 0, 0};
-    if (this->state.compare("need2") == 0) {
+    if (this->state == kNeed2) {
         this->s0 = pt;
-        this->state = "need1";
-    } else if (this->state.compare("need1") == 0) {
+        this->state = kNeed1;
+    } else if (this->state == kNeed1) {
         this->s1 = pt;
         setup();
-        this->state = "ready";
-    } else if (this->state.compare("ready") == 0) {
+        this->state = kReady;
+    } else if (this->state == kReady) {
         s = process__(pt, file);
     } else {
         // impossible
@@ -108,11 +108,11 @@ GreedyPLR::process__(struct point pt, bool file) {
             this->s0 = last_pt;
             this->s1 = pt;
             setup();
-            this->state = "ready";
+            this->state = kReady;
             return prev_segment;
         } else {
             this->s0 = pt;
-            this->state = "need1";
+            this->state = kNeed1;
         }
         return prev_segment;
     }
@@ -132,17 +132,17 @@ GreedyPLR::process__(struct point pt, bool file) {
 Segment
 GreedyPLR::finish() {
     Segment s = {0, 0, 0};
-    if (this->state.compare("need2") == 0) {
-        this->state = "finished";
+    if (this->state == kNeed2) {
+        this->state = kFinished;
         return s;
-    } else if (this->state.compare("need1") == 0) {
-        this->state = "finished";
+    } else if (this->state == kNeed1) {
+        this->state = kFinished;
         s.x = this->s0.x;
         s.k = 0;
         s.b = this->s0.y;
         return s;
-    } else if (this->state.compare("ready") == 0) {
-        this->state = "finished";
+    } else if (this->state == kReady) {
+        this->state = kFinished;
         return current_segment();
     } else {
         std::cout << "ERROR in finish" << std::endl;
@@ -155,12 +155,11 @@ PLR::PLR(double gamma) {
 }
 
 std::vector<Segment>&
-PLR::train(std::vector<string>& keys, bool file) {
+PLR::train(const uint64_t* keys, size_t size, bool file) {
     GreedyPLR plr(this->gamma);
     int count = 0;
-    size_t size = keys.size();
-    for (int i = 0; i < size; ++i) {
-        Segment seg = plr.process(point((double) stoull(keys[i]), i), file);
+    for (size_t i = 0; i < size; ++i) {
+        Segment seg = plr.process(point((double) keys[i], i), file);
         if (seg.x != 0 ||
             seg.k != 0 ||
             seg.b != 0) {
@@ -38,7 +38,9 @@ struct point get_lower_bound(struct point pt, double gamma);
 
 class GreedyPLR {
 private:
-    std::string state;
+    enum State { kNeed2, kNeed1, kReady, kFinished };
+
+    State state;
     double gamma;
     struct point last_pt;
     struct point s0;
@@ -64,7 +66,7 @@ private:
 
 public:
     PLR(double gamma);
-    std::vector<Segment>& train(std::vector<std::string>& keys, bool file);
+    std::vector<Segment>& train(const uint64_t* keys, size_t size, bool file);
 //    std::vector<double> predict(std::vector<double> xx);
 //    double mae(std::vector<double> y_true, std::vector<double> y_pred);
 };
@@ -92,7 +92,8 @@ int main(int argc, char *argv[]) {
     string db_location, profiler_out, input_filename, distribution_filename, ycsb_filename;
     bool print_single_timing, print_file_info, evict, unlimit_fd, use_distribution = false, pause, use_ycsb = false;
     bool change_level_load, change_file_load, change_level_learning, change_file_learning;
-    int load_type, insert_bound;
+    bool direct_reads;
+    int load_type, insert_bound, max_subcompactions;
     string db_location_copy;
 
     string output;
@@ -127,6 +128,20 @@ int main(int argc, char *argv[]) {
             ("change_file_load", "enable level learning", cxxopts::value<bool>(change_file_load)->default_value("false"))
             ("p,pause", "pause between operation", cxxopts::value<bool>(pause)->default_value("false"))
             ("policy", "learn policy", cxxopts::value<int>(adgMod::policy)->default_value("0"))
+            ("learned_merge", "use file models to skip comparisons in compaction", cxxopts::value<bool>(adgMod::learned_merge)->default_value("false"))
+            ("learn_on_build", "learn file models while tables are built", cxxopts::value<bool>(adgMod::learn_on_build)->default_value("false"))
+            ("compose_models", "compose compaction output models from input models", cxxopts::value<bool>(adgMod::compose_models)->default_value("false"))
+            ("level_entry_model", "learn level models over all entries of a level", cxxopts::value<bool>(adgMod::level_entry_model)->default_value("false"))
+            ("learn_workers", "number of file learning threads, 0 for one per core", cxxopts::value<int>(adgMod::learn_workers)->default_value("1"))
+            ("learn_cpu_share", "fraction of the cores file learning may use", cxxopts::value<double>(adgMod::learn_cpu_share)->default_value("1"))
+            ("text_model", "write models in the old text format", cxxopts::value<bool>(adgMod::text_model)->default_value("false"))
+            ("io_uring", "read table files through io_uring", cxxopts::value<bool>(adgMod::use_io_uring)->default_value("false"))
+            ("subcompactions", "max number of threads per compaction", cxxopts::value<int>(max_subcompactions)->default_value("1"))
+            ("direct_reads", "run every iteration twice, reading predicted entries through the page cache and then with O_DIRECT, and report both", cxxopts::value<bool>(direct_reads)->default_value("false"))
+            ("vlog_gc_threshold", "fraction of a vlog segment that must be dead before it is collected, 0 to disable", cxxopts::value<double>(adgMod::vlog_gc_threshold)->default_value("0.5"))
+            ("vlog_segment_size", "size after which the vlog starts a new segment file", cxxopts::value<uint64_t>(adgMod::vlog_segment_size)->default_value("16777216"))
+            ("vlog_gc_rate", "bytes per second vlog collection may read, 0 for unlimited", cxxopts::value<uint64_t>(adgMod::vlog_gc_rate)->default_value("33554432"))
+            ("vlog_value_threshold", "values shorter than this are kept in the LSM instead of the vlog", cxxopts::value<uint32_t>(adgMod::vlog_value_threshold)->default_value("0"))
             ("YCSB", "use YCSB trace", cxxopts::value<string>(ycsb_filename)->default_value(""))
             ("insert", "insert new value", cxxopts::value<int>(insert_bound)->default_value("0"))
             ("output", "output key list", cxxopts::value<string>(output)->default_value("key_list.txt"));
@@ -203,7 +218,23 @@ int main(int argc, char *argv[]) {
         num_mix -= 1000;
     }
 
-    for (size_t iteration = 0; iteration < num_iteration; ++iteration) {
+    // with direct_reads, each iteration is run through the page cache and then with O_DIRECT,
+    // over the same operations
+    const int num_read_paths = direct_reads ? 2 : 1;
+    const char* read_path_names[2] = {"page cache", "O_DIRECT"};
+    vector<uint64_t> read_path_times[2];
+    std::default_random_engine read_path_e1, read_path_e2, read_path_e3;
+    for (size_t iteration = 0; iteration < num_iteration * num_read_paths; ++iteration) {
+        const int read_path = iteration % num_read_paths;
+        if (read_path == 0) {
+            read_path_e1 = e1;
+            read_path_e2 = e2;
+            read_path_e3 = e3;
+        } else {
+            e1 = read_path_e1;
+            e2 = read_path_e2;
+            e3 = read_path_e3;
+        }
 //        if (copy_out) {
 //            rc = system("sudo fstrim -a -v");
 //        }
@@ -220,6 +251,8 @@ int main(int argc, char *argv[]) {
         Status status;
 
         options.create_if_missing = true;
+        options.max_subcompactions = max_subcompactions;
+        options.direct_reads = read_path == 1;
         //options.comparator = new NumericalComparator;
         //adgMod::block_restart_interval = options.block_restart_interval = adgMod::MOD == 8 || adgMod::MOD == 7 ? 1 : adgMod::block_restart_interval;
         //read_options.fill_cache = true;
@@ -352,6 +385,7 @@ int main(int argc, char *argv[]) {
         (void) rc;
 
         cout << "Starting up" << endl;
+        cout << "Read path: " << read_path_names[read_path] << endl;
         status = DB::Open(options, db_location, &db);
         adgMod::db->WaitForBackground();
         assert(status.ok() && "Open Error");
@@ -497,6 +531,7 @@ int main(int argc, char *argv[]) {
         for (int s = 0; s < times.size(); ++s) {
             times[s].push_back(instance->ReportTime(s));
         }
+        read_path_times[read_path].push_back(instance->ReportTime(4));
         adgMod::db->WaitForBackground();
         sleep(10);
 
@@ -507,6 +542,7 @@ int main(int argc, char *argv[]) {
         }
 
         for (Counter& c : levelled_counters) c.Report();
+        for (int i = 0; i < learn_worker_stats.size(); ++i) learn_worker_stats[i].Report(i);
 
         file_data->Report();
         Version* current = adgMod::db->versions_->current();
@@ -541,6 +577,14 @@ int main(int argc, char *argv[]) {
         printf("Timer %d MEAN: %lu, STDDEV: %f\n", s, (uint64_t) mean, stdev);
     }
 
+    // read time (timer 4) of the runs through each read path
+    for (int path = 0; direct_reads && path < num_read_paths; ++path) {
+        const vector<uint64_t>& time = read_path_times[path];
+        if (time.empty()) continue;
+        double mean = std::accumulate(time.begin(), time.end(), 0.0) / time.size();
+        printf("Read path %s: read time MEAN: %lu, RUNS: %zu\n", read_path_names[path], (uint64_t) mean, time.size());
+    }
+
     if (num_iteration > 1) {
         cout << "Data Without the First Item" << endl;
         for (int s = 0; s < times.size(); ++s) {
@@ -16,7 +16,9 @@ namespace adgMod {
 
     Stats* Stats::singleton = nullptr;
 
-    Stats::Stats() : timers(20, Timer{}), initial_time(__rdtsc()) {
+    Stats::Stats() : initial_time(__rdtsc()) {
+        timers.reserve(20);
+        for (uint32_t id = 0; id < 20; ++id) timers.emplace_back(id);
         levelled_counters[0].name = "LevelModel";
         levelled_counters[1].name = "FileModel";
         levelled_counters[2].name = "Baseline";
@@ -32,6 +34,8 @@ namespace adgMod {
         levelled_counters[12].name = "LevelLearn";
         levelled_counters[13].name = "LevelModelUse";
         levelled_counters[14].name = "LevelModelNotUse";
+        levelled_counters[15].name = "LearnedMergeSkip";
+        levelled_counters[16].name = "ComposedEntries";
     }
 
     Stats* Stats::GetInstance() {
@@ -4,46 +4,103 @@
 
 #include "timer.h"
 #include "util.h"
+#include <atomic>
 #include <cassert>
+#include <set>
 #include <x86intrin.h>
 
 
 namespace adgMod {
 
-    Timer::Timer() : time_accumulated(0), started(false) {}
+    namespace {
+
+        // Timer state of one thread. Only the owning thread writes it; Time() and
+        // Reset() read it from other threads through the registry.
+        struct ThreadTimers {
+            uint64_t time_started[Timer::kMaxTimers];
+            bool started[Timer::kMaxTimers];
+            std::atomic<uint64_t> time_accumulated[Timer::kMaxTimers];
+
+            ThreadTimers();
+            ~ThreadTimers();
+        };
+
+        // never destroyed, as threads may exit during static destruction
+        leveldb::port::Mutex* registry_mutex = new leveldb::port::Mutex();
+        std::set<ThreadTimers*>* registry = new std::set<ThreadTimers*>();
+        // time of threads that have exited
+        uint64_t retired[Timer::kMaxTimers];
+
+        ThreadTimers::ThreadTimers() {
+            for (uint32_t i = 0; i < Timer::kMaxTimers; ++i) {
+                started[i] = false;
+                time_accumulated[i].store(0, std::memory_order_relaxed);
+            }
+            registry_mutex->Lock();
+            registry->insert(this);
+            registry_mutex->Unlock();
+        }
+
+        ThreadTimers::~ThreadTimers() {
+            registry_mutex->Lock();
+            for (uint32_t i = 0; i < Timer::kMaxTimers; ++i) retired[i] += time_accumulated[i].load();
+            registry->erase(this);
+            registry_mutex->Unlock();
+        }
+
+        ThreadTimers& LocalTimers() {
+            static thread_local ThreadTimers timers;
+            return timers;
+        }
+    }
+
+    Timer::Timer(uint32_t id) : id(id) {
+        assert(id < kMaxTimers);
+    }
 
     void Timer::Start() {
-        assert(!started);
+        ThreadTimers& local = LocalTimers();
+        assert(!local.started[id]);
         unsigned int dummy = 0;
-        time_started = __rdtscp(&dummy);
-        started = true;
+        local.time_started[id] = __rdtscp(&dummy);
+        local.started[id] = true;
     }
 
     std::pair<uint64_t, uint64_t> Timer::Pause(bool record) {
-        assert(started);
+        ThreadTimers& local = LocalTimers();
+        assert(local.started[id]);
         unsigned int dummy = 0;
+        uint64_t time_started = local.time_started[id];
         uint64_t time_elapse = __rdtscp(&dummy) - time_started;
-        time_accumulated += time_elapse / reference_frequency;
+        // only this thread adds to its own slot, so no atomic add is needed
+        std::atomic<uint64_t>& accumulated = local.time_accumulated[id];
+        accumulated.store(accumulated.load(std::memory_order_relaxed) + time_elapse / reference_frequency,
+                          std::memory_order_relaxed);
+        local.started[id] = false;
 
         if (record) {
             Stats* instance = Stats::GetInstance();
             uint64_t start_absolute = time_started - instance->initial_time;
             uint64_t end_absolute = start_absolute + time_elapse;
-            started = false;
             return {start_absolute / reference_frequency, end_absolute / reference_frequency};
         } else {
-            started = false;
             return {0, 0};
         }
     }
 
     void Timer::Reset() {
-        time_accumulated = 0;
-        started = false;
+        LocalTimers().started[id] = false;
+        registry_mutex->Lock();
+        retired[id] = 0;
+        for (ThreadTimers* timers : *registry) timers->time_accumulated[id].store(0, std::memory_order_relaxed);
+        registry_mutex->Unlock();
     }
 
     uint64_t Timer::Time() {
-        //assert(!started);
-        return time_accumulated;
+        registry_mutex->Lock();
+        uint64_t time = retired[id];
+        for (ThreadTimers* timers : *registry) time += timers->time_accumulated[id].load(std::memory_order_relaxed);
+        registry_mutex->Unlock();
+        return time;
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,8 @@
 //
 // Created by daiyi on 2020/02/02.
 // Internal implementation for timers used in Stats class.
+// A timer may be started and paused by several threads at once: each thread
+// keeps its own start time and accumulated time, and Time() adds them up.
 
 #ifndef LEVELDB_TIMER_H
 #define LEVELDB_TIMER_H
@@ -14,17 +16,17 @@
 namespace adgMod {
 
     class Timer {
-        uint64_t time_started;
-        uint64_t time_accumulated;
-        bool started;
+        uint32_t id;
 
     public:
+        static const uint32_t kMaxTimers = 32;
+
         void Start();
         std::pair<uint64_t, uint64_t> Pause(bool record = false);
         void Reset();
         uint64_t Time();
 
-        Timer();
+        explicit Timer(uint32_t id);
         ~Timer() = default;
     };
 
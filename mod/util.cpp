@@ -43,21 +43,36 @@ namespace adgMod {
     int file_allowed_seek = 10;
     int level_allowed_seek = 1;
     float reference_frequency = 2.6;
-    bool block_num_entries_recorded = false;
+    std::atomic<bool> block_num_entries_recorded(false);
     bool level_learning_enabled = false;
     bool file_learning_enabled = true;
     bool load_level_model = true;
     bool load_file_model = true;
+    bool learned_merge = false;
+    bool learn_on_build = false;
+    bool compose_models = false;
+    bool level_entry_model = false;
+    int learn_workers = 1;
+    double learn_cpu_share = 1;
+    bool text_model = false;
+    bool eytzinger_search = true;
+    bool use_io_uring = false;
+    double vlog_gc_threshold = 0.5;
+    uint64_t vlog_segment_size = 16 * 1024 * 1024;
+    uint64_t vlog_gc_rate = 32 * 1024 * 1024;
+    uint32_t vlog_value_threshold = 0;
     uint64_t block_num_entries = 0;
     uint64_t block_size = 0;
     uint64_t entry_size = 0;
 
 
-    vector<Counter> levelled_counters(15);
+    vector<Counter> levelled_counters(17);
+    vector<LearnWorkerStats> learn_worker_stats;
     vector<vector<Event*>> events(3);
     leveldb::port::Mutex compaction_counter_mutex;
     leveldb::port::Mutex learn_counter_mutex;
     leveldb::port::Mutex file_stats_mutex;
+    static leveldb::port::Mutex block_layout_mutex;
     map<int, FileStats> file_stats;
 
     uint64_t ExtractInteger(const char* pos, size_t size) {
@@ -94,6 +109,16 @@ namespace adgMod {
         return std::move(result);
     }
 
+    void RecordBlockLayout(uint64_t num_entries, uint64_t entry_size, uint64_t block_size) {
+        if (block_num_entries_recorded.load(std::memory_order_acquire)) return;
+        leveldb::MutexLock l(&block_layout_mutex);
+        if (block_num_entries_recorded.load(std::memory_order_relaxed)) return;
+        adgMod::block_num_entries = num_entries;
+        adgMod::entry_size = entry_size;
+        adgMod::block_size = block_size;
+        block_num_entries_recorded.store(true, std::memory_order_release);
+    }
+
     uint64_t SliceToInteger(const Slice& slice) {
         const char* data = slice.data();
         size_t size = slice.size();
@@ -5,6 +5,7 @@
 #ifndef LEVELDB_UTIL_H
 #define LEVELDB_UTIL_H
 
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
@@ -71,7 +72,7 @@ namespace adgMod {
     extern int file_allowed_seek;
     extern int level_allowed_seek;
     extern float reference_frequency;
-    extern bool block_num_entries_recorded;
+    extern std::atomic<bool> block_num_entries_recorded;
 
     // enable online file learning -- default=false 
     extern bool level_learning_enabled;
@@ -81,6 +82,34 @@ namespace adgMod {
     extern bool load_level_model;
     // load offline-learned file models -- default=true
     extern bool load_file_model;
+    // use file models to skip key comparisons where compaction inputs do not interleave -- default=false
+    extern bool learned_merge;
+    // learn file models while their tables are built instead of reading new files back -- default=false
+    extern bool learn_on_build;
+    // give compaction outputs their model as they are built, reusing the segments of the input
+    // models for runs copied from one input -- default=false
+    extern bool compose_models;
+    // learn MOD 9 level models over every entry of the level, so that one prediction gives the
+    // file and the entries to read in it -- default=false
+    extern bool level_entry_model;
+    // number of threads learning file models, 0 means one per core -- default=1
+    extern int learn_workers;
+    // fraction of the machine's cores the learning workers may keep busy -- default=1
+    extern double learn_cpu_share;
+    // search model segments through the Eytzinger tree instead of a binary search -- default=true
+    extern bool eytzinger_search;
+    // write models in the old text format instead of the binary one -- default=false
+    extern bool text_model;
+    // read table files through io_uring instead of mmap, so batched lookups are in flight together -- default=false
+    extern bool use_io_uring;
+    // fraction of a value log segment that must be dead before it is collected, 0 disables collection -- default=0.5
+    extern double vlog_gc_threshold;
+    // size after which the value log starts a new segment file, the unit of collection -- default=16MB
+    extern uint64_t vlog_segment_size;
+    // bytes per second value log collection may read, 0 means unlimited -- default=32MB
+    extern uint64_t vlog_gc_rate;
+    // values shorter than this are kept in the LSM instead of the value log -- default=0
+    extern uint32_t vlog_value_threshold;
     
     // constants determined during the first offline learning following the load of DB
     extern uint64_t block_num_entries;
@@ -88,7 +117,10 @@ namespace adgMod {
     extern uint64_t entry_size;
 
     // runtime data collectors
+    class LearnWorkerStats;
     extern vector<Counter> levelled_counters;
+    // one per learning worker, sized when the workers start
+    extern vector<LearnWorkerStats> learn_worker_stats;
     extern vector<vector<Event*>> events;
     extern leveldb::port::Mutex compaction_counter_mutex;
     extern leveldb::port::Mutex learn_counter_mutex;
@@ -109,6 +141,23 @@ namespace adgMod {
     bool operator<=(const Slice& slice, const string& string);
     bool operator>=(const Slice& slice, const string& string);
     uint64_t get_time_difference(timespec start, timespec stop);
+    // record block_num_entries, entry_size and block_size from the first data block seen; later
+    // calls, possibly from other threads, have no effect
+    void RecordBlockLayout(uint64_t num_entries, uint64_t entry_size, uint64_t block_size);
+
+    // what a learning worker has done, updated by that worker only
+    class LearnWorkerStats {
+    public:
+        std::atomic<uint64_t> num_learned;
+        // micros spent learning, and sleeping to stay within learn_cpu_share
+        std::atomic<uint64_t> learn_time;
+        std::atomic<uint64_t> throttle_time;
+
+        LearnWorkerStats() : num_learned(0), learn_time(0), throttle_time(0) {};
+        void Report(int worker) const {
+            printf("LearnWorker %d %lu %lu %lu\n", worker, num_learned.load(), learn_time.load(), throttle_time.load());
+        }
+    };
 
     // data structure containing infomation for CBA
     class FileStats {
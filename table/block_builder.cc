@@ -40,7 +40,11 @@
 namespace leveldb {
 
 BlockBuilder::BlockBuilder(const Options* options)
-    : options_(options), restarts_(), counter_(0), finished_(false) {
+    : options_(options),
+      restarts_(),
+      counter_(0),
+      finished_(false),
+      shares_prefixes_(false) {
   assert(options->block_restart_interval >= 1);
   restarts_.push_back(0);  // First restart point is at offset 0
 }
@@ -51,6 +55,7 @@ void BlockBuilder::Reset() {
   restarts_.push_back(0);  // First restart point is at offset 0
   counter_ = 0;
   finished_ = false;
+  shares_prefixes_ = false;
   last_key_.clear();
 }
 
@@ -91,6 +96,7 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
     counter_ = 0;
   }
   const size_t non_shared = key.size() - shared;
+  if (shared > 0) shares_prefixes_ = true;
 
   // Add "<shared><non_shared><value_size>" to buffer_
   PutVarint32(&buffer_, shared);
@@ -38,15 +38,23 @@ class BlockBuilder {
   // we are building.
   size_t CurrentSizeEstimate() const;
 
+  // Returns the size of the entries added so far, without the restart array.
+  size_t EntriesSize() const { return buffer_.size(); }
+
   // Return true iff no entries have been added since the last Reset()
   bool empty() const { return buffer_.empty(); }
 
+  // Return true iff an entry added since the last Reset() dropped a prefix
+  // shared with the previous key, so it cannot be decoded on its own.
+  bool shares_prefixes() const { return shares_prefixes_; }
+
  private:
   const Options* options_;
   std::string buffer_;              // Destination buffer
   std::vector<uint32_t> restarts_;  // Restart points
   int counter_;                     // Number of entries emitted since restart
   bool finished_;                   // Has Finish() been called?
+  bool shares_prefixes_;
   std::string last_key_;
 };
 
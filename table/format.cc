@@ -28,6 +28,43 @@ Status BlockHandle::DecodeFrom(Slice* input) {
   }
 }
 
+void TableLayout::EncodeTo(std::string* dst) const {
+  PutVarint64(dst, entries_per_block_);
+  PutVarint64(dst, entry_stride_);
+  PutVarint64(dst, block_stride_);
+  PutVarint64(dst, restart_interval_);
+}
+
+Status TableLayout::DecodeFrom(Slice* input) {
+  if (GetVarint64(input, &entries_per_block_) &&
+      GetVarint64(input, &entry_stride_) &&
+      GetVarint64(input, &block_stride_)) {
+    // Layouts written before the restart interval was recorded end here
+    restart_interval_ = 0;
+    if (input->empty() || GetVarint64(input, &restart_interval_)) {
+      return Status::OK();
+    }
+  }
+  return Status::Corruption("bad table layout");
+}
+
+void EncodeIndexValue(const BlockHandle& handle, uint64_t first_entry,
+                      uint64_t num_entries, std::string* dst) {
+  handle.EncodeTo(dst);
+  PutVarint64(dst, first_entry);
+  PutVarint64(dst, num_entries);
+}
+
+Status DecodeIndexValue(Slice* input, BlockHandle* handle,
+                        uint64_t* first_entry, uint64_t* num_entries) {
+  Status s = handle->DecodeFrom(input);
+  if (s.ok() && !(GetVarint64(input, first_entry) &&
+                  GetVarint64(input, num_entries))) {
+    s = Status::Corruption("bad index value");
+  }
+  return s;
+}
+
 void Footer::EncodeTo(std::string* dst) const {
   const size_t original_size = dst->size();
   metaindex_handle_.EncodeTo(dst);
@@ -72,6 +72,79 @@ class Footer {
   BlockHandle index_handle_;
 };
 
+// TableLayout records the geometry of the data blocks of a table whose
+// entries all have the same encoded size, so that a learned lookup can go
+// from the position of an entry straight to its bytes: entry n lies in data
+// block n / entries_per_block, which starts at that index times block_stride,
+// at (n % entries_per_block) * entry_stride within it.  Every data block but
+// the last holds exactly entries_per_block entries and takes exactly
+// block_stride bytes on disk.  A table that does not fit this shape stores
+// zero for these three.
+//
+// Entries of varying size can still be located through the index: if
+// restart_interval is not zero, every data block is stored uncompressed,
+// every restart_interval-th entry of it is a restart point that can be
+// decoded on its own and so is every other entry, and the index value of each
+// block carries the position of its first entry and its number of entries.
+class TableLayout {
+ public:
+  // Maximum encoding length of a TableLayout
+  enum { kMaxEncodedLength = 4 * 10 };
+
+  TableLayout()
+      : entries_per_block_(0),
+        entry_stride_(0),
+        block_stride_(0),
+        restart_interval_(0) {}
+  TableLayout(uint64_t entries_per_block, uint64_t entry_stride,
+              uint64_t block_stride, uint64_t restart_interval)
+      : entries_per_block_(entries_per_block),
+        entry_stride_(entry_stride),
+        block_stride_(block_stride),
+        restart_interval_(restart_interval) {}
+
+  // False if the entries of the table cannot be located from the strides.
+  bool uniform() const { return entries_per_block_ != 0; }
+
+  // False if the entries of the table cannot be located through the index
+  // values and the restart arrays.
+  bool indexed() const { return restart_interval_ != 0; }
+
+  // Number of entries in every data block but the last.
+  uint64_t entries_per_block() const { return entries_per_block_; }
+
+  // Encoded size of every entry.
+  uint64_t entry_stride() const { return entry_stride_; }
+
+  // Size of every data block but the last on disk, trailer included.
+  uint64_t block_stride() const { return block_stride_; }
+
+  // Number of entries between restart points of the data blocks.
+  uint64_t restart_interval() const { return restart_interval_; }
+
+  void EncodeTo(std::string* dst) const;
+  Status DecodeFrom(Slice* input);
+
+ private:
+  uint64_t entries_per_block_;
+  uint64_t entry_stride_;
+  uint64_t block_stride_;
+  uint64_t restart_interval_;
+};
+
+// The value of an index block entry is the handle of a data block, followed
+// by the position of the block's first entry in the table and its number of
+// entries.  Readers that only want the handle decode it and ignore the rest.
+void EncodeIndexValue(const BlockHandle& handle, uint64_t first_entry,
+                      uint64_t num_entries, std::string* dst);
+
+// Fails on the index values of tables written without the entry counts.
+Status DecodeIndexValue(Slice* input, BlockHandle* handle,
+                        uint64_t* first_entry, uint64_t* num_entries);
+
+// Name of the meta block that holds the TableLayout of a table.
+static const char kTableLayoutMetaKey[] = "learned.layout";
+
 // kTableMagicNumber was picked by running
 //    echo http://code.google.com/p/leveldb/ | sha1sum
 // and taking the leading 64 bits.
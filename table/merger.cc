@@ -4,8 +4,12 @@
 
 #include "table/merger.h"
 
+#include <vector>
+
+#include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/iterator.h"
+#include "mod/learned_index.h"
 #include "table/iterator_wrapper.h"
 
 namespace leveldb {
@@ -54,55 +58,18 @@ class MergingIterator : public Iterator {
 
   virtual void Next() {
     assert(Valid());
-
-    // Ensure that all children are positioned after key().
-    // If we are moving in the forward direction, it is already
-    // true for all of the non-current_ children since current_ is
-    // the smallest child and key() == current_->key().  Otherwise,
-    // we explicitly position the non-current_ children.
     if (direction_ != kForward) {
-      for (int i = 0; i < n_; i++) {
-        IteratorWrapper* child = &children_[i];
-        if (child != current_) {
-          child->Seek(key());
-          if (child->Valid() &&
-              comparator_->Compare(key(), child->key()) == 0) {
-            child->Next();
-          }
-        }
-      }
-      direction_ = kForward;
+      SwitchToForward();
     }
-
     current_->Next();
     FindSmallest();
   }
 
   virtual void Prev() {
     assert(Valid());
-
-    // Ensure that all children are positioned before key().
-    // If we are moving in the reverse direction, it is already
-    // true for all of the non-current_ children since current_ is
-    // the largest child and key() == current_->key().  Otherwise,
-    // we explicitly position the non-current_ children.
     if (direction_ != kReverse) {
-      for (int i = 0; i < n_; i++) {
-        IteratorWrapper* child = &children_[i];
-        if (child != current_) {
-          child->Seek(key());
-          if (child->Valid()) {
-            // Child is at first entry >= key().  Step back one to be < key()
-            child->Prev();
-          } else {
-            // Child has no entries >= key().  Position at last entry.
-            child->SeekToLast();
-          }
-        }
-      }
-      direction_ = kReverse;
+      SwitchToReverse();
     }
-
     current_->Prev();
     FindLargest();
   }
@@ -128,16 +95,17 @@ class MergingIterator : public Iterator {
     return status;
   }
 
- private:
+ protected:
   // Which direction is the iterator moving?
   enum Direction { kForward, kReverse };
 
   void FindSmallest();
   void FindLargest();
+  void SwitchToForward();
+  void SwitchToReverse();
 
-  // We might want to use a heap in case there are lots of children.
-  // For now we use a simple array since we expect a very small number
-  // of children in leveldb.
+  // A simple array scan is cheapest for the small number of children leveldb
+  // usually merges.  TournamentMergingIterator below handles wide merges.
   const Comparator* comparator_;
   IteratorWrapper* children_;
   int n_;
@@ -174,6 +142,312 @@ void MergingIterator::FindLargest() {
   }
   current_ = largest;
 }
+
+void MergingIterator::SwitchToForward() {
+  // Ensure that all children are positioned after key().
+  // If we are moving in the forward direction, it is already
+  // true for all of the non-current_ children since current_ is
+  // the smallest child and key() == current_->key().  Otherwise,
+  // we explicitly position the non-current_ children.
+  for (int i = 0; i < n_; i++) {
+    IteratorWrapper* child = &children_[i];
+    if (child != current_) {
+      child->Seek(key());
+      if (child->Valid() && comparator_->Compare(key(), child->key()) == 0) {
+        child->Next();
+      }
+    }
+  }
+  direction_ = kForward;
+}
+
+void MergingIterator::SwitchToReverse() {
+  // Ensure that all children are positioned before key().
+  // If we are moving in the reverse direction, it is already
+  // true for all of the non-current_ children since current_ is
+  // the largest child and key() == current_->key().  Otherwise,
+  // we explicitly position the non-current_ children.
+  for (int i = 0; i < n_; i++) {
+    IteratorWrapper* child = &children_[i];
+    if (child != current_) {
+      child->Seek(key());
+      if (child->Valid()) {
+        // Child is at first entry >= key().  Step back one to be < key()
+        child->Prev();
+      } else {
+        // Child has no entries >= key().  Position at last entry.
+        child->SeekToLast();
+      }
+    }
+  }
+  direction_ = kReverse;
+}
+
+// A merge that keeps the children in a tournament tree (loser tree), so that
+// advancing takes O(log n) comparisons instead of the O(n) of the array scan.
+// Internal node i of tree_ holds the child that lost the match played there,
+// and tree_[0] holds the overall winner.  The leaf of child i is node n_ + i.
+// The tree orders children for the current direction_; it is rebuilt when the
+// direction changes or all children are repositioned.  Ties between equal
+// keys are broken like the array scan: the lowest index wins going forward
+// and the highest index wins in reverse.
+class TournamentMergingIterator : public MergingIterator {
+ public:
+  TournamentMergingIterator(const Comparator* comparator, Iterator** children,
+                            int n)
+      : MergingIterator(comparator, children, n), tree_(n, 0) {}
+
+  virtual void SeekToFirst() {
+    for (int i = 0; i < n_; i++) {
+      children_[i].SeekToFirst();
+    }
+    direction_ = kForward;
+    Build();
+  }
+
+  virtual void SeekToLast() {
+    for (int i = 0; i < n_; i++) {
+      children_[i].SeekToLast();
+    }
+    direction_ = kReverse;
+    Build();
+  }
+
+  virtual void Seek(const Slice& target) {
+    for (int i = 0; i < n_; i++) {
+      children_[i].Seek(target);
+    }
+    direction_ = kForward;
+    Build();
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    if (direction_ != kForward) {
+      SwitchToForward();
+      current_->Next();
+      Build();
+    } else {
+      current_->Next();
+      Replay();
+    }
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    if (direction_ != kReverse) {
+      SwitchToReverse();
+      current_->Prev();
+      Build();
+    } else {
+      current_->Prev();
+      Replay();
+    }
+  }
+
+ protected:
+  // Returns true if child a is yielded before child b in the current
+  // direction.  Exhausted children lose against everything.
+  bool Beats(int a, int b) const {
+    const IteratorWrapper& x = children_[a];
+    const IteratorWrapper& y = children_[b];
+    if (!x.Valid()) return false;
+    if (!y.Valid()) return true;
+    int r = comparator_->Compare(x.key(), y.key());
+    if (direction_ == kForward) {
+      return r < 0 || (r == 0 && a < b);
+    } else {
+      return r > 0 || (r == 0 && a > b);
+    }
+  }
+
+  void SetCurrent() {
+    IteratorWrapper* winner = &children_[tree_[0]];
+    current_ = winner->Valid() ? winner : nullptr;
+  }
+
+  // Plays every match bottom-up.  O(n) comparisons.
+  void Build() {
+    std::vector<int> winners(2 * n_);
+    for (int i = 0; i < n_; i++) {
+      winners[n_ + i] = i;
+    }
+    for (int node = n_ - 1; node >= 1; node--) {
+      int left = winners[2 * node];
+      int right = winners[2 * node + 1];
+      if (Beats(right, left)) {
+        winners[node] = right;
+        tree_[node] = left;
+      } else {
+        winners[node] = left;
+        tree_[node] = right;
+      }
+    }
+    tree_[0] = winners[1];
+    SetCurrent();
+  }
+
+  // Replays the matches on the path of the last winner, the only child that
+  // moved.  O(log n) comparisons.
+  void Replay() {
+    int winner = tree_[0];
+    for (int node = (n_ + winner) / 2; node >= 1; node /= 2) {
+      if (Beats(tree_[node], winner)) {
+        std::swap(tree_[node], winner);
+      }
+    }
+    tree_[0] = winner;
+    SetCurrent();
+  }
+
+  std::vector<int> tree_;
+};
+
+// A forward merge over single-table children that uses the learned model of
+// each table to avoid key comparisons.  When a child becomes the smallest, the
+// smallest key among the other children (the bound) is looked up in the model
+// of that child's table.  Entries the model guarantees to be smaller than the
+// bound cannot interleave with any other child, so they are yielded without
+// comparisons; past them, each entry is compared with the bound only.  The
+// children are kept in the tournament tree, whose runner-up, the bound, is the
+// best of the children that lost to the winner on its path.
+// Positions are tracked after SeekToFirst() and Seek(); reverse iteration
+// falls back to the plain merge.
+class LearnedMergingIterator : public TournamentMergingIterator,
+                               public MergeSource {
+ public:
+  LearnedMergingIterator(const Comparator* comparator, Iterator** children,
+                         adgMod::LearnedIndexData** models, int n, int level)
+      : TournamentMergingIterator(comparator, children, n),
+        models_(models, models + n),
+        positions_(n, 0),
+        tracking_(false),
+        bound_(-1),
+        run_(0),
+        skipped_(0),
+        level_(level) {}
+
+  virtual ~LearnedMergingIterator() {
+    adgMod::levelled_counters[15].Increment(level_, skipped_);
+  }
+
+  virtual void SeekToFirst() {
+    for (int i = 0; i < n_; i++) {
+      positions_[i] = 0;
+    }
+    tracking_ = true;
+    TournamentMergingIterator::SeekToFirst();
+    FindBound();
+  }
+
+  virtual void SeekToLast() {
+    tracking_ = false;
+    TournamentMergingIterator::SeekToLast();
+  }
+
+  // Each child that has entries both before and after target is walked from
+  // its first entry, to count the entries before target.  Children do not
+  // know their positions otherwise; a compaction split by key range has only
+  // the few tables its boundary cuts through to walk.
+  virtual void Seek(const Slice& target) {
+    for (int i = 0; i < n_; i++) {
+      IteratorWrapper* child = &children_[i];
+      positions_[i] = 0;
+      child->SeekToFirst();
+      if (!child->Valid() || comparator_->Compare(child->key(), target) >= 0) {
+        continue;
+      }
+      child->Seek(target);
+      if (!child->Valid()) continue;
+      child->SeekToFirst();
+      while (child->Valid() && comparator_->Compare(child->key(), target) < 0) {
+        child->Next();
+        ++positions_[i];
+      }
+    }
+    tracking_ = true;
+    direction_ = kForward;
+    Build();
+    FindBound();
+  }
+
+  virtual void Next() {
+    if (!tracking_ || direction_ != kForward) {
+      tracking_ = false;
+      TournamentMergingIterator::Next();
+      return;
+    }
+
+    const int index = current_ - children_;
+    current_->Next();
+    ++positions_[index];
+    if (current_->Valid()) {
+      if (run_ > 0) {
+        // Guaranteed by the model to be smaller than every other child
+        --run_;
+        ++skipped_;
+        return;
+      }
+      if (bound_ < 0 || Beats(index, bound_)) {
+        // No other child has entries left, or they all come later
+        return;
+      }
+    }
+    Replay();
+    FindBound();
+  }
+
+  virtual void Prev() {
+    tracking_ = false;
+    TournamentMergingIterator::Prev();
+  }
+
+  virtual bool CurrentSource(const adgMod::LearnedIndexData** model,
+                             uint64_t* position) const {
+    assert(Valid());
+    if (!tracking_) return false;
+    const int index = current_ - children_;
+    *model = models_[index];
+    *position = positions_[index];
+    return *model != nullptr;
+  }
+
+ private:
+  // Sets bound_ to the runner-up of the tree and run_ from the model of the
+  // winner.  O(log n) comparisons.
+  void FindBound();
+
+  std::vector<adgMod::LearnedIndexData*> models_;
+  // Index of the current entry of each child within its table
+  std::vector<uint64_t> positions_;
+  bool tracking_;
+  // Child holding the smallest key among all children except current_, or -1
+  int bound_;
+  // Number of following entries of current_ known to be smaller than bound_
+  uint64_t run_;
+  uint64_t skipped_;
+  int level_;
+};
+
+void LearnedMergingIterator::FindBound() {
+  bound_ = -1;
+  run_ = 0;
+  if (current_ == nullptr) return;
+  const int index = tree_[0];
+  for (int node = (n_ + index) / 2; node >= 1; node /= 2) {
+    if (bound_ < 0 || Beats(tree_[node], bound_)) bound_ = tree_[node];
+  }
+  if (bound_ >= 0 && !children_[bound_].Valid()) bound_ = -1;
+
+  if (bound_ < 0) return;
+  adgMod::LearnedIndexData* model = models_[index];
+  if (model == nullptr) return;
+  uint64_t below =
+      model->NumEntriesBelow(ExtractUserKey(children_[bound_].key()));
+  if (below > positions_[index] + 1) {
+    run_ = below - positions_[index] - 1;
+  }
+}
 }  // namespace
 
 Iterator* NewMergingIterator(const Comparator* comparator, Iterator** children,
@@ -183,8 +457,41 @@ Iterator* NewMergingIterator(const Comparator* comparator, Iterator** children,
     return NewEmptyIterator();
   } else if (n == 1) {
     return children[0];
-  } else {
+  } else if (n <= kMaxLinearMergeChildren) {
     return new MergingIterator(comparator, children, n);
+  } else {
+    return new TournamentMergingIterator(comparator, children, n);
+  }
+}
+
+Iterator* NewLinearMergingIterator(const Comparator* comparator,
+                                   Iterator** children, int n) {
+  assert(n >= 1);
+  return new MergingIterator(comparator, children, n);
+}
+
+Iterator* NewTournamentMergingIterator(const Comparator* comparator,
+                                       Iterator** children, int n) {
+  assert(n >= 1);
+  return new TournamentMergingIterator(comparator, children, n);
+}
+
+Iterator* NewLearnedMergingIterator(const Comparator* comparator,
+                                   Iterator** children,
+                                   adgMod::LearnedIndexData** models, int n,
+                                   int level, MergeSource** source) {
+  assert(n >= 0);
+  if (source != nullptr) *source = nullptr;
+  if (n == 0) {
+    return NewEmptyIterator();
+  } else if (n == 1 && source == nullptr) {
+    return children[0];
+  } else {
+    // A single child is still wrapped when the caller wants its positions
+    LearnedMergingIterator* result =
+        new LearnedMergingIterator(comparator, children, models, n, level);
+    if (source != nullptr) *source = result;
+    return result;
   }
 }
 
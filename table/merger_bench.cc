@@ -0,0 +1,169 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+// Microbenchmark of the ways MergingIterator picks the next child.
+//
+// Merges --num sorted keys spread over n children, for every n in
+// --children, once with the linear scan and once with the tournament tree,
+// and reports nanoseconds per yielded key.  With --reverse the merge is
+// scanned from the back.  Example:
+//
+//   ./merger_bench --num=2000000 --children=2,4,8,16,32,64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "table/merger.h"
+#include "util/random.h"
+
+// Number of keys merged per run
+static int FLAGS_num = 1000000;
+
+// Comma-separated list of child counts
+static const char* FLAGS_children = "2,3,4,6,8,16,32,64";
+
+// Number of repetitions per configuration; the fastest one is reported
+static int FLAGS_repeats = 3;
+
+// Scan with Prev() instead of Next()
+static bool FLAGS_reverse = false;
+
+namespace leveldb {
+
+namespace {
+
+// Iterator over a sorted in-memory array of keys.
+class ArrayIterator : public Iterator {
+ public:
+  explicit ArrayIterator(const std::vector<std::string>* keys)
+      : keys_(keys), index_(keys->size()) {}
+
+  virtual bool Valid() const { return index_ < keys_->size(); }
+  virtual void SeekToFirst() { index_ = 0; }
+  virtual void SeekToLast() {
+    index_ = keys_->empty() ? keys_->size() : keys_->size() - 1;
+  }
+  virtual void Seek(const Slice& target) {
+    index_ = std::lower_bound(keys_->begin(), keys_->end(), target.ToString()) -
+             keys_->begin();
+  }
+  virtual void Next() { index_++; }
+  virtual void Prev() {
+    index_ = index_ == 0 ? keys_->size() : index_ - 1;
+  }
+  virtual Slice key() const { return (*keys_)[index_]; }
+  virtual Slice value() const { return Slice(); }
+  virtual Status status() const { return Status::OK(); }
+
+ private:
+  const std::vector<std::string>* keys_;
+  size_t index_;
+};
+
+// Spreads FLAGS_num random 16-byte keys over n sorted runs.
+void MakeRuns(int n, std::vector<std::vector<std::string>>* runs) {
+  Random rnd(301);
+  runs->assign(n, std::vector<std::string>());
+  char buf[32];
+  for (int i = 0; i < FLAGS_num; i++) {
+    snprintf(buf, sizeof(buf), "%016d", i);
+    (*runs)[rnd.Uniform(n)].push_back(buf);
+  }
+}
+
+double RunOnce(bool tournament,
+               const std::vector<std::vector<std::string>>& runs,
+               uint64_t* yielded) {
+  const int n = runs.size();
+  std::vector<Iterator*> children;
+  for (int i = 0; i < n; i++) {
+    children.push_back(new ArrayIterator(&runs[i]));
+  }
+  const Comparator* cmp = BytewiseComparator();
+  Iterator* iter =
+      tournament ? NewTournamentMergingIterator(cmp, children.data(), n)
+                 : NewLinearMergingIterator(cmp, children.data(), n);
+
+  uint64_t count = 0;
+  const uint64_t start = Env::Default()->NowMicros();
+  if (FLAGS_reverse) {
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) count++;
+  } else {
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) count++;
+  }
+  const uint64_t micros = Env::Default()->NowMicros() - start;
+  delete iter;
+
+  *yielded = count;
+  return micros * 1000.0 / std::max<uint64_t>(count, 1);
+}
+
+void Run() {
+  std::vector<int> widths;
+  const char* p = FLAGS_children;
+  while (*p != '\0') {
+    widths.push_back(atoi(p));
+    while (*p != '\0' && *p != ',') p++;
+    if (*p == ',') p++;
+  }
+
+  fprintf(stdout, "Keys:       %d\n", FLAGS_num);
+  fprintf(stdout, "Direction:  %s\n", FLAGS_reverse ? "reverse" : "forward");
+  fprintf(stdout, "%-10s %14s %18s\n", "children", "linear ns/key",
+          "tournament ns/key");
+  for (int n : widths) {
+    if (n < 1) continue;
+    std::vector<std::vector<std::string>> runs;
+    MakeRuns(n, &runs);
+    double best[2] = {0, 0};
+    for (int t = 0; t < 2; t++) {
+      for (int r = 0; r < FLAGS_repeats; r++) {
+        uint64_t yielded;
+        double ns = RunOnce(t == 1, runs, &yielded);
+        if (yielded != static_cast<uint64_t>(FLAGS_num)) {
+          fprintf(stderr, "merge yielded %llu keys, expected %d\n",
+                  static_cast<unsigned long long>(yielded), FLAGS_num);
+          exit(1);
+        }
+        if (r == 0 || ns < best[t]) best[t] = ns;
+      }
+    }
+    fprintf(stdout, "%-10d %14.1f %18.1f\n", n, best[0], best[1]);
+  }
+}
+
+}  // namespace
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--repeats=%d%c", &n, &junk) == 1) {
+      FLAGS_repeats = n;
+    } else if (sscanf(argv[i], "--reverse=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_reverse = n;
+    } else if (strncmp(argv[i], "--children=", 11) == 0) {
+      FLAGS_children = argv[i] + 11;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  leveldb::Run();
+  return 0;
+}
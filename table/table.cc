@@ -66,6 +66,7 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = nullptr;
     rep->filter = nullptr;
+    rep->has_layout = false;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   }
@@ -74,10 +75,6 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
 }
 
 void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == nullptr) {
-    return;  // Do not need any metadata
-  }
-
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
   ReadOptions opt;
@@ -92,11 +89,17 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  if (rep_->options.filter_policy != nullptr) {
+    std::string key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value());
+    }
+  }
+  iter->Seek(kTableLayoutMetaKey);
+  if (iter->Valid() && iter->key() == Slice(kTableLayoutMetaKey)) {
+    ReadLayout(iter->value());
   }
   delete iter;
   delete meta;
@@ -125,6 +128,36 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
 }
 
+void Table::ReadLayout(const Slice& layout_handle_value) {
+  Slice v = layout_handle_value;
+  BlockHandle layout_handle;
+  if (!layout_handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  ReadOptions opt;
+  if (rep_->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, layout_handle, &block).ok()) {
+    return;
+  }
+  Slice input = block.data;
+  rep_->has_layout = rep_->layout.DecodeFrom(&input).ok();
+  if (block.heap_allocated) {
+    delete[] block.data.data();
+  }
+}
+
+TableLayout Table::Layout() const {
+  if (rep_->has_layout) {
+    return rep_->layout;
+  }
+  return TableLayout(adgMod::block_num_entries, adgMod::entry_size,
+                     adgMod::block_size, 0);
+}
+
 Table::~Table() { delete rep_; }
 
 static void DeleteBlock(void* arg, void* ignored) {
@@ -311,18 +344,16 @@ void Table::FillData(const ReadOptions& options, adgMod::LearnedIndexData* data)
     int num_entries_this_block = 0;
     for (block_iter->SeekToRestartPoint(0); block_iter->ParseNextKey(); ++num_entries_this_block) {
         ParseInternalKey(block_iter->key(), &parsed_key);
-        data->string_keys.emplace_back(parsed_key.user_key.data(), parsed_key.user_key.size());
+        data->keys.push_back(adgMod::SliceToInteger(parsed_key.user_key));
     }
     //num_points += num_entries_this_block;
 
-    if (!adgMod::block_num_entries_recorded) {
-        adgMod::block_num_entries = num_entries_this_block;
-        adgMod::block_num_entries_recorded = true;
-        adgMod::entry_size = block_iter->restarts_ / num_entries_this_block;
+    if (!adgMod::block_num_entries_recorded.load(std::memory_order_acquire)) {
         BlockHandle temp;
         Slice temp_slice = index_iter->value();
         temp.DecodeFrom(&temp_slice);
-        adgMod::block_size = temp.size() + kBlockTrailerSize;
+        adgMod::RecordBlockLayout(num_entries_this_block, block_iter->restarts_ / num_entries_this_block,
+                                  temp.size() + kBlockTrailerSize);
     }
 
     uint64_t current_total = data->num_entries_accumulated.NumEntries();
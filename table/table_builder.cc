@@ -6,6 +6,7 @@
 
 #include <assert.h>
 
+#include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
@@ -15,6 +16,7 @@
 #include "table/format.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "mod/learned_index.h"
 
 namespace leveldb {
 
@@ -31,10 +33,22 @@ struct TableBuilder::Rep {
         filter_block(opt.filter_policy == nullptr
                          ? nullptr
                          : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        pending_first_entry(0),
+        pending_num_entries(0),
+        block_entries(0),
+        layout_entries_per_block(0),
+        layout_entry_stride(0),
+        layout_block_stride(0),
+        layout_uniform(true),
+        layout_short_block(false),
+        layout_indexed(true),
+        model_builder(nullptr) {
     index_block_options.block_restart_interval = 1;
   }
 
+  ~Rep() { delete model_builder; }
+
   Options options;
   Options index_block_options;
   WritableFile* file;
@@ -58,8 +72,26 @@ struct TableBuilder::Rep {
   // Invariant: r->pending_index_entry is true only if data_block is empty.
   bool pending_index_entry;
   BlockHandle pending_handle;  // Handle to add to index block
+  uint64_t pending_first_entry;  // Position of its first entry in the table
+  uint64_t pending_num_entries;  // Number of entries in it
 
   std::string compressed_output;
+
+  // Number of entries in data_block
+  uint64_t block_entries;
+
+  // The TableLayout taken from the first entry and the first data block,
+  // and whether everything written since has kept to it.  A block with
+  // fewer entries is allowed only as the last one.
+  uint64_t layout_entries_per_block;
+  uint64_t layout_entry_stride;
+  uint64_t layout_block_stride;
+  bool layout_uniform;
+  bool layout_short_block;
+  // False once a data block cannot be searched through its restart array
+  bool layout_indexed;
+  // Learns the file model of this table as keys are added, if requested
+  adgMod::FileModelBuilder* model_builder;
 };
 
 TableBuilder::TableBuilder(const Options& options, WritableFile* file)
@@ -75,6 +107,13 @@ TableBuilder::~TableBuilder() {
   delete rep_;
 }
 
+void TableBuilder::TrainModel(adgMod::LearnedIndexData* data) {
+  Rep* r = rep_;
+  assert(r->num_entries == 0);
+  delete r->model_builder;
+  r->model_builder = new adgMod::FileModelBuilder(data);
+}
+
 Status TableBuilder::ChangeOptions(const Options& options) {
   // Note: if more fields are added to Options, update
   // this function to catch changes that should not be allowed to
@@ -92,6 +131,12 @@ Status TableBuilder::ChangeOptions(const Options& options) {
 }
 
 void TableBuilder::Add(const Slice& key, const Slice& value) {
+  Add(key, value, nullptr, 0);
+}
+
+void TableBuilder::Add(const Slice& key, const Slice& value,
+                       const adgMod::LearnedIndexData* source,
+                       uint64_t source_position) {
   Rep* r = rep_;
   assert(!r->closed);
   if (!ok()) return;
@@ -103,7 +148,8 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     assert(r->data_block.empty());
     //r->options.comparator->FindShortestSeparator(&r->last_key, key);
     std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
+    EncodeIndexValue(r->pending_handle, r->pending_first_entry,
+                     r->pending_num_entries, &handle_encoding);
     r->index_block.Add(r->last_key, Slice(handle_encoding));
     r->pending_index_entry = false;
   }
@@ -114,7 +160,18 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
+  r->block_entries++;
+  const size_t entries_size = r->data_block.EntriesSize();
   r->data_block.Add(key, value);
+  const uint64_t entry_size = r->data_block.EntriesSize() - entries_size;
+  if (r->layout_entry_stride == 0) {
+    r->layout_entry_stride = entry_size;
+  } else if (entry_size != r->layout_entry_stride) {
+    r->layout_uniform = false;
+  }
+  if (r->model_builder != nullptr) {
+    r->model_builder->Add(ExtractUserKey(key), source, source_position);
+  }
 
   const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
   if (estimated_block_size >= r->options.block_size) {
@@ -128,16 +185,52 @@ void TableBuilder::Flush() {
   if (!ok()) return;
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  const uint64_t entries_size = r->data_block.EntriesSize();
+  const uint64_t raw_size = r->data_block.CurrentSizeEstimate();
+  if (r->data_block.shares_prefixes()) {
+    r->layout_indexed = false;
+  }
+  r->pending_first_entry = r->num_entries - r->block_entries;
+  r->pending_num_entries = r->block_entries;
   WriteBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
     r->status = r->file->Flush();
   }
+  if (ok()) {
+    UpdateLayout(raw_size);
+  }
+  if (ok() && r->model_builder != nullptr) {
+    r->model_builder->FinishBlock(
+        ExtractUserKey(r->last_key), r->block_entries, entries_size,
+        r->pending_handle.size() + kBlockTrailerSize);
+  }
+  r->block_entries = 0;
   if (r->filter_block != nullptr) {
     r->filter_block->StartBlock(r->offset);
   }
 }
 
+void TableBuilder::UpdateLayout(uint64_t raw_size) {
+  Rep* r = rep_;
+  const uint64_t block_stride = r->pending_handle.size() + kBlockTrailerSize;
+  if (r->pending_handle.size() != raw_size) {
+    // Entries cannot be located in a compressed block
+    r->layout_uniform = false;
+    r->layout_indexed = false;
+  } else if (r->layout_short_block) {
+    r->layout_uniform = false;
+  } else if (r->layout_entries_per_block == 0) {
+    r->layout_entries_per_block = r->block_entries;
+    r->layout_block_stride = block_stride;
+  } else if (r->block_entries < r->layout_entries_per_block) {
+    r->layout_short_block = true;
+  } else if (r->block_entries != r->layout_entries_per_block ||
+             block_stride != r->layout_block_stride) {
+    r->layout_uniform = false;
+  }
+}
+
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
@@ -201,7 +294,8 @@ Status TableBuilder::Finish() {
   assert(!r->closed);
   r->closed = true;
 
-  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle,
+      layout_block_handle;
 
   // Write filter block
   if (ok() && r->filter_block != nullptr) {
@@ -209,6 +303,20 @@ Status TableBuilder::Finish() {
                   &filter_block_handle);
   }
 
+  // Write layout block
+  if (ok()) {
+    const uint64_t restart_interval =
+        r->layout_indexed ? r->options.block_restart_interval : 0;
+    TableLayout layout(0, 0, 0, restart_interval);
+    if (r->layout_uniform && r->layout_entries_per_block != 0) {
+      layout = TableLayout(r->layout_entries_per_block, r->layout_entry_stride,
+                           r->layout_block_stride, restart_interval);
+    }
+    std::string layout_encoding;
+    layout.EncodeTo(&layout_encoding);
+    WriteRawBlock(layout_encoding, kNoCompression, &layout_block_handle);
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
@@ -220,6 +328,10 @@ Status TableBuilder::Finish() {
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    // "filter." sorts before this, so keys stay in order
+    std::string handle_encoding;
+    layout_block_handle.EncodeTo(&handle_encoding);
+    meta_index_block.Add(kTableLayoutMetaKey, handle_encoding);
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -230,7 +342,8 @@ Status TableBuilder::Finish() {
     if (r->pending_index_entry) {
       //r->options.comparator->FindShortSuccessor(&r->last_key);
       std::string handle_encoding;
-      r->pending_handle.EncodeTo(&handle_encoding);
+      EncodeIndexValue(r->pending_handle, r->pending_first_entry,
+                       r->pending_num_entries, &handle_encoding);
       r->index_block.Add(r->last_key, Slice(handle_encoding));
       r->pending_index_entry = false;
     }
@@ -249,6 +362,10 @@ Status TableBuilder::Finish() {
       r->offset += footer_encoding.size();
     }
   }
+
+  if (ok() && r->model_builder != nullptr) {
+    r->model_builder->Finish();
+  }
   return r->status;
 }
 
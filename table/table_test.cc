@@ -4,19 +4,28 @@
 
 #include "leveldb/table.h"
 
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "db/dbformat.h"
 #include "db/memtable.h"
+#include "db/table_cache.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
+#include "mod/learned_index.h"
+#include "mod/util.h"
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "table/merger.h"
+#include "util/logging.h"
 #include "util/random.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
@@ -241,6 +250,11 @@ class TableConstructor : public Constructor {
     return table_->ApproximateOffsetOf(key);
   }
 
+  TableLayout Layout() const { return table_->Layout(); }
+
+  Table* table() const { return table_; }
+  RandomAccessFile* file() const { return source_; }
+
  private:
   void Reset() {
     delete table_;
@@ -787,12 +801,169 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 610000, 612000));
 }
 
+static std::string LayoutKey(int i) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "k%05d", i);
+  return buf;
+}
+
+TEST(TableTest, LayoutUniform) {
+  TableConstructor c(BytewiseComparator());
+  const int kNumEntries = 1000;
+  for (int i = 0; i < kNumEntries; i++) {
+    c.Add(LayoutKey(i), std::string(20, 'v'));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  TableLayout layout = c.Layout();
+  ASSERT_TRUE(layout.uniform());
+  // Three one-byte varints, the key and the value
+  ASSERT_EQ(3 + 6 + 20, layout.entry_stride());
+  ASSERT_GT(layout.entries_per_block(), 1);
+  ASSERT_LT(layout.entries_per_block(), kNumEntries);
+  for (int i = 0; i < kNumEntries; i += 37) {
+    ASSERT_EQ((i / layout.entries_per_block()) * layout.block_stride(),
+              c.ApproximateOffsetOf(LayoutKey(i)));
+  }
+}
+
+TEST(TableTest, LayoutNotUniform) {
+  TableConstructor c(BytewiseComparator());
+  for (int i = 0; i < 1000; i++) {
+    c.Add(LayoutKey(i), std::string(20 + i % 3, 'v'));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  // Entries vary in size but are still found through the restart array
+  TableLayout layout = c.Layout();
+  ASSERT_TRUE(!layout.uniform());
+  ASSERT_TRUE(layout.indexed());
+  ASSERT_EQ(options.block_restart_interval, layout.restart_interval());
+}
+
+static void SaveIndexedRead(void* arg, const Slice& key, const Slice& value) {
+  std::pair<std::string, std::string>* found =
+      reinterpret_cast<std::pair<std::string, std::string>*>(arg);
+  found->first = key.ToString();
+  found->second = value.ToString();
+}
+
+TEST(TableTest, IndexValue) {
+  BlockHandle handle;
+  handle.set_offset(123456789);
+  handle.set_size(4096);
+  std::string encoding;
+  EncodeIndexValue(handle, 1ull << 40, 37, &encoding);
+
+  Slice input(encoding);
+  BlockHandle decoded;
+  uint64_t first_entry, num_entries;
+  ASSERT_OK(DecodeIndexValue(&input, &decoded, &first_entry, &num_entries));
+  ASSERT_EQ(handle.offset(), decoded.offset());
+  ASSERT_EQ(handle.size(), decoded.size());
+  ASSERT_EQ(1ull << 40, first_entry);
+  ASSERT_EQ(37, num_entries);
+  ASSERT_TRUE(input.empty());
+
+  // the index values of tables written before the entry counts
+  std::string handle_only;
+  handle.EncodeTo(&handle_only);
+  input = handle_only;
+  ASSERT_TRUE(DecodeIndexValue(&input, &decoded, &first_entry, &num_entries)
+                  .IsCorruption());
+}
+
+TEST(TableTest, IndexedRead) {
+  TableConstructor c(BytewiseComparator());
+  const int kNumEntries = 1000;
+  for (int i = 0; i < kNumEntries; i++) {
+    c.Add(LayoutKey(i), std::string(20 + i % 3, 'a' + i % 26));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  // no filter, so that keys outside the table reach the block search
+  options.filter_policy = nullptr;
+  c.Finish(options, &keys, &kvmap);
+  TableLayout layout = c.Layout();
+  ASSERT_TRUE(!layout.uniform());
+  ASSERT_TRUE(layout.indexed());
+
+  // every key, from intervals around its position that span block boundaries
+  const int kError = 40;
+  for (int i = 0; i < kNumEntries; i++) {
+    std::pair<std::string, std::string> found;
+    const uint64_t lower = i < kError ? 0 : i - kError;
+    const uint64_t upper = std::min(i + kError, kNumEntries - 1);
+    ASSERT_TRUE(TableCache::IndexedRead(c.table(), c.file(), layout,
+                                        LayoutKey(i), lower, upper, &found,
+                                        SaveIndexedRead));
+    ASSERT_EQ(LayoutKey(i), found.first);
+    ASSERT_EQ(kvmap[LayoutKey(i)], found.second);
+
+    // the exact position
+    found.first.clear();
+    ASSERT_TRUE(TableCache::IndexedRead(c.table(), c.file(), layout,
+                                        LayoutKey(i), i, i, &found,
+                                        SaveIndexedRead));
+    ASSERT_EQ(LayoutKey(i), found.first);
+  }
+
+  // a key before the first block finds the first entry
+  std::pair<std::string, std::string> found;
+  ASSERT_TRUE(TableCache::IndexedRead(c.table(), c.file(), layout, "a", 0,
+                                      kError, &found, SaveIndexedRead));
+  ASSERT_EQ(LayoutKey(0), found.first);
+
+  // a key after the last block finds nothing
+  found.first.clear();
+  ASSERT_TRUE(TableCache::IndexedRead(c.table(), c.file(), layout, "z",
+                                      kNumEntries - 1 - kError,
+                                      kNumEntries - 1, &found,
+                                      SaveIndexedRead));
+  ASSERT_TRUE(found.first.empty());
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
   return port::Snappy_Compress(in.data(), in.size(), &out);
 }
 
+TEST(TableTest, LayoutCompressed) {
+  if (!SnappyCompressionSupported()) {
+    fprintf(stderr, "skipping compression tests\n");
+    return;
+  }
+
+  TableConstructor c(BytewiseComparator());
+  for (int i = 0; i < 1000; i++) {
+    c.Add(LayoutKey(i), std::string(20, 'v'));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kSnappyCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  // Entries cannot be located inside compressed blocks
+  ASSERT_TRUE(!c.Layout().uniform());
+  ASSERT_TRUE(!c.Layout().indexed());
+}
+
 TEST(TableTest, ApproximateOffsetOfCompressed) {
   if (!SnappyCompressionSupported()) {
     fprintf(stderr, "skipping compression tests\n");
@@ -829,6 +1000,301 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
 }
 
+// Iterator over a sorted array of key/value pairs.
+class KVArrayIterator : public Iterator {
+ public:
+  explicit KVArrayIterator(
+      const std::vector<std::pair<std::string, std::string>>* data)
+      : data_(data), index_(data->size()) {}
+
+  virtual bool Valid() const { return index_ < data_->size(); }
+  virtual void SeekToFirst() { index_ = 0; }
+  virtual void SeekToLast() {
+    index_ = data_->empty() ? data_->size() : data_->size() - 1;
+  }
+  virtual void Seek(const Slice& target) {
+    index_ = 0;
+    while (index_ < data_->size() &&
+           Slice((*data_)[index_].first).compare(target) < 0) {
+      index_++;
+    }
+  }
+  virtual void Next() { index_++; }
+  virtual void Prev() { index_ = index_ == 0 ? data_->size() : index_ - 1; }
+  virtual Slice key() const { return (*data_)[index_].first; }
+  virtual Slice value() const { return (*data_)[index_].second; }
+  virtual Status status() const { return Status::OK(); }
+
+ private:
+  const std::vector<std::pair<std::string, std::string>>* data_;
+  size_t index_;
+};
+
+class MergerTest {};
+
+// The tournament tree must yield exactly what the linear scan yields,
+// including the order of equal keys, across direction switches.
+TEST(MergerTest, TournamentMatchesLinear) {
+  Random rnd(test::RandomSeed());
+  for (int n : {1, 2, 3, 5, 8, 13, 33}) {
+    std::vector<std::vector<std::pair<std::string, std::string>>> runs(n);
+    for (int i = 0; i < n; i++) {
+      const int entries = rnd.Uniform(50);
+      std::set<std::string> keys;
+      for (int j = 0; j < entries; j++) {
+        keys.insert(test::RandomKey(&rnd, 1 + rnd.Uniform(2)));
+      }
+      for (const std::string& key : keys) {
+        runs[i].push_back(std::make_pair(key, NumberToString(i)));
+      }
+    }
+
+    std::vector<Iterator*> linear_children, tournament_children;
+    for (int i = 0; i < n; i++) {
+      linear_children.push_back(new KVArrayIterator(&runs[i]));
+      tournament_children.push_back(new KVArrayIterator(&runs[i]));
+    }
+    Iterator* linear = NewLinearMergingIterator(BytewiseComparator(),
+                                                linear_children.data(), n);
+    Iterator* tournament = NewTournamentMergingIterator(
+        BytewiseComparator(), tournament_children.data(), n);
+
+    for (int step = 0; step < 1000; step++) {
+      const int op = rnd.Uniform(5);
+      if (!linear->Valid() || op == 0) {
+        switch (rnd.Uniform(3)) {
+          case 0:
+            linear->SeekToFirst();
+            tournament->SeekToFirst();
+            break;
+          case 1:
+            linear->SeekToLast();
+            tournament->SeekToLast();
+            break;
+          default: {
+            std::string target = test::RandomKey(&rnd, 1 + rnd.Uniform(2));
+            linear->Seek(target);
+            tournament->Seek(target);
+            break;
+          }
+        }
+      } else if (op <= 2) {
+        linear->Next();
+        tournament->Next();
+      } else {
+        linear->Prev();
+        tournament->Prev();
+      }
+      ASSERT_EQ(linear->Valid(), tournament->Valid());
+      if (linear->Valid()) {
+        ASSERT_EQ(linear->key().ToString(), tournament->key().ToString());
+        ASSERT_EQ(linear->value().ToString(), tournament->value().ToString());
+      }
+    }
+    delete linear;
+    delete tournament;
+  }
+}
+
+static std::string MergerKey(int k) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%06d", k);
+  return std::string(buf);
+}
+
+TEST(MergerTest, TournamentYieldsAllKeysInOrder) {
+  const int n = 16;
+  std::vector<std::vector<std::pair<std::string, std::string>>> runs(n);
+  for (int k = 0; k < 1000; k++) {
+    runs[(k * 7) % n].push_back(std::make_pair(MergerKey(k), std::string()));
+  }
+  std::vector<Iterator*> children;
+  for (int i = 0; i < n; i++) {
+    children.push_back(new KVArrayIterator(&runs[i]));
+  }
+  Iterator* iter = NewMergingIterator(BytewiseComparator(), children.data(), n);
+  int k = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(MergerKey(k), iter->key().ToString());
+    k++;
+  }
+  ASSERT_EQ(1000, k);
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    k--;
+    ASSERT_EQ(MergerKey(k), iter->key().ToString());
+  }
+  ASSERT_EQ(0, k);
+  delete iter;
+}
+
+// Merges on both sides of kMaxLinearMergeChildren yield every key in order,
+// equal keys in the order of their children.
+TEST(MergerTest, OrderAroundLinearThreshold) {
+  for (int n : {5, kMaxLinearMergeChildren, kMaxLinearMergeChildren + 1, 9}) {
+    std::vector<std::vector<std::pair<std::string, std::string>>> runs(n);
+    int total = 0;
+    for (int k = 0; k < 200; k++) {
+      // key k is in children k % n and, for every third key, the ones after
+      for (int i = k % n; i < n && (i == k % n || k % 3 == 0); i++) {
+        runs[i].push_back(std::make_pair(MergerKey(k), NumberToString(i)));
+        total++;
+      }
+    }
+    std::vector<Iterator*> children;
+    for (int i = 0; i < n; i++) {
+      children.push_back(new KVArrayIterator(&runs[i]));
+    }
+    Iterator* iter =
+        NewMergingIterator(BytewiseComparator(), children.data(), n);
+    int count = 0;
+    std::string last_key, last_child;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      const std::string key = iter->key().ToString();
+      const std::string child = iter->value().ToString();
+      if (count > 0) {
+        ASSERT_LE(last_key, key);
+        if (key == last_key) {
+          ASSERT_LT(std::stoi(last_child), std::stoi(child));
+        }
+      }
+      last_key = key;
+      last_child = child;
+      count++;
+    }
+    ASSERT_EQ(total, count);
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      const std::string key = iter->key().ToString();
+      if (count < total) ASSERT_GE(last_key, key);
+      last_key = key;
+      count--;
+    }
+    ASSERT_EQ(0, count);
+    delete iter;
+  }
+}
+
+// A table of internal keys with the file model learned while it was built
+class LearnedTable {
+ public:
+  LearnedTable(const InternalKeyComparator* icmp,
+               const std::vector<std::pair<std::string, std::string>>& data)
+      : model_(0, false), source_(nullptr), table_(nullptr) {
+    Options options;
+    options.comparator = icmp;
+    options.block_size = 256;
+    StringSink sink;
+    TableBuilder builder(options, &sink);
+    builder.TrainModel(&model_);
+    for (const auto& entry : data) builder.Add(entry.first, entry.second);
+    ASSERT_OK(builder.Finish());
+    source_ = new StringSource(sink.contents());
+    ASSERT_OK(Table::Open(options, source_, sink.contents().size(), &table_));
+  }
+
+  ~LearnedTable() {
+    delete table_;
+    delete source_;
+  }
+
+  Iterator* NewIterator() const { return table_->NewIterator(ReadOptions()); }
+  adgMod::LearnedIndexData* model() { return &model_; }
+
+ private:
+  adgMod::LearnedIndexData model_;
+  StringSource* source_;
+  Table* table_;
+};
+
+// A learned merge over tables with their file models yields what the plain
+// merge yields, including user keys in several tables and several times in a
+// table, and reports the table and position of every entry, from the first
+// entry or from a seek.
+TEST(MergerTest, LearnedMatchesPlain) {
+  InternalKeyComparator icmp(BytewiseComparator());
+  Random rnd(301);
+  int skipped = adgMod::levelled_counters[15].Sum();
+  for (int trial = 0; trial < 40; trial++) {
+    const int n = 1 + rnd.Uniform(12);
+    std::vector<std::vector<std::pair<std::string, std::string>>> runs(n);
+    SequenceNumber sequence = 1;
+    for (int k = 0, owner = 0; k < 20000;) {
+      // runs of all lengths, so that some are skipped and some interleave
+      owner = rnd.Uniform(n);
+      for (int length = 1 + (rnd.OneIn(3) ? rnd.Uniform(2000) : rnd.Uniform(5));
+           length > 0 && k < 20000; length--, k++) {
+        const std::string user_key = MergerKey(10 * k);
+        runs[owner].push_back(std::make_pair(
+            InternalKey(user_key, sequence++, kTypeValue).Encode().ToString(),
+            NumberToString(owner)));
+        // the same user key in another table, or again in this one
+        if (rnd.OneIn(20)) {
+          const int other = rnd.Uniform(n);
+          runs[other].push_back(std::make_pair(
+              InternalKey(user_key, sequence++, kTypeValue).Encode().ToString(),
+              NumberToString(other)));
+        }
+      }
+    }
+    std::vector<std::unique_ptr<LearnedTable>> tables;
+    std::vector<Iterator*> plain_children, learned_children;
+    std::vector<adgMod::LearnedIndexData*> models;
+    for (int i = 0; i < n; i++) {
+      std::sort(runs[i].begin(), runs[i].end(),
+                [&](const std::pair<std::string, std::string>& a,
+                    const std::pair<std::string, std::string>& b) {
+                  return icmp.Compare(a.first, b.first) < 0;
+                });
+      tables.emplace_back(new LearnedTable(&icmp, runs[i]));
+      plain_children.push_back(tables[i]->NewIterator());
+      learned_children.push_back(tables[i]->NewIterator());
+      // some tables are not learned
+      models.push_back(runs[i].empty() || rnd.OneIn(5) ? nullptr
+                                                       : tables[i]->model());
+    }
+
+    Iterator* plain = NewMergingIterator(&icmp, plain_children.data(), n);
+    MergeSource* source;
+    Iterator* learned = NewLearnedMergingIterator(
+        &icmp, learned_children.data(), models.data(), n, 1, &source);
+    ASSERT_TRUE(source != nullptr);
+    // from the first entry, then from targets as a compaction split by key
+    // range starts its ranges
+    for (int seek = 0; seek < 4; seek++) {
+      if (seek == 0) {
+        plain->SeekToFirst();
+        learned->SeekToFirst();
+      } else {
+        const std::string target =
+            InternalKey(MergerKey(rnd.Uniform(200010)), kMaxSequenceNumber,
+                        kValueTypeForSeek)
+                .Encode()
+                .ToString();
+        plain->Seek(target);
+        learned->Seek(target);
+      }
+      for (; plain->Valid(); plain->Next(), learned->Next()) {
+        ASSERT_TRUE(learned->Valid());
+        ASSERT_EQ(plain->key().ToString(), learned->key().ToString());
+        ASSERT_EQ(plain->value().ToString(), learned->value().ToString());
+        const int owner = std::stoi(learned->value().ToString());
+        const adgMod::LearnedIndexData* model;
+        uint64_t position;
+        if (source->CurrentSource(&model, &position)) {
+          ASSERT_TRUE(model == models[owner]);
+          ASSERT_LT(position, runs[owner].size());
+          ASSERT_EQ(runs[owner][position].first, learned->key().ToString());
+        } else {
+          ASSERT_TRUE(models[owner] == nullptr);
+        }
+      }
+      ASSERT_TRUE(!learned->Valid());
+    }
+    delete plain;
+    delete learned;
+  }
+  ASSERT_GT(adgMod::levelled_counters[15].Sum(), skipped);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) { return leveldb::test::RunAllTests(); }
@@ -8,6 +8,28 @@ namespace leveldb {
 
 Env::~Env() {}
 
+Status Env::MultiRead(RandomAccessFile* const* files, ReadRequest* requests,
+                      size_t num) {
+  Status result;
+  for (size_t i = 0; i < num; i++) {
+    Status s = files[i]->MultiRead(&requests[i], 1);
+    if (result.ok()) result = s;
+  }
+  return result;
+}
+
+Status Env::NewDirectRandomAccessFile(const std::string& fname,
+                                      RandomAccessFile** result) {
+  *result = nullptr;
+  return Status::NotSupported("NewDirectRandomAccessFile", fname);
+}
+
+Status Env::NewMappedRandomAccessFile(const std::string& fname,
+                                      RandomAccessFile** result) {
+  *result = nullptr;
+  return Status::NotSupported("NewMappedRandomAccessFile", fname);
+}
+
 Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
@@ -16,6 +38,16 @@ SequentialFile::~SequentialFile() {}
 
 RandomAccessFile::~RandomAccessFile() {}
 
+Status RandomAccessFile::MultiRead(ReadRequest* requests, size_t num) const {
+  Status result;
+  for (size_t i = 0; i < num; i++) {
+    ReadRequest* r = &requests[i];
+    r->status = Read(r->offset, r->n, &r->result, r->scratch);
+    if (result.ok()) result = r->status;
+  }
+  return result;
+}
+
 WritableFile::~WritableFile() {}
 
 Logger::~Logger() {}
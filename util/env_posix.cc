@@ -8,11 +8,13 @@
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <x86intrin.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
@@ -21,12 +23,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <set>
 #include <string>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 #include <db/db_impl.h>
 #include <db/version_edit.h>
 
@@ -41,6 +45,23 @@
 #include "mod/util.h"
 #include "mod/learned_index.h"
 
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define LEVELDB_HAVE_IO_URING 1
+#endif
+#endif
+
+#if LEVELDB_HAVE_IO_URING
+// Old libc headers may lack the syscall numbers of kernels that have the ring.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#endif
+
 namespace leveldb {
 
 namespace {
@@ -56,6 +77,15 @@ int g_mmap_limit = kDefaultMmapLimit;
 
 constexpr const size_t kWritableFileBufferSize = 65536;
 
+// O_DIRECT reads are aligned to this, which covers both 512 B and 4 KB
+// logical sectors.
+constexpr const size_t kDirectIOAlignment = 4096;
+
+// Size and number of the aligned buffers that direct reads go through.  A
+// learned lookup reads at most a block, so one buffer almost always suffices.
+constexpr const size_t kDirectBufferSize = 4 * kDirectIOAlignment;
+constexpr const int kDirectBufferCount = 256;
+
 Status PosixError(const std::string& context, int error_number) {
   if (error_number == ENOENT) {
     return Status::NotFound(context, std::strerror(error_number));
@@ -100,6 +130,194 @@ class Limiter {
   std::atomic<int> acquires_allowed_;
 };
 
+// Keeps a batch of preads in flight together through an io_uring, talking to
+// the kernel with raw syscalls so that liburing is not needed.
+//
+// Each thread gets its own ring from ThreadLocal(), so Read() needs no
+// locking.  If the kernel refuses to set up a ring, ThreadLocal() returns
+// nullptr from then on and callers read the blocks one by one.
+class IoUring {
+ public:
+  // Number of reads in flight at once.
+  static constexpr unsigned kDepth = 64;
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  ~IoUring() {
+#if LEVELDB_HAVE_IO_URING
+    if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0) ::close(ring_fd_);
+#endif
+  }
+
+  // The calling thread's ring, or nullptr if io_uring is not available.
+  static IoUring* ThreadLocal() {
+    static std::atomic<bool> unavailable(false);
+    if (unavailable.load(std::memory_order_relaxed)) return nullptr;
+    thread_local std::unique_ptr<IoUring> ring;
+    if (ring == nullptr) {
+      std::unique_ptr<IoUring> new_ring(new IoUring());
+      if (!new_ring->Setup()) {
+        unavailable.store(true, std::memory_order_relaxed);
+        return nullptr;
+      }
+      ring = std::move(new_ring);
+    }
+    return ring.get();
+  }
+
+  // Performs requests[i] on fds[i] for every i < num.  A request whose fd is
+  // negative, or that the ring fails, is read with files[i]->Read() instead.
+  // Returns the first non-OK status, if any.
+  Status Read(const int* fds, const RandomAccessFile* const* files,
+              ReadRequest* requests, size_t num) {
+    std::vector<bool> fallback(num, false);
+#if LEVELDB_HAVE_IO_URING
+    size_t next = 0, in_flight = 0, unsubmitted = 0;
+    while (next < num || in_flight > 0) {
+      unsigned tail = *sq_tail_;
+      for (; next < num && in_flight < kDepth; next++) {
+        if (fds[next] < 0) {
+          fallback[next] = true;
+          continue;
+        }
+        unsigned index = tail & *sq_mask_;
+        struct io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fds[next];
+        sqe->addr = reinterpret_cast<uint64_t>(requests[next].scratch);
+        sqe->len = static_cast<uint32_t>(requests[next].n);
+        sqe->off = requests[next].offset;
+        sqe->user_data = next;
+        sq_array_[index] = index;
+        tail++;
+        in_flight++;
+        unsubmitted++;
+      }
+      __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+      if (in_flight == 0) break;
+
+      int submitted = ::syscall(__NR_io_uring_enter, ring_fd_, unsubmitted, 1,
+                                IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (submitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        // Nothing was submitted this time: read what is left one by one.
+        unsigned head = tail - unsubmitted;
+        for (unsigned i = head; i != tail; i++) {
+          fallback[sqes_[sq_array_[i & *sq_mask_]].user_data] = true;
+        }
+        in_flight -= unsubmitted;
+        unsubmitted = 0;
+        __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+        if (in_flight == 0) {
+          for (; next < num; next++) fallback[next] = true;
+        }
+        continue;
+      }
+      unsubmitted -= submitted;
+
+      unsigned head = *cq_head_;
+      while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        ReadRequest* r = &requests[cqe->user_data];
+        if (cqe->res >= 0) {
+          r->result = Slice(r->scratch, cqe->res);
+          r->status = Status::OK();
+        } else {
+          fallback[cqe->user_data] = true;
+        }
+        head++;
+        in_flight--;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+#else
+    fallback.assign(num, true);
+#endif
+
+    Status result;
+    for (size_t i = 0; i < num; i++) {
+      ReadRequest* r = &requests[i];
+      if (fallback[i]) {
+        r->status = files[i]->Read(r->offset, r->n, &r->result, r->scratch);
+      }
+      if (result.ok()) result = r->status;
+    }
+    return result;
+  }
+
+ private:
+  IoUring() = default;
+
+  bool Setup() {
+#if LEVELDB_HAVE_IO_URING
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd_ = ::syscall(__NR_io_uring_setup, kDepth, &params);
+    if (ring_fd_ < 0) return false;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    void* sq_ring = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) return false;
+    sq_ring_ = static_cast<char*>(sq_ring);
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      void* cq_ring = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED) return false;
+      cq_ring_ = static_cast<char*>(cq_ring);
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    sq_tail_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq_ring_ + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq_ring_ + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq_ring_ + params.cq_off.cqes);
+    return params.sq_entries >= kDepth && params.cq_entries >= kDepth;
+#else
+    return false;
+#endif
+  }
+
+#if LEVELDB_HAVE_IO_URING
+  int ring_fd_ = -1;
+  char* sq_ring_ = nullptr;
+  char* cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  struct io_uring_cqe* cqes_ = nullptr;
+#endif
+};
+
 // Implements sequential read access in a file using read().
 //
 // Instances of this class are thread-friendly but not thread-safe, as required
@@ -194,10 +412,156 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     return status;
   }
 
+  // Keeps the reads in flight together when adgMod::use_io_uring is set.
+  Status MultiRead(ReadRequest* requests, size_t num) const override {
+    IoUring* ring = (adgMod::use_io_uring && has_permanent_fd_)
+                        ? IoUring::ThreadLocal()
+                        : nullptr;
+    if (ring == nullptr) return RandomAccessFile::MultiRead(requests, num);
+    std::vector<int> fds(num, fd_);
+    std::vector<const RandomAccessFile*> files(num, this);
+    return ring->Read(fds.data(), files.data(), requests, num);
+  }
+
+  // The descriptor every read goes through, or -1 if each read opens one.
+  int fd() const { return fd_; }
+
+ private:
+  const bool has_permanent_fd_;  // If false, the file is opened on every read.
+  const int fd_;                 // -1 if has_permanent_fd_ is false.
+  Limiter* const fd_limiter_;
+  const std::string filename_;
+};
+
+// A bounded set of kDirectBufferSize buffers aligned for O_DIRECT.  Acquire()
+// blocks while all of them are in use, so direct reads never hold more than
+// kDirectBufferCount of them, however many threads read.
+class AlignedBufferPool {
+ public:
+  AlignedBufferPool() : available_(&mu_), num_allocated_(0) {}
+
+  AlignedBufferPool(const AlignedBufferPool&) = delete;
+  AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+  ~AlignedBufferPool() {
+    assert(free_.size() == static_cast<size_t>(num_allocated_));
+    for (char* buffer : free_) std::free(buffer);
+  }
+
+  // Returns nullptr if a new buffer cannot be allocated.
+  char* Acquire() {
+    MutexLock lock(&mu_);
+    while (free_.empty() && num_allocated_ == kDirectBufferCount) {
+      available_.Wait();
+    }
+    if (!free_.empty()) {
+      char* buffer = free_.back();
+      free_.pop_back();
+      return buffer;
+    }
+    void* buffer;
+    if (::posix_memalign(&buffer, kDirectIOAlignment, kDirectBufferSize) != 0) {
+      return nullptr;
+    }
+    num_allocated_++;
+    return static_cast<char*>(buffer);
+  }
+
+  void Release(char* buffer) {
+    MutexLock lock(&mu_);
+    free_.push_back(buffer);
+    available_.Signal();
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar available_ GUARDED_BY(mu_);
+  std::vector<char*> free_ GUARDED_BY(mu_);
+  int num_allocated_ GUARDED_BY(mu_);
+};
+
+// Implements random read access in a file opened with O_DIRECT.  Reads are
+// widened to kDirectIOAlignment, done into a buffer from |buffer_pool| and
+// the requested bytes copied out to scratch.
+//
+// Instances of this class are thread-safe, as required by the RandomAccessFile
+// API.
+class PosixDirectRandomAccessFile final : public RandomAccessFile {
+ public:
+  // The new instance takes ownership of |fd|, which must have been opened
+  // with O_DIRECT. |fd_limiter| and |buffer_pool| must outlive this instance.
+  PosixDirectRandomAccessFile(std::string filename, int fd, Limiter* fd_limiter,
+                              AlignedBufferPool* buffer_pool)
+      : has_permanent_fd_(fd_limiter->Acquire()),
+        fd_(has_permanent_fd_ ? fd : -1),
+        fd_limiter_(fd_limiter),
+        buffer_pool_(buffer_pool),
+        filename_(std::move(filename)) {
+    if (!has_permanent_fd_) {
+      assert(fd_ == -1);
+      ::close(fd);  // The file will be opened on every read.
+    }
+  }
+
+  ~PosixDirectRandomAccessFile() override {
+    if (has_permanent_fd_) {
+      assert(fd_ != -1);
+      ::close(fd_);
+      fd_limiter_->Release();
+    }
+  }
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    int fd = fd_;
+    if (!has_permanent_fd_) {
+      fd = ::open(filename_.c_str(), O_RDONLY | O_DIRECT);
+      if (fd < 0) {
+        return PosixError(filename_, errno);
+      }
+    }
+    char* buffer = buffer_pool_->Acquire();
+
+    Status status;
+    size_t done = 0;
+    if (buffer == nullptr) {
+      status = Status::IOError(filename_, "cannot allocate direct I/O buffer");
+    }
+    while (status.ok() && done < n) {
+      const uint64_t position = offset + done;
+      const uint64_t aligned = position & ~(kDirectIOAlignment - 1);
+      const size_t skip = position - aligned;
+      const size_t wanted = (skip + n - done + kDirectIOAlignment - 1) &
+                            ~(kDirectIOAlignment - 1);
+      const size_t length = std::min(kDirectBufferSize, wanted);
+      ssize_t read_size =
+          ::pread(fd, buffer, length, static_cast<off_t>(aligned));
+      if (read_size < 0) {
+        status = PosixError(filename_, errno);
+        break;
+      }
+      if (static_cast<size_t>(read_size) <= skip) break;  // End of file.
+      const size_t copied = std::min(read_size - skip, n - done);
+      std::memcpy(scratch + done, buffer + skip, copied);
+      done += copied;
+      if (static_cast<size_t>(read_size) < length) break;  // End of file.
+    }
+    *result = Slice(scratch, done);
+
+    if (buffer != nullptr) buffer_pool_->Release(buffer);
+    if (!has_permanent_fd_) {
+      // Close the temporary file descriptor opened earlier.
+      assert(fd != fd_);
+      ::close(fd);
+    }
+    return status;
+  }
+
  private:
   const bool has_permanent_fd_;  // If false, the file is opened on every read.
   const int fd_;                 // -1 if has_permanent_fd_ is false.
   Limiter* const fd_limiter_;
+  AlignedBufferPool* const buffer_pool_;
   const std::string filename_;
 };
 
@@ -516,30 +880,30 @@ class PosixEnv : public Env {
       return PosixError(filename, errno);
     }
 
-    if (!mmap_limiter_.Acquire() || filename.find("vlog") != std::string::npos) {
+    // Tables are read through io_uring with pread semantics, so they are not
+    // mapped when it is in use.  Acquire the mmap slot last so that files
+    // that are not mapped do not hold one.
+    if (adgMod::use_io_uring || filename.find("vlog") != std::string::npos ||
+        !mmap_limiter_.Acquire()) {
       posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
       *result = new PosixRandomAccessFile(filename, fd, &fd_limiter_);
       return Status::OK();
     }
-    uint64_t file_size;
-    Status status = GetFileSize(filename, &file_size);
-    if (status.ok()) {
-      void* mmap_base =
-          ::mmap(/*addr=*/nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
-      if (mmap_base != MAP_FAILED) {
-        *result = new PosixMmapReadableFile(filename,
-                                            reinterpret_cast<char*>(mmap_base),
-                                            file_size, &mmap_limiter_);
-      } else {
-        status = PosixError(filename, errno);
-      }
+    return MapReadableFile(filename, fd, result);
+  }
+
+  Status NewMappedRandomAccessFile(const std::string& filename,
+                                   RandomAccessFile** result) override {
+    *result = nullptr;
+    if (!mmap_limiter_.Acquire()) {
+      return Status::NotSupported("too many mapped files", filename);
     }
-    ::close(fd);
-    if (!status.ok()) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
       mmap_limiter_.Release();
+      return PosixError(filename, errno);
     }
-    return status;
-
+    return MapReadableFile(filename, fd, result);
   }
 
 
@@ -565,6 +929,38 @@ class PosixEnv : public Env {
     ::close(fd);
   }
 
+  Status NewDirectRandomAccessFile(const std::string& filename,
+                                   RandomAccessFile** result) override {
+    *result = nullptr;
+#ifdef O_DIRECT
+    int fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+      if (errno == EINVAL) {
+        // The filesystem does not support direct I/O, e.g. tmpfs.
+        return Status::NotSupported("O_DIRECT", filename);
+      }
+      return PosixError(filename, errno);
+    }
+    *result = new PosixDirectRandomAccessFile(filename, fd, &fd_limiter_,
+                                              &direct_buffer_pool_);
+    return Status::OK();
+#else
+    return Status::NotSupported("O_DIRECT", filename);
+#endif
+  }
+
+  Status MultiRead(RandomAccessFile* const* files, ReadRequest* requests,
+                   size_t num) override {
+    IoUring* ring = adgMod::use_io_uring ? IoUring::ThreadLocal() : nullptr;
+    if (ring == nullptr) return Env::MultiRead(files, requests, num);
+    std::vector<int> fds(num);
+    for (size_t i = 0; i < num; i++) {
+      const PosixRandomAccessFile* file =
+          dynamic_cast<const PosixRandomAccessFile*>(files[i]);
+      fds[i] = (file != nullptr) ? file->fd() : -1;
+    }
+    return ring->Read(fds.data(), files, requests, num);
+  }
 
 
 
@@ -785,7 +1181,6 @@ class PosixEnv : public Env {
   // examine items in the learning_prepare queue to decide which ones to learn
   void PrepareLearn() {
     adgMod::Stats* instance = adgMod::Stats::GetInstance();
-    std::priority_queue<std::pair<double, LearnParam>> learn_pq;
     bool wait_for_time = false;
     int64_t time_diff = 1000000;
     prepare_queue_mutex.Lock();
@@ -813,21 +1208,13 @@ class PosixEnv : public Env {
 
         learning_prepare.pop();
         double score = adgMod::learn_cb_model->CalculateCB(level, front.second.second->file_size);
-        if (score > CBModel_Learn::const_size_to_cost) learn_pq.push(std::make_pair(score, front));
-      }
-
-      // items in learn_pq is ranked by its CBA score, larger meaning that
-      // CBA predicts the learning benefit to be larger
-      // Learn the file with the largest score first
-      while (!learn_pq.empty()) {
-        auto& top = learn_pq.top().second;
-        int level = top.second.first;
-        FileMetaData* meta = top.second.second;
-        adgMod::LearnedIndexData* model = adgMod::file_data->GetModel(meta->number);
-        prepare_queue_mutex.Unlock();
-        adgMod::LearnedIndexData::FileLearn(new adgMod::MetaAndSelf{nullptr, 0, meta, model, level});
-        prepare_queue_mutex.Lock();
-        learn_pq.pop();
+        if (score > CBModel_Learn::const_size_to_cost) {
+          // items in learn_pq is ranked by its CBA score, larger meaning that
+          // CBA predicts the learning benefit to be larger.
+          // The learning workers learn the file with the largest score first
+          if (learn_pq.empty()) learn_pq_cv.SignalAll();
+          learn_pq.push(std::make_pair(score, front));
+        }
       }
 
       // if we decide to wait, sleep here
@@ -844,11 +1231,65 @@ class PosixEnv : public Env {
     env->PrepareLearn();
   }
 
+  // learning worker: learn files from learn_pq, sleeping after each one as
+  // long as needed to keep the workers within learn_cpu_share of the cores
+  void LearnWorkerMain(int worker, double max_busy_fraction) {
+    adgMod::LearnWorkerStats& stats = adgMod::learn_worker_stats[worker];
+    prepare_queue_mutex.Lock();
+
+    // dead loop
+    while (true) {
+      while (learn_pq.empty()) {
+        learn_pq_cv.Wait();
+      }
+      LearnParam param = learn_pq.top().second;
+      learn_pq.pop();
+      prepare_queue_mutex.Unlock();
+
+      int level = param.second.first;
+      FileMetaData* meta = param.second.second;
+      adgMod::LearnedIndexData* model = adgMod::file_data->GetModel(meta->number);
+      uint64_t start = NowMicros();
+      adgMod::LearnedIndexData::FileLearn(new adgMod::MetaAndSelf{nullptr, 0, meta, model, level});
+      uint64_t busy = NowMicros() - start;
+      stats.num_learned.fetch_add(1);
+      stats.learn_time.fetch_add(busy);
+
+      if (max_busy_fraction < 1) {
+        uint64_t idle = busy * (1 / max_busy_fraction - 1);
+        SleepForMicroseconds((int) idle);
+        stats.throttle_time.fetch_add(idle);
+      }
+      prepare_queue_mutex.Lock();
+    }
+  }
+
+  static void LearnWorkerEntryPoint(PosixEnv* env, int worker, double max_busy_fraction) {
+    env->LearnWorkerMain(worker, max_busy_fraction);
+  }
+
+  void StartLearnWorkers() EXCLUSIVE_LOCKS_REQUIRED(prepare_queue_mutex) {
+    int cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+    int workers = adgMod::learn_workers > 0 ? adgMod::learn_workers : cores;
+    double max_busy_fraction = adgMod::learn_cpu_share * cores / workers;
+    adgMod::learn_worker_stats = std::vector<adgMod::LearnWorkerStats>(workers);
+    for (int i = 0; i < workers; ++i) {
+      std::thread worker(PosixEnv::LearnWorkerEntryPoint, this, i, max_busy_fraction);
+      worker.detach();
+    }
+  }
+
   void PrepareLearning(uint64_t time_start, int level, FileMetaData* meta) {
     if (adgMod::fresh_write || (adgMod::MOD != 6 && adgMod::MOD != 7 && adgMod::MOD != 9)) return;
+    // learned while the table was built
+    if (adgMod::file_data->GetModel(meta->number)->Learned()) {
+      delete meta;
+      return;
+    }
     MutexLock guard(&prepare_queue_mutex);
     if (!preparing_thread_started) {
         preparing_thread_started = true;
+        StartLearnWorkers();
         std::thread background_thread(PosixEnv::PrepareLearnEntryPoint, this);
         background_thread.detach();
     }
@@ -907,19 +1348,47 @@ class PosixEnv : public Env {
   // learning_prepare is filled by the background compaction thread
   // when new file is generated. It is consumed by a learning prepare thread
   // that examins the items to decide if an actual learning should be issued.
-  // (Learning is done by another background learning thread, so we have 4 threads in total
-  // taking the foreground main thread into account.)
+  // The files to learn are put into learn_pq, from which a pool of learn_workers
+  // learning workers take them.
   typedef std::pair<uint64_t, std::pair<int, FileMetaData*>> LearnParam;
   port::Mutex prepare_queue_mutex;
   std::queue<LearnParam> learning_prepare;
   bool preparing_thread_started;
   port::CondVar preparing_queue_cv;
+  std::priority_queue<std::pair<double, LearnParam>> learn_pq GUARDED_BY(prepare_queue_mutex);
+  port::CondVar learn_pq_cv;
+
 
 
+  // Maps the file open at fd, which is closed.  The caller must have acquired
+  // an mmap slot, which the returned file keeps, or which is released on
+  // failure.
+  Status MapReadableFile(const std::string& filename, int fd,
+                         RandomAccessFile** result) {
+    uint64_t file_size;
+    Status status = GetFileSize(filename, &file_size);
+    if (status.ok()) {
+      void* mmap_base =
+          ::mmap(/*addr=*/nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mmap_base != MAP_FAILED) {
+        *result = new PosixMmapReadableFile(filename,
+                                            reinterpret_cast<char*>(mmap_base),
+                                            file_size, &mmap_limiter_);
+      } else {
+        status = PosixError(filename, errno);
+      }
+    }
+    ::close(fd);
+    if (!status.ok()) {
+      mmap_limiter_.Release();
+    }
+    return status;
+  }
 
   PosixLockTable locks_;  // Thread-safe.
   Limiter mmap_limiter_;  // Thread-safe.
   Limiter fd_limiter_;    // Thread-safe.
+  AlignedBufferPool direct_buffer_pool_;  // Thread-safe.
 };
 
 // Return the maximum number of concurrent mmaps.
@@ -952,6 +1421,7 @@ PosixEnv::PosixEnv()
       started_learn_thread_(false),
       preparing_queue_cv(&prepare_queue_mutex),
       preparing_thread_started(false),
+      learn_pq_cv(&prepare_queue_mutex),
       mmap_limiter_(/*MaxMmaps()*/ adgMod::fd_limit),
       fd_limiter_(MaxOpenFiles()) {
         compaction_awaiting.store(0);
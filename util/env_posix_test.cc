@@ -2,9 +2,13 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <vector>
+
 #include "leveldb/env.h"
+#include "mod/util.h"
 #include "port/port.h"
 #include "util/env_posix_test_helper.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -55,6 +59,185 @@ TEST(EnvPosixTest, TestOpenOnRead) {
   ASSERT_OK(env_->DeleteFile(test_file));
 }
 
+TEST(EnvPosixTest, TestDirectRead) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/direct_read.txt";
+
+  // Not a multiple of the alignment, and longer than one aligned buffer.
+  std::string data;
+  for (int i = 0; i < 40000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  FILE* f = fopen(test_file.c_str(), "w");
+  ASSERT_TRUE(f != nullptr);
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+
+  // More files than read-only descriptors, to cover open-on-read too.
+  const int kNumFiles = kReadOnlyFileLimit + 2;
+  leveldb::RandomAccessFile* files[kNumFiles] = {0};
+  for (int i = 0; i < kNumFiles; i++) {
+    Status s = env_->NewDirectRandomAccessFile(test_file, &files[i]);
+    if (s.IsNotSupportedError()) {
+      fprintf(stderr, "skipping TestDirectRead: %s\n", s.ToString().c_str());
+      ASSERT_OK(env_->DeleteFile(test_file));
+      return;
+    }
+    ASSERT_OK(s);
+  }
+
+  struct {
+    uint64_t offset;
+    size_t n;
+  } reads[] = {{0, 1}, {4095, 2}, {100, 300}, {1, 30000}, {39990, 10},
+               {39990, 100}, {40000, 10}, {50000, 10}};
+  std::string scratch(30000, '\0');
+  for (int i = 0; i < kNumFiles; i++) {
+    for (const auto& read : reads) {
+      Slice result;
+      ASSERT_OK(files[i]->Read(read.offset, read.n, &result, &scratch[0]));
+      size_t expected = read.offset >= data.size()
+                            ? 0
+                            : std::min(read.n, data.size() - read.offset);
+      ASSERT_EQ(expected, result.size());
+      ASSERT_EQ(data.substr(std::min<size_t>(read.offset, data.size()),
+                            expected),
+                result.ToString());
+    }
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    delete files[i];
+  }
+  ASSERT_OK(env_->DeleteFile(test_file));
+}
+
+TEST(EnvPosixTest, TestMappedRead) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/mapped_read.txt";
+
+  std::string data;
+  for (int i = 0; i < 10000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_OK(WriteStringToFile(env_, data, test_file));
+
+  leveldb::RandomAccessFile* file;
+  Status s = env_->NewMappedRandomAccessFile(test_file, &file);
+  if (s.IsNotSupportedError()) {
+    fprintf(stderr, "skipping TestMappedRead: %s\n", s.ToString().c_str());
+    ASSERT_OK(env_->DeleteFile(test_file));
+    return;
+  }
+  ASSERT_OK(s);
+
+  // Reads need no scratch, and the slices stay valid with the file.
+  Slice first, second;
+  ASSERT_OK(file->Read(4000, 300, &first, nullptr));
+  ASSERT_OK(file->Read(9000, 1000, &second, nullptr));
+  ASSERT_EQ(data.substr(4000, 300), first.ToString());
+  ASSERT_EQ(data.substr(9000, 1000), second.ToString());
+  ASSERT_TRUE(!file->Read(9990, 20, &first, nullptr).ok());
+  delete file;
+  ASSERT_OK(env_->DeleteFile(test_file));
+}
+
+TEST(EnvPosixTest, TestMultiReadIoUring) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read.txt";
+
+  std::string data;
+  for (int i = 0; i < 10000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_OK(WriteStringToFile(env_, data, test_file));
+
+  const bool saved_use_io_uring = adgMod::use_io_uring;
+  adgMod::use_io_uring = true;
+
+  // Past the read-only descriptor limit files open on every read, and a
+  // mapped file has no descriptor at all: neither can go through the ring,
+  // so their reads fall back to Read().
+  std::vector<RandomAccessFile*> files;
+  for (int i = 0; i < kReadOnlyFileLimit + 2; i++) {
+    RandomAccessFile* file;
+    ASSERT_OK(env_->NewRandomAccessFile(test_file, &file));
+    files.push_back(file);
+  }
+  RandomAccessFile* mapped = nullptr;
+  if (env_->NewMappedRandomAccessFile(test_file, &mapped).ok()) {
+    files.push_back(mapped);
+  }
+
+  // More requests than the ring keeps in flight at once, some of them
+  // running past the end of the file or starting beyond it.
+  Random rnd(301);
+  const int kNumRequests = 300;
+  std::vector<RandomAccessFile*> request_files(kNumRequests);
+  std::vector<ReadRequest> requests(kNumRequests);
+  std::vector<std::string> scratch(kNumRequests);
+  for (int i = 0; i < kNumRequests; i++) {
+    request_files[i] = files[rnd.Uniform(files.size())];
+    ReadRequest* r = &requests[i];
+    switch (i % 3) {
+      case 0:
+        r->offset = rnd.Uniform(data.size());
+        r->n = 1 + rnd.Uniform(data.size() - r->offset);
+        break;
+      case 1:
+        r->offset = data.size() - 1 - rnd.Uniform(100);
+        r->n = 100 + rnd.Uniform(100);
+        break;
+      default:
+        r->offset = data.size() + rnd.Uniform(2);
+        r->n = 1 + rnd.Uniform(100);
+        break;
+    }
+    // mapped reads need no scratch, and are not allowed past the end
+    if (request_files[i] == mapped) {
+      if (r->offset >= data.size()) r->offset = data.size() - 1;
+      r->n = std::min<size_t>(r->n, data.size() - r->offset);
+    }
+    scratch[i].resize(r->n);
+    r->scratch = &scratch[i][0];
+  }
+
+  auto check = [&](int i) {
+    const ReadRequest& r = requests[i];
+    ASSERT_OK(r.status);
+    size_t expected = r.offset >= data.size()
+                          ? 0
+                          : std::min(r.n, data.size() - r.offset);
+    ASSERT_EQ(expected, r.result.size());
+    ASSERT_EQ(data.substr(std::min<size_t>(r.offset, data.size()), expected),
+              r.result.ToString());
+  };
+
+  ASSERT_OK(env_->MultiRead(request_files.data(), requests.data(),
+                            kNumRequests));
+  for (int i = 0; i < kNumRequests; i++) {
+    check(i);
+  }
+
+  // The same requests on one file with a descriptor, through its own batch.
+  for (int i = 0; i < kNumRequests; i++) {
+    requests[i].result = Slice();
+    requests[i].status = Status::Corruption("not read");
+  }
+  ASSERT_OK(files[0]->MultiRead(requests.data(), kNumRequests));
+  for (int i = 0; i < kNumRequests; i++) {
+    check(i);
+  }
+
+  adgMod::use_io_uring = saved_use_io_uring;
+  for (RandomAccessFile* file : files) {
+    delete file;
+  }
+  ASSERT_OK(env_->DeleteFile(test_file));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {